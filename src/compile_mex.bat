@@ -68,7 +68,8 @@ SET MEX_EXT="dll"
 IF %BITS%==64 (
 SET MATLIB=C:\SVN\pracompila\ML2010a_w64\lib\win64\microsoft
 SET MATINC=C:\SVN\pracompila\ML2010a_w64\include
-SET _MX_COMPAT=-DMX_COMPAT_32
+REM Do not set MX_COMPAT_32 here: 64-bit mwSize/mwIndex are needed for objects with more than 2^31 elements
+SET _MX_COMPAT=
 SET MEX_EXT="mexw64"
 
 ) ELSE (
@@ -34,21 +34,86 @@
  */
 
 #include "gmtmex.h"
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+#include <sys/stat.h>
 
 extern int GMT_get_V (char arg);	/* Temporary here to allow full debug messaging */
 
+/* MATLAB thread-based pools (backgroundPool, parpool ('threads')) may call us from several threads
+ * at once.  A GMT session is not thread safe, so every calling thread gets its own persistent session,
+ * and a session handle may only be used by the thread that created it.  The few tables shared by all
+ * threads (sessions, jobs, warm sessions) are guarded by state_lock, which is only held for short table
+ * updates and never across a GMT or MATLAB call that may raise an error. */
+
+static gmtmex_mutex_t state_lock = GMTMEX_MUTEX_INITIALIZER;
+static GMTMEX_TLS int this_thread;	/* Only its address is used, to tell the calling threads apart */
+
+static void cache_flush (bool all);
+
 #ifndef SINGLE_SESSION
-/* Being declared external we can access it between MEX calls */
-static uintptr_t *pPersistent;    /* To store API address back and forth within a single MATLAB session */
+static struct GMTMEX_SESSION {
+	void *API;                      /* Persistent session, or NULL if the slot is free */
+	void *owner;                    /* &this_thread of the thread that created it */
+} Sessions[GMTMEX_MAX_SESSIONS];
+static GMTMEX_TLS void *this_API = NULL;	/* Persistent session of the calling thread */
+
+static void session_add (void *API) {
+	/* Record the new persistent session of the calling thread */
+	int slot;
+	gmtmex_mutex_lock (&state_lock);
+	for (slot = 0; slot < GMTMEX_MAX_SESSIONS && Sessions[slot].API; slot++);
+	if (slot < GMTMEX_MAX_SESSIONS) Sessions[slot].API = API, Sessions[slot].owner = &this_thread;
+	gmtmex_mutex_unlock (&state_lock);
+	if (slot == GMTMEX_MAX_SESSIONS) {
+		GMT_Destroy_Session (API);
+		mexErrMsgTxt ("GMT: Too many threads with a GMT session. Destroy some with gmt ('destroy') first.\n");
+	}
+	this_API = API;
+}
+
+static void session_remove (void *API) {
+	/* Forget a persistent session that is about to be destroyed */
+	int slot;
+	gmtmex_mutex_lock (&state_lock);
+	for (slot = 0; slot < GMTMEX_MAX_SESSIONS; slot++)
+		if (Sessions[slot].API == API) Sessions[slot].API = Sessions[slot].owner = NULL;
+	gmtmex_mutex_unlock (&state_lock);
+	if (API == this_API) this_API = NULL;
+}
+
+static bool session_owned (void *API) {
+	/* True if API is a live session created by the calling thread */
+	int slot;
+	bool owned = false;
+	gmtmex_mutex_lock (&state_lock);
+	for (slot = 0; slot < GMTMEX_MAX_SESSIONS; slot++)
+		if (Sessions[slot].API && Sessions[slot].API == API) owned = (Sessions[slot].owner == &this_thread);
+	gmtmex_mutex_unlock (&state_lock);
+	return (owned);
+}
 
 /* Here is the exit function, which gets run when the MEX-file is
    cleared and when the user exits MATLAB. The mexAtExit function
-   should always be declared as static. */
+   should always be declared as static.  MATLAB runs it on its main
+   thread once no thread is calling us, so it destroys the sessions
+   of all threads. */
+static void release_all_jobs (void);
+static void unwind_call (void);
 static void force_Destroy_Session (void) {
-	void *API = (void *)pPersistent[0];	/* Get the GMT API pointer */
-	if (API != NULL) {		/* Otherwise just silently ignore this call */
+	int slot;
+	void *API = NULL;
+	unwind_call ();		/* Anything left behind by a call that ended in an error */
+	release_all_jobs ();	/* Any asynchronous jobs run in their own sessions */
+	GMTMEX_Unshare_All ();	/* Segments made by gmt ('share', ...); mappings in other processes stay valid */
+	cache_flush (true);	/* Objects kept by gmt ('cache', ...) */
+	GMTMEX_Stage_Flush ();	/* Buffers kept by gmt ('staging', ...) */
+	for (slot = 0; slot < GMTMEX_MAX_SESSIONS; slot++) {
+		if ((API = Sessions[slot].API) == NULL) continue;	/* Otherwise just silently ignore this slot */
+		GMTMEX_Free_Residents (API);	/* Objects kept by gmt ('register', ...) */
+		session_remove (API);	/* Wipe the persistent memory */
 		if (GMT_Destroy_Session (API)) mexErrMsgTxt ("Failure to destroy GMT session\n");
-		*pPersistent = 0;	/* Wipe the persistent memory */
 	}
 }
 #endif
@@ -67,13 +132,42 @@ static void usage (int nlhs, int nrhs) {
 	}
 	else {
 		mexPrintf("Usage is:\n\tgmt ('module_name', 'options'[, <matlab arrays>]); %% Run a GMT module\n");
+		mexPrintf("\tf = gmt ('async', 'module_name options'[, <matlab arrays>]); %% Run a GMT module in the background\n");
+		mexPrintf("\tout = gmt ('wait', f); %% Wait for a background module and get its outputs\n");
+		mexPrintf("\t[done, out] = gmt ('ready', f); %% Same, but return done = false at once if still running\n");
+		mexPrintf("\tI = gmt ('colorize', G, cpt); %% Turn a grid into an RGB(A) image using a color palette\n");
+		mexPrintf("\tG = gmt ('wrapgrid', Z, head); %% Make a grid structure from a 2-D array and a 1x9 header vector\n");
+		mexPrintf("\tD = gmt ('wrapseg', {seg1, seg2, ...}[, headers, text, comm, proj_s, wkt_s]); %% Make a dataset structure\n");
+		mexPrintf("\tR = gmt ('record', data, text); %% Make a dataset structure with numeric and text records\n");
+		mexPrintf("\tall = gmt ('catseg', D[, 1]); %% Merge all data segments into one matrix, optionally NaN-separated\n");
+		mexPrintf("\tcpt = gmt ('catcpt', cpt1, cpt2); %% Join two color palette structures\n");
+		mexPrintf("\tM = gmt ('matrix', 'single', 'module_name options'[, <matlab arrays>]); %% Return table output as a bare single, double, int32, ... matrix\n");
+		mexPrintf("\tG = gmt ('layout', 'TRF', 'module_name options'[, <matlab arrays>]); %% Return grids in GMT row order (z is n_columns x n_rows)\n");
+		mexPrintf("\tD = gmt ('segments', 'single', 'module_name options'[, <matlab arrays>]); %% Return dataset segment data as single\n");
+		mexPrintf("\tout = gmt ('stack', 'module_name options', S[, <matlab arrays>]); %% Run a GMT module on every layer of a 3-D grid\n");
+		mexPrintf("\tout = gmt ('map'[, n_workers], 'module_name options', {in1, in2, ...}[, <matlab arrays>]); %% Run a GMT module on every item of a cell array\n");
+		mexPrintf("\tG = gmt ('tile'[, halo], 'module_name options', G[, <matlab arrays>]); %% Run a grid module on bands of rows in parallel and stitch the output\n");
+		mexPrintf("\th = gmt ('register', obj); %% Convert obj once and keep it in the session; pass h instead of obj\n");
+		mexPrintf("\tgmt ('unregister', h); %% Release a registered object\n");
+		mexPrintf("\tgmt ('save', obj, file); %% Write an object to a native binary file\n");
+		mexPrintf("\tobj = gmt ('load', file); %% Read a native file; add 'resident' to keep it in the session instead (matrices and images stay mapped)\n");
+		mexPrintf("\tgmt ('share', obj, name); %% Put a grid, image or matrix in shared memory for other processes on this host\n");
+		mexPrintf("\th = gmt ('attach', name); %% Use a shared object without copying it; pass h as input, release with gmt ('unregister', h)\n");
+		mexPrintf("\tgmt ('unshare', name); %% Remove a shared object (it is also removed when the sharing MEX file is cleared)\n");
+		mexPrintf("\tL = gmt ('registered'); %% List the registered objects and their memory\n");
+		mexPrintf("\tgmt ('warm'[, n]); %% Start n GMT sessions ahead of time so that later calls do not pay the startup\n");
+		mexPrintf("\tgmt ('log', 'keep'); %% Keep GMT messages instead of printing them: console (default), buffer (print once per call) or keep\n");
+		mexPrintf("\tL = gmt ('log'); %% Return the kept messages with their time, level and module\n");
+		mexPrintf("\tS = gmt ('cache', bytes); %% Keep up to bytes of gmtread outputs and reuse them while the file is unchanged; 'flush' empties it\n");
+		mexPrintf("\tS = gmt ('staging', 'on'[, keep]); %% Put input grids in reused huge-page buffers; 'prefault' also faults them in, 'off' stops\n");
+		mexPrintf("\tS = gmt ('memstats'); %% Bytes copied and passed by reference by the last call and the session\n");
 		if (nlhs != 0)
 			mexErrMsgTxt ("But meanwhile you already made an error by asking help and an output.\n");
 	}
 }
 
 static void *Initiate_Session (unsigned int verbose) {
-	/* Initialize the GMT Session and store the API pointer in a persistent variable */
+	/* Initialize the GMT Session and, unless single-session, make it the persistent session of this thread */
 	void *API = NULL;
 	/* Initializing new GMT session with a MATLAB-acceptable replacement for the printf function */
 	/* For debugging with verbose we pass the specified verbose shifted by 10 bits - this is decoded in API */
@@ -82,13 +176,136 @@ static void *Initiate_Session (unsigned int verbose) {
 		mexErrMsgTxt ("GMT: Failure to create new GMT session\n");
 
 #ifndef SINGLE_SESSION
-	if (!pPersistent) pPersistent = mxMalloc(sizeof(uintptr_t));
-	pPersistent[0] = (uintptr_t)(API);
-	mexMakeMemoryPersistent (pPersistent);
+	session_add (API);
 #endif
 	return (API);
 }
 
+#ifdef SINGLE_SESSION
+/* Without a persistent session every call would create and destroy a GMT session, paying the full
+ * startup (defaults, gmt.conf, plugins) each time.  Instead, a session whose call ended cleanly is
+ * reset and kept in a small pool of warm sessions for the next call.  The defaults that gmtmex may
+ * change during a call are restored from a snapshot taken when the session was created.  Modules
+ * that change what a session reads at startup (gmt.conf, modern mode) empty the pool. */
+
+#define GMTMEX_POOL_SIZE	4
+
+static const char *pool_keys[] = {"API_PAD", "GMT_EXPORT_TYPE", NULL};	/* Defaults changed by gmtmex */
+#define GMTMEX_POOL_KEYS	2
+static const char *pool_flush_modules[] = {"gmtset", "begin", "end", "figure", "subplot", "inset", "clear", NULL};
+
+static struct GMTMEX_POOLED {
+	void *API;                      /* Warm session, or NULL if the slot is free */
+	bool busy;                      /* true while a call is using it */
+	void *owner;                    /* &this_thread of the thread using it while busy */
+	char snapshot[GMTMEX_POOL_KEYS][GMT_LEN256];	/* Values of pool_keys when the session was created */
+} Pool[GMTMEX_POOL_SIZE];
+
+static int pool_add (void *API, bool busy) {
+	/* Put a new session in a free slot with its snapshot; return the slot or GMT_NOTSET if the pool is full */
+	int slot, k;
+	char snapshot[GMTMEX_POOL_KEYS][GMT_LEN256];
+	for (k = 0; pool_keys[k]; k++) GMT_Get_Default (API, pool_keys[k], snapshot[k]);	/* Before another thread can take it */
+	gmtmex_mutex_lock (&state_lock);
+	for (slot = 0; slot < GMTMEX_POOL_SIZE && Pool[slot].API; slot++);
+	if (slot < GMTMEX_POOL_SIZE) {
+		Pool[slot].API = API;	Pool[slot].busy = busy;	Pool[slot].owner = (busy) ? &this_thread : NULL;
+		memcpy (Pool[slot].snapshot, snapshot, sizeof (snapshot));
+	}
+	gmtmex_mutex_unlock (&state_lock);
+	return ((slot < GMTMEX_POOL_SIZE) ? slot : GMT_NOTSET);
+}
+
+static void pool_release (void *API, bool recycle) {
+	/* A call is done with API: reset it for the next call, or destroy it if it cannot be trusted */
+	int slot, k;
+	char value[GMT_LEN256] = {""};
+	gmtmex_mutex_lock (&state_lock);
+	for (slot = 0; slot < GMTMEX_POOL_SIZE && Pool[slot].API != API; slot++);
+	if (slot < GMTMEX_POOL_SIZE && !recycle) memset (&Pool[slot], 0, sizeof (struct GMTMEX_POOLED));
+	gmtmex_mutex_unlock (&state_lock);
+	if (slot < GMTMEX_POOL_SIZE && recycle) {	/* Still busy, so no other thread touches the slot */
+		for (k = 0; pool_keys[k]; k++) {	/* Put back any default that was left changed */
+			GMT_Get_Default (API, pool_keys[k], value);
+			if (strcmp (value, Pool[slot].snapshot[k])) GMT_Set_Default (API, pool_keys[k], Pool[slot].snapshot[k]);
+		}
+		gmtmex_mutex_lock (&state_lock);
+		Pool[slot].busy = false;	Pool[slot].owner = NULL;
+		gmtmex_mutex_unlock (&state_lock);
+		return;
+	}
+	if (GMT_Destroy_Session (API)) mexErrMsgTxt ("GMT: Failure to destroy GMT5 session\n");
+}
+
+static void *pool_get (unsigned int verbose) {
+	/* Return an idle warm session, or start a new one (which joins the pool if there is room) */
+	int slot, n_stale = 0;
+	void *API = NULL, *stale[GMTMEX_POOL_SIZE];
+	gmtmex_mutex_lock (&state_lock);
+	for (slot = 0; slot < GMTMEX_POOL_SIZE; slot++) {	/* Still busy with us means our previous call ended in an error */
+		if (!Pool[slot].busy || Pool[slot].owner != &this_thread) continue;
+		stale[n_stale++] = Pool[slot].API;
+		memset (&Pool[slot], 0, sizeof (struct GMTMEX_POOLED));
+	}
+	for (slot = 0; API == NULL && slot < GMTMEX_POOL_SIZE; slot++) {
+		if (Pool[slot].API && !Pool[slot].busy) {
+			Pool[slot].busy = true;	Pool[slot].owner = &this_thread;
+			API = Pool[slot].API;
+		}
+	}
+	gmtmex_mutex_unlock (&state_lock);
+	while (n_stale) GMT_Destroy_Session (stale[--n_stale]);
+	if (API) return (API);
+	API = Initiate_Session (verbose);
+	pool_add (API, true);
+	return (API);
+}
+
+static void pool_flush (void) {
+	/* Destroy all idle sessions */
+	int slot, n_idle = 0;
+	void *idle[GMTMEX_POOL_SIZE];
+	gmtmex_mutex_lock (&state_lock);
+	for (slot = 0; slot < GMTMEX_POOL_SIZE; slot++) {
+		if (Pool[slot].API == NULL || Pool[slot].busy) continue;
+		idle[n_idle++] = Pool[slot].API;
+		memset (&Pool[slot], 0, sizeof (struct GMTMEX_POOLED));
+	}
+	gmtmex_mutex_unlock (&state_lock);
+	while (n_idle) GMT_Destroy_Session (idle[--n_idle]);
+}
+
+static bool pool_keeps (const char *module) {
+	/* False if module changes state that sessions read at startup, in which case the idle ones are stale too */
+	unsigned int k;
+	for (k = 0; pool_flush_modules[k]; k++) {
+		if (strcmp (module, pool_flush_modules[k])) continue;
+		pool_flush ();
+		return (false);
+	}
+	return (true);
+}
+
+static unsigned int pool_warm (unsigned int n, unsigned int verbose) {
+	/* Start sessions until n of them are in the pool; return how many there are */
+	int slot;
+	unsigned int n_warm = 0;
+	void *API = NULL;
+	if (n > GMTMEX_POOL_SIZE) n = GMTMEX_POOL_SIZE;
+	gmtmex_mutex_lock (&state_lock);
+	for (slot = 0; slot < GMTMEX_POOL_SIZE; slot++) if (Pool[slot].API) n_warm++;
+	gmtmex_mutex_unlock (&state_lock);
+	for (; n_warm < n; n_warm++) {	/* Another thread may fill the pool meanwhile; then the extra session is not kept */
+		API = Initiate_Session (verbose);
+		if (pool_add (API, false) == GMT_NOTSET) {
+			GMT_Destroy_Session (API);
+			break;
+		}
+	}
+	return (n_warm);
+}
+#endif
+
 static void *alloc_default_plhs (void *API, struct GMT_RESOURCE *X) {
 	/* Allocate a default plhs when it was not stated in command line. That is, mimic the Matlab behavior
 	   when we do for example (i.e. no lhs):  sqrt([4 9])  
@@ -116,6 +333,1193 @@ static void *alloc_default_plhs (void *API, struct GMT_RESOURCE *X) {
 	return ptr;
 }
 
+static void free_containers (void *API, struct GMT_RESOURCE *X, unsigned int n_items) {
+	/* Close the virtual files and free all GMT containers involved in a module call */
+	unsigned int k, kk;
+	for (k = 0; k < n_items; k++) {
+		void *ppp = X[k].object;
+		if (GMT_Close_VirtualFile (API, X[k].name) != GMT_NOERROR)
+			mexErrMsgTxt ("GMT: Failed to close virtual file\n");
+		if (GMTMEX_Is_Resident (X[k].object))	/* Owned by gmt ('register', ...), so must survive this call */
+			X[k].object = NULL;
+		else if (GMT_Destroy_Data (API, &X[k].object) != GMT_NOERROR)
+			mexErrMsgTxt ("GMT: Failed to destroy object used in the interface between GMT and MATLAB\n");
+		else {	/* Success, now make sure we don't destroy the same pointer more than once */
+			for (kk = k+1; kk < n_items; kk++)
+				if (X[kk].object == ppp) X[kk].object = NULL;
+		}
+	}
+}
+
+/* Asynchronous module calls: gmt ('async', ...) converts the inputs on the main thread into a
+ * separate GMT session, then runs GMT_Call_Module in that session on a background thread.
+ * gmt ('wait', f) and gmt ('ready', f) collect the outputs, again on the main thread, so that
+ * the MATLAB API is never touched from the worker thread.  Messages printed by GMT while the
+ * worker runs are kept in the job and echoed when the job is collected. */
+
+struct GMTMEX_JOB {
+	uint64_t id;                    /* Handle returned to MATLAB */
+	void *API;                      /* The private session of this job */
+	char module[MODULE_LEN];        /* Name of GMT module to call */
+	char *cmd;                      /* Copy of the user's command, for error messages */
+	struct GMT_OPTION *options;     /* Linked list of module options */
+	struct GMT_RESOURCE *X;         /* Array of information about MATLAB args */
+	unsigned int n_items;           /* Number of GMT containers involved */
+	unsigned int n_inputs;          /* Number of duplicated MATLAB inputs */
+	mxArray **input;                /* Private copies of the inputs, so MATLAB cannot free them under us */
+	int status;                     /* Return status from GMT_Call_Module */
+	bool done;                      /* true once the worker has returned */
+	char *log;                      /* Messages produced while the worker was running */
+	size_t log_len, log_alloc;
+	gmtmex_thread_t thread;
+	gmtmex_mutex_t lock;
+};
+
+static struct GMTMEX_JOB *Jobs[GMTMEX_MAX_JOBS];	/* Jobs whose thread has started; guarded by state_lock, since any thread may collect a job */
+static unsigned int jobs_pending = 0;	/* Slots reserved by jobs that are still being set up */
+static uint64_t last_job_id = 0;
+static GMTMEX_TLS struct GMTMEX_JOB *this_job = NULL;	/* Set in the worker thread only */
+
+static int job_print_func (FILE *fp, const char *message) {
+	/* Print function for job sessions.  On the worker thread we may not call mexPrintf,
+	 * so the message is appended to the job log instead. */
+	size_t len;
+	struct GMTMEX_JOB *job = this_job;
+	if (job == NULL)	/* On the main thread, e.g. during input conversion */
+		return (GMTMEX_print_func (fp, message));
+	len = strlen (message);
+	gmtmex_mutex_lock (&job->lock);
+	if (job->log_len + len + 1 > job->log_alloc) {
+		char *tmp = NULL;
+		size_t n_alloc = (job->log_alloc) ? 2 * job->log_alloc : BUFSIZ;
+		while (n_alloc < job->log_len + len + 1) n_alloc *= 2;
+		if ((tmp = realloc (job->log, n_alloc)) != NULL) job->log = tmp, job->log_alloc = n_alloc;
+	}
+	if (job->log_len + len + 1 <= job->log_alloc) {
+		memcpy (&job->log[job->log_len], message, len + 1);
+		job->log_len += len;
+	}
+	gmtmex_mutex_unlock (&job->lock);
+	return 0;
+}
+
+static GMTMEX_THREAD_FUNC (job_worker) {
+	/* Thread function: run the module and flag that we are done */
+	struct GMTMEX_JOB *job = arg;
+	int status;
+	this_job = job;
+	status = GMT_Call_Module (job->API, job->module, GMT_MODULE_OPT, job->options);
+	gmtmex_mutex_lock (&job->lock);
+	job->status = status;
+	job->done = true;
+	gmtmex_mutex_unlock (&job->lock);
+	this_job = NULL;
+	GMTMEX_THREAD_RETURN;
+}
+
+static void release_job (struct GMTMEX_JOB *job);
+
+static struct GMTMEX_JOB *new_job (unsigned int verbose, const mxArray *prhs[], int nrhs) {
+	/* Create a job with its own GMT session and private copies of the MATLAB inputs.  The job reserves a
+	 * slot in Jobs but is only put there by publish_job once its thread runs, so that no other call can
+	 * collect it, or join a thread that does not exist, while it is being set up */
+	int k, slot;
+	unsigned int n_free = 0;
+	bool reserved = false;
+	struct GMTMEX_JOB *job = NULL;
+
+	gmtmex_mutex_lock (&state_lock);
+	for (slot = 0; slot < GMTMEX_MAX_JOBS; slot++) if (Jobs[slot] == NULL) n_free++;
+	if (n_free > jobs_pending) jobs_pending++, reserved = true;
+	gmtmex_mutex_unlock (&state_lock);
+	if (!reserved)
+		mexErrMsgTxt ("GMT: Too many asynchronous jobs. Collect some with gmt ('wait', f) first.\n");
+	if ((job = calloc (1, sizeof (struct GMTMEX_JOB))) == NULL ||
+	    (job->API = GMT_Create_Session (MEX_PROG, 2U, (verbose << 10) + GMT_SESSION_NOEXIT + GMT_SESSION_EXTERNAL +
+	                                    GMT_SESSION_COLMAJOR, job_print_func)) == NULL) {
+		free (job);
+		gmtmex_mutex_lock (&state_lock);
+		jobs_pending--;
+		gmtmex_mutex_unlock (&state_lock);
+		mexErrMsgTxt ("GMT: Failure to create new GMT session for asynchronous job\n");
+	}
+	if (nrhs > 0) {
+		if ((job->input = calloc ((size_t)nrhs, sizeof (mxArray *))) == NULL) {	/* The caller's inputs would not outlive this call */
+			GMT_Destroy_Session (job->API);
+			free (job);
+			gmtmex_mutex_lock (&state_lock);
+			jobs_pending--;
+			gmtmex_mutex_unlock (&state_lock);
+			mexErrMsgTxt ("GMT: Failure to allocate the inputs of an asynchronous job\n");
+		}
+		for (k = 0; k < nrhs; k++) {	/* Duplicate so that the data outlive this mex call */
+			job->input[k] = mxDuplicateArray (prhs[k]);
+			mexMakeArrayPersistent (job->input[k]);
+		}
+		job->n_inputs = (unsigned int)nrhs;
+	}
+	gmtmex_mutex_init (&job->lock);
+	return (job);
+}
+
+static void publish_job (struct GMTMEX_JOB *job) {
+	/* The thread of job has started, so put the job in the slot it reserved and give it its handle */
+	int slot;
+	gmtmex_mutex_lock (&state_lock);
+	for (slot = 0; slot < GMTMEX_MAX_JOBS && Jobs[slot]; slot++);	/* There is one, since it was reserved */
+	job->id = ++last_job_id;
+	Jobs[slot] = job;
+	jobs_pending--;
+	gmtmex_mutex_unlock (&state_lock);
+}
+
+static void drop_job (struct GMTMEX_JOB *job) {
+	/* Free a job whose thread never started and give back its reserved slot */
+	gmtmex_mutex_lock (&state_lock);
+	jobs_pending--;
+	gmtmex_mutex_unlock (&state_lock);
+	release_job (job);
+}
+
+static struct GMTMEX_JOB *claim_job (uint64_t id, bool wait, bool *done) {
+	/* Take job id out of the table so that no other call can collect it, unless wait is false and
+	 * it is still running, in which case done is set to false.  Returns NULL if there is no such job */
+	int slot;
+	struct GMTMEX_JOB *job = NULL;
+	*done = true;
+	gmtmex_mutex_lock (&state_lock);
+	for (slot = 0; slot < GMTMEX_MAX_JOBS && !(Jobs[slot] && Jobs[slot]->id == id); slot++);
+	if (slot < GMTMEX_MAX_JOBS) {
+		job = Jobs[slot];
+		if (!wait) {
+			gmtmex_mutex_lock (&job->lock);
+			*done = job->done;
+			gmtmex_mutex_unlock (&job->lock);
+		}
+		if (*done) Jobs[slot] = NULL;
+	}
+	gmtmex_mutex_unlock (&state_lock);
+	return (job);
+}
+
+static void release_job (struct GMTMEX_JOB *job) {
+	/* Free everything held by a finished job that is no longer in Jobs, including its session */
+	unsigned int k;
+	free_containers (job->API, job->X, job->n_items);
+	GMT_Destroy_Options (job->API, &job->options);
+	GMT_Destroy_Session (job->API);
+	for (k = 0; k < job->n_inputs; k++) mxDestroyArray (job->input[k]);
+	free (job->input);
+	gmtmex_mutex_free (&job->lock);
+	free (job->log);
+	free (job->cmd);
+	free (job);
+}
+
+static void release_all_jobs (void) {
+	/* Exit function: wait for any running workers and free their jobs */
+	int slot;
+	struct GMTMEX_JOB *job = NULL;
+	for (slot = 0; slot < GMTMEX_MAX_JOBS; slot++) {
+		gmtmex_mutex_lock (&state_lock);
+		job = Jobs[slot];	Jobs[slot] = NULL;
+		gmtmex_mutex_unlock (&state_lock);
+		if (job == NULL) continue;
+		gmtmex_thread_join (job->thread);
+		release_job (job);
+	}
+}
+
+static void collect_job (int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[], bool wait) {
+	/* out = gmt ('wait', f) blocks until job f is done and returns its outputs.
+	 * [done, out] = gmt ('ready', f) returns done = false right away if f is still running,
+	 * otherwise it collects the outputs as 'wait' would. */
+	int status, k, pos, offset = (wait) ? 0 : 1;
+	bool done;
+	char message[BUFSIZ] = {""};
+	struct GMTMEX_JOB *job = NULL;
+
+	if (nrhs != 1 || !mxIsScalar_(prhs[0]) || !mxIsUint64 (prhs[0]))
+		mexErrMsgTxt ("GMT: Usage is gmt ('wait', f) or gmt ('ready', f), where f = gmt ('async', ...)\n");
+	if ((job = claim_job (*(uint64_t *)mxGetData (prhs[0]), wait, &done)) == NULL)
+		mexErrMsgTxt ("GMT: Unknown or already collected asynchronous job\n");
+
+	if (!wait) {	/* If not done the job is still in Jobs and we must not touch it */
+		plhs[0] = mxCreateLogicalScalar (done);
+		if (!done) {	/* Still running; MATLAB wants all requested outputs to be assigned */
+			for (k = 1; k < nlhs; k++) plhs[k] = mxCreateDoubleMatrix (0, 0, mxREAL);
+			return;
+		}
+	}
+	gmtmex_thread_join (job->thread);	/* Returns at once if the worker has already finished */
+	GMTMEX_Log_Text (job->log);
+	GMTMEX_Log_Flush ();
+
+	if ((status = job->status) == GMT_NOERROR) {	/* Hook up any GMT outputs to MATLAB plhs array */
+		for (k = 0; k < (int)job->n_items; k++) {
+			if (job->X[k].direction == GMT_IN) continue;
+			pos = job->X[k].pos + offset;
+			if (pos < nlhs || pos == 0)
+				plhs[pos] = GMTMEX_Get_Object (job->API, &job->X[k]);
+		}
+	}
+	else if (status > GMT_MODULE_PURPOSE)
+		snprintf (message, BUFSIZ, "GMT: Module return with failure while executing the command\n%s\n", job->cmd);
+	release_job (job);
+	if (message[0]) mexErrMsgTxt (message);
+}
+
+/* Grid stacks: G = gmt ('stack', 'module options', S[, <matlab arrays>]) runs the module once for each
+ * layer of the grid structure S, whose z is a rows x columns x layers array sharing one header.  The
+ * layers are spread over worker threads that each have their own GMT session, as for async jobs.
+ * Other inputs are converted once per worker and used for all its layers.  Grid outputs come back
+ * as one grid structure with a 3-D z array, other outputs as a cell array with one item per layer.
+ *
+ * Maps: out = gmt ('map'[, n_workers], 'module options', {in1, in2, ...}[, <matlab arrays>]) does the
+ * same for the items of a cell array, which may be of any type the module takes as its first input.
+ * Every output is a cell array shaped like the input cell.
+ *
+ * Tiles: G = gmt ('tile'[, halo], 'module options', G[, <matlab arrays>]) splits the first grid input into
+ * bands of rows, each with halo extra rows above and below, runs the module on every band and copies the
+ * interior rows of the outputs into one output grid.  Other grid inputs of the same size are split the
+ * same way.  The module must return one grid on the same lattice as its input.  The halo is worked out
+ * from the command for the modules in tile_halo, and must be given for others.
+ *
+ * In all cases each worker parses and encodes the options once and only duplicates and expands them for
+ * each item. */
+
+struct GMTMEX_TILING {
+	struct GMT_GRID **full;         /* Whole grid inputs that are cut into tiles, indexed by position (NULL if not) */
+	struct GMT_GRID *out;           /* The stitched output grid */
+	uint64_t halo;                  /* Rows of halo above and below each tile */
+	uint64_t *row;                  /* Tile t has the interior rows row[t] to row[t+1]-1 */
+};
+
+struct GMTMEX_WORKER {
+	struct GMTMEX_JOB *job;         /* Session and message log of this worker */
+	unsigned int worker, n_workers; /* This worker does items worker, worker + n_workers, ... */
+	uint64_t n_total;               /* Number of items (stack layers, cell items or tiles) */
+	const char *module, *args;      /* Module name and options */
+	int n_in_objects;               /* Number of MATLAB inputs */
+	unsigned int item_pos;          /* Position of the grid stack or of the cell among the inputs (UINT_MAX for tiles) */
+	struct GMTMEX_STACK *S;         /* The grid stack, or NULL for a map or tiles */
+	struct GMTMEX_TILING *T;        /* The tiles, or NULL for a stack or map */
+	void **items;                   /* Map inputs converted in their worker session, indexed by item */
+	unsigned int *item_family;      /* Their actual families */
+	struct GMT_OPTION *options;     /* Module options encoded once in this session */
+	struct GMT_RESOURCE *X;         /* Their inputs and outputs */
+	unsigned int n_items;           /* Number of entries in X */
+	unsigned int *opt_index;        /* Position in options of the option of each X[k] */
+	void **shared;                  /* Other inputs converted in this session, indexed by position */
+	unsigned int *shared_family;    /* Their actual families */
+	void **out;                     /* Outputs, indexed by item * n_out + position */
+	unsigned int n_out;             /* Number of outputs per item */
+	int status;                     /* First failure in this worker, if any */
+};
+
+static struct GMT_GRID *layer_grid (void *API, struct GMTMEX_STACK *S, uint64_t layer) {
+	/* Create a padded GMT grid from one layer of the stack */
+	uint64_t ij;
+	struct GMT_GRID *G = NULL;
+	if ((G = GMT_Create_Data (API, GMT_IS_GRID, GMT_IS_SURFACE, GMT_GRID_ALL, NULL, S->range, S->inc,
+	                          S->registration, GMT_NOTSET, NULL)) == NULL)
+		return (NULL);
+	if (G->header->n_rows != S->n_rows || G->header->n_columns != S->n_columns) {
+		GMT_Report (API, GMT_MSG_NORMAL, "GMT: Grid stack dimensions do not agree with its range and increments\n");
+		GMT_Destroy_Data (API, &G);
+		return (NULL);
+	}
+	ij = layer * S->n_rows * S->n_columns;	/* Start of this layer in the MATLAB array */
+	if (S->is_single)
+		GMTMEX_Copy_Grid_In (G, (float *)S->data + ij, true, false, S->nan_value, NULL);
+	else
+		GMTMEX_Copy_Grid_In (G, (double *)S->data + ij, false, false, S->nan_value, NULL);
+	return (G);
+}
+
+static void tile_rows (struct GMTMEX_TILING *T, struct GMT_GRID_HEADER *h, uint64_t tile, uint64_t *r0, uint64_t *r1) {
+	/* Rows r0 to r1-1 of the whole grid make up the tile with its halo */
+	*r0 = (T->row[tile] > T->halo) ? T->row[tile] - T->halo : 0;
+	*r1 = (T->row[tile+1] + T->halo < h->n_rows) ? T->row[tile+1] + T->halo : h->n_rows;
+}
+
+static uint64_t tile_node (struct GMT_GRID_HEADER *h, uint64_t row) {
+	/* Index of the first node of row in a padded grid */
+	return ((row + h->pad[GMT_YHI]) * h->mx + h->pad[GMT_XLO]);
+}
+
+static struct GMT_GRID *tile_grid (void *API, struct GMTMEX_TILING *T, struct GMT_GRID *F, uint64_t tile) {
+	/* Create a padded GMT grid holding one tile and its halo, cut from the whole grid F */
+	uint64_t row, r0, r1;
+	double wesn[4];
+	struct GMT_GRID *G = NULL;
+	struct GMT_GRID_HEADER *h = F->header;
+
+	tile_rows (T, h, tile, &r0, &r1);
+	wesn[GMT_XLO] = h->wesn[GMT_XLO];	wesn[GMT_XHI] = h->wesn[GMT_XHI];
+	wesn[GMT_YHI] = h->wesn[GMT_YHI] - r0 * h->inc[GMT_Y];	/* Rows start in the north */
+	wesn[GMT_YLO] = h->wesn[GMT_YHI] - (r1 - 1 + h->registration) * h->inc[GMT_Y];
+	if ((G = GMT_Create_Data (API, GMT_IS_GRID, GMT_IS_SURFACE, GMT_GRID_ALL, NULL, wesn, h->inc,
+	                          h->registration, GMT_NOTSET, NULL)) == NULL)
+		return (NULL);
+	if (G->header->n_rows != r1 - r0 || G->header->n_columns != h->n_columns) {
+		GMT_Report (API, GMT_MSG_NORMAL, "GMT: Tile dimensions do not agree with the grid\n");
+		GMT_Destroy_Data (API, &G);
+		return (NULL);
+	}
+	G->header->nan_value = h->nan_value;
+	for (row = r0; row < r1; row++)
+		memcpy (&G->data[tile_node (G->header, row - r0)], &F->data[tile_node (h, row)], h->n_columns * sizeof (gmt_grdfloat));
+	return (G);
+}
+
+static int stitch_tile (void *API, struct GMTMEX_TILING *T, uint64_t tile, struct GMT_GRID *O) {
+	/* Copy the interior rows of the output O of one tile into the stitched grid.  Tiles write disjoint rows */
+	uint64_t row, r0, r1;
+	struct GMT_GRID_HEADER *h = T->out->header;
+
+	tile_rows (T, h, tile, &r0, &r1);
+	if (O == NULL || O->header->n_columns != h->n_columns || O->header->n_rows != r1 - r0 || O->header->registration != h->registration ||
+	    fabs (O->header->inc[GMT_Y] - h->inc[GMT_Y]) > 1e-6 * h->inc[GMT_Y] ||
+	    fabs (O->header->wesn[GMT_YHI] - (h->wesn[GMT_YHI] - r0 * h->inc[GMT_Y])) > 0.5 * h->inc[GMT_Y]) {
+		GMT_Report (API, GMT_MSG_NORMAL, "GMT: The module output is not on the lattice of its input, so it cannot be tiled\n");
+		return (GMT_RUNTIME_ERROR);
+	}
+	for (row = T->row[tile]; row < T->row[tile+1]; row++)
+		memcpy (&T->out->data[tile_node (h, row)], &O->data[tile_node (O->header, row - r0)], h->n_columns * sizeof (gmt_grdfloat));
+	if (tile == 0) {	/* The first tile describes the output */
+		strncpy (h->title, O->header->title, GMT_GRID_TITLE_LEN80 - 1);
+		strncpy (h->command, O->header->command, GMT_GRID_COMMAND_LEN320 - 1);
+		strncpy (h->remark, O->header->remark, GMT_GRID_REMARK_LEN160 - 1);
+		strncpy (h->z_units, O->header->z_units, GMT_GRID_UNIT_LEN80 - 1);
+	}
+	return (GMT_NOERROR);
+}
+
+static int encode_worker (struct GMTMEX_WORKER *W) {
+	/* Parse and encode the module options once in the worker session and note where each resource's option sits */
+	unsigned int k, n;
+	void *API = W->job->API;
+	struct GMT_OPTION *opt = NULL;
+
+	if ((W->options = GMT_Create_Options (API, 0, W->args)) == NULL) return (GMT_RUNTIME_ERROR);
+	if ((W->X = GMT_Encode_Options (API, W->module, W->n_in_objects, &W->options, &W->n_items)) == NULL) return (GMT_RUNTIME_ERROR);
+	if ((W->opt_index = calloc (W->n_items + 1, sizeof (unsigned int))) == NULL) return (GMT_RUNTIME_ERROR);
+	for (k = 0; k < W->n_items; k++) {
+		for (n = 0, opt = W->options; opt && opt != W->X[k].option; opt = opt->next) n++;
+		W->opt_index[k] = n;
+	}
+	return (GMT_NOERROR);
+}
+
+static int run_item (struct GMTMEX_WORKER *W, uint64_t item) {
+	/* Run the module on one layer or cell item, keeping the outputs.  Only the GMT API is used here */
+	int status = GMT_RUNTIME_ERROR;
+	unsigned int k, n, n_open = 0, n_made = 0, family;
+	void *API = W->job->API, *object = NULL;
+	struct GMT_GRID **made = NULL;
+	struct GMT_OPTION *options = NULL, *opt = NULL;
+	struct GMT_RESOURCE *X = W->X;
+
+	if ((made = calloc (W->n_items + 1, sizeof (struct GMT_GRID *))) == NULL) return (status);
+	if ((options = GMT_Duplicate_Options (API, W->options)) == NULL) {
+		free (made);
+		return (status);
+	}
+	for (k = 0; k < W->n_items; k++, n_open++) {
+		family = X[k].family;
+		if (X[k].direction == GMT_IN) {
+			if (W->T && W->T->full[X[k].pos])
+				object = made[n_made++] = tile_grid (API, W->T, W->T->full[X[k].pos], item);
+			else if (X[k].pos != W->item_pos)
+				object = W->shared[X[k].pos], family = W->shared_family[X[k].pos];
+			else if (W->S)
+				object = made[n_made++] = layer_grid (API, W->S, item);
+			else
+				object = W->items[item], family = W->item_family[item];
+		}
+		else
+			object = GMT_Create_Data (API, X[k].family, X[k].geometry, GMT_IS_OUTPUT, NULL, NULL, NULL, 0, 0, NULL);
+		if (object == NULL || GMT_Open_VirtualFile (API, family, X[k].geometry, X[k].direction|GMT_IS_REFERENCE, object, X[k].name) != GMT_NOERROR)
+			break;
+		for (n = 0, opt = options; opt && n < W->opt_index[k]; opt = opt->next) n++;	/* Same option in the copy */
+		if (opt == NULL || GMT_Expand_Option (API, opt, X[k].name) != GMT_NOERROR) {
+			n_open++;	/* So it is closed below */
+			break;
+		}
+	}
+	if (n_open == W->n_items)
+		status = GMT_Call_Module (API, W->module, GMT_MODULE_OPT, options);
+	for (k = 0; k < n_open; k++) {
+		if (status == GMT_NOERROR && X[k].direction == GMT_OUT) {
+			if (W->T)	/* Only the interior goes into the stitched grid */
+				status = stitch_tile (API, W->T, item, GMT_Read_VirtualFile (API, X[k].name));
+			else
+				W->out[item * W->n_out + X[k].pos] = GMT_Read_VirtualFile (API, X[k].name);
+		}
+		GMT_Close_VirtualFile (API, X[k].name);
+	}
+	for (k = 0; k < n_made; k++)	/* Output containers and map inputs are freed with the session */
+		if (made[k]) GMT_Destroy_Data (API, &made[k]);
+	free (made);
+	GMT_Destroy_Options (API, &options);
+	return (status);
+}
+
+static GMTMEX_THREAD_FUNC (item_worker) {
+	/* Thread function: run the module on every n_workers'th item */
+	struct GMTMEX_WORKER *W = arg;
+	uint64_t item;
+	this_job = W->job;	/* So messages go to the log */
+	for (item = W->worker; item < W->n_total && W->status == GMT_NOERROR; item += W->n_workers)
+		W->status = run_item (W, item);
+	this_job = NULL;
+	GMTMEX_THREAD_RETURN;
+}
+
+static void free_workers (struct GMTMEX_WORKER *W, unsigned int n_workers) {
+	/* Destroy the worker sessions, which also frees all containers they hold */
+	unsigned int w;
+	GMTMEX_Forget_Objects ();	/* The conversions of the inputs are freed with the sessions */
+	for (w = 0; w < n_workers; w++) {
+		if (W[w].job == NULL) continue;
+		if (W[w].job->API) {
+			if (W[w].options) GMT_Destroy_Options (W[w].job->API, &W[w].options);
+			GMT_Destroy_Session (W[w].job->API);
+		}
+		gmtmex_mutex_free (&W[w].job->lock);
+		free (W[w].job->log);
+		free (W[w].job);
+		free (W[w].opt_index);
+		free (W[w].shared);
+		free (W[w].shared_family);
+	}
+	free (W);
+}
+
+/* The conversions of the inputs raise a MATLAB error on bad input, which skips the cleanup at the end of a
+ * stack, map or tile run.  So the workers and arrays of the run are recorded in Held and released by
+ * release_held, either right before we report an error ourselves or by unwind_call at the start of the
+ * next call. */
+
+#define GMTMEX_N_HELD	4
+
+static GMTMEX_TLS struct GMTMEX_HELD {
+	struct GMTMEX_WORKER *W;        /* Workers of the run, or NULL */
+	unsigned int n_workers;
+	unsigned int n_mem;
+	void *mem[GMTMEX_N_HELD];       /* Arrays allocated for the run */
+} Held;	/* One per calling thread */
+
+static void hold_workers (struct GMTMEX_WORKER *W, unsigned int n_workers) {
+	Held.W = W;	Held.n_workers = n_workers;
+}
+
+static void *held_calloc (size_t n, size_t size) {
+	/* calloc whose result is freed by release_held */
+	void *p = NULL;
+	if (Held.n_mem < GMTMEX_N_HELD && (p = calloc (n, size)) != NULL) Held.mem[Held.n_mem++] = p;
+	return (p);
+}
+
+static void release_held (void) {
+	/* Free the workers and arrays of a stack, map or tile run */
+	unsigned int k;
+	if (Held.W) free_workers (Held.W, Held.n_workers);
+	for (k = 0; k < Held.n_mem; k++) free (Held.mem[k]);
+	memset (&Held, 0, sizeof (struct GMTMEX_HELD));
+}
+
+static void held_failed (const char *message) {
+	/* Clean up the run first, then report the error */
+	release_held ();
+	GMTMEX_Log_Flush ();
+	mexErrMsgTxt (message);
+}
+
+static void start_workers (struct GMTMEX_WORKER *W, unsigned int first, unsigned int n_workers, unsigned int verbose,
+                           uint64_t n_total, const char *module, const char *args, int n_in_objects, const char *what) {
+	/* Create the sessions of the held workers first to n_workers - 1 and encode the options in each of them.
+	 * n_out is set from the first worker */
+	unsigned int w, k, n_out = 0;
+	char message[GMT_LEN256] = {""};
+
+	for (w = first; w < n_workers; w++) {	/* Each worker gets its own session and message log */
+		if ((W[w].job = calloc (1, sizeof (struct GMTMEX_JOB))) == NULL ||
+		    (W[w].job->API = GMT_Create_Session (MEX_PROG, 2U, (verbose << 10) + GMT_SESSION_NOEXIT + GMT_SESSION_EXTERNAL +
+		                                         GMT_SESSION_COLMAJOR, job_print_func)) == NULL) {
+			snprintf (message, GMT_LEN256, "GMT: Failure to create a GMT session for a %s worker\n", what);
+			held_failed (message);
+		}
+		gmtmex_mutex_init (&W[w].job->lock);
+		W[w].worker = w;	W[w].n_workers = n_workers;	W[w].n_total = n_total;
+		W[w].module = module;	W[w].args = args;	W[w].n_in_objects = n_in_objects;
+		W[w].item_pos = UINT_MAX;
+		if (encode_worker (&W[w]) != GMT_NOERROR ||
+		    (W[w].shared = calloc (n_in_objects + 1, sizeof (void *))) == NULL ||
+		    (W[w].shared_family = calloc (n_in_objects + 1, sizeof (unsigned int))) == NULL) {
+			GMTMEX_Log_Text (W[w].job->log);
+			held_failed ("GMT: Failure to encode mex command options\n");
+		}
+	}
+	for (k = 0; k < W[0].n_items; k++)
+		if (W[0].X[k].direction == GMT_OUT && W[0].X[k].pos + 1 > n_out) n_out = W[0].X[k].pos + 1;
+	if (n_out == 0) {
+		snprintf (message, GMT_LEN256, "GMT: gmt ('%s', ...) needs a module that returns something\n", what);
+		held_failed (message);
+	}
+	for (w = first; w < n_workers; w++) W[w].n_out = n_out;
+}
+
+static struct GMTMEX_WORKER *new_workers (unsigned int verbose, unsigned int n_workers, uint64_t n_total, const char *module,
+                                          const char *args, int n_in_objects, const char *what) {
+	/* Create n_workers workers, held for release_held */
+	char message[GMT_LEN256] = {""};
+	struct GMTMEX_WORKER *W = NULL;
+
+	if ((W = calloc (n_workers, sizeof (struct GMTMEX_WORKER))) == NULL) {
+		snprintf (message, GMT_LEN256, "GMT: Failure to allocate %s workers\n", what);
+		mexErrMsgTxt (message);
+	}
+	hold_workers (W, n_workers);
+	start_workers (W, 0, n_workers, verbose, n_total, module, args, n_in_objects, what);
+	return (W);
+}
+
+static void convert_shared (struct GMTMEX_WORKER *W, unsigned int n_workers, const mxArray *prhs[]) {
+	/* Convert every input but the stack, cell or tiled grids in every worker session, unless the worker already
+	 * has it.  prhs[pos] is input pos */
+	unsigned int k, w, actual_family;
+	struct GMT_RESOURCE *X = W[0].X;
+	for (k = 0; k < W[0].n_items; k++) {
+		if (X[k].direction == GMT_OUT || X[k].pos == W[0].item_pos || (W[0].T && W[0].T->full[X[k].pos])) continue;
+		for (w = 0; w < n_workers; w++) {
+			if (W[w].shared[X[k].pos]) continue;
+			W[w].shared[X[k].pos] = GMTMEX_Convert_Input (W[w].job->API, X[k].family, X[k].option->option == GMT_OPT_INFILE,
+			                                              prhs[X[k].pos], &actual_family);
+			W[w].shared_family[X[k].pos] = actual_family;
+		}
+	}
+}
+
+static int run_workers (struct GMTMEX_WORKER *W, unsigned int n_workers) {
+	/* Run all the items in parallel, wait for all of them and return the first failure */
+	int status = GMT_NOERROR;
+	unsigned int w;
+	for (w = 0; w < n_workers; w++) {
+		if (gmtmex_thread_create (&W[w].job->thread, item_worker, &W[w])) {
+			W[w].status = GMT_RUNTIME_ERROR;
+			W[w].job->done = true;	/* No thread to join */
+		}
+	}
+	for (w = 0; w < n_workers; w++) {
+		if (!W[w].job->done) gmtmex_thread_join (W[w].job->thread);
+		GMTMEX_Log_Text (W[w].job->log);
+		if (W[w].status != GMT_NOERROR && status == GMT_NOERROR) status = W[w].status;
+	}
+	return (status);
+}
+
+static char *split_command (const mxArray *ptr, char module[]) {
+	/* Get the 'module options' string, copy the module name and return the options */
+	char *cmd = mxArrayToString (ptr), *args = NULL;
+	size_t len;
+	for (len = 0; cmd[len] && cmd[len] != ' '; len++);	/* Length of module name */
+	if (len >= MODULE_LEN) mexErrMsgTxt ("GMT: Module name in command is too long\n");
+	strncpy (module, cmd, len);
+	args = &cmd[len];
+	while (*args == ' ') args++;
+	return (args);
+}
+
+static unsigned int n_workers_for (uint64_t n_total) {
+	/* One worker per core, but no more than there are items */
+	unsigned int n_workers = gmtmex_n_cores ();
+	if (n_workers > GMTMEX_MAX_JOBS) n_workers = GMTMEX_MAX_JOBS;
+	if ((uint64_t)n_workers > n_total) n_workers = (unsigned int)n_total;
+	if (n_workers == 0) n_workers = 1;
+	return (n_workers);
+}
+
+static void run_stack (unsigned int verbose, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+	/* prhs[0] is the 'module options' string and prhs[1...] are the inputs */
+	int status = GMT_NOERROR;
+	unsigned int k, w, n_workers, n_out, *out_family = NULL;
+	char *args = NULL, module[MODULE_LEN] = {""}, message[BUFSIZ] = {""};
+	void **out = NULL;
+	struct GMTMEX_STACK S;
+	struct GMTMEX_WORKER *W = NULL;
+	struct GMT_RESOURCE *X = NULL;
+
+	if (nrhs < 2 || !mxIsChar (prhs[0]))
+		mexErrMsgTxt ("GMT: Usage is G = gmt ('stack', 'module_name options', S[, <matlab arrays>]);\n");
+	args = split_command (prhs[0], module);
+
+	/* Find the grid stack among the inputs to size the job */
+	S.n_layers = 0;
+	for (k = 1; k < (unsigned int)nrhs && !S.n_layers; k++)
+		if (!GMTMEX_Get_Stack (prhs[k], &S)) S.n_layers = 0;
+	if (S.n_layers == 0)
+		mexErrMsgTxt ("GMT: gmt ('stack', ...) needs a grid structure whose z is a rows x columns x layers array\n");
+	n_workers = n_workers_for (S.n_layers);
+	W = new_workers (verbose, n_workers, S.n_layers, module, args, nrhs - 1, "stack");
+	n_out = W[0].n_out;	X = W[0].X;
+	if ((out_family = held_calloc (n_out, sizeof (unsigned int))) == NULL ||
+	    (out = held_calloc (S.n_layers * n_out, sizeof (void *))) == NULL)
+		held_failed ("GMT: Failure to allocate grid stack outputs\n");
+	for (k = 0; k < W[0].n_items; k++) {
+		struct GMTMEX_STACK S2;
+		if (X[k].direction == GMT_OUT)
+			out_family[X[k].pos] = X[k].family;
+		else if (X[k].family == GMT_IS_GRID && W[0].item_pos == UINT_MAX && GMTMEX_Get_Stack (prhs[X[k].pos+1], &S2)) {
+			for (w = 0; w < n_workers; w++) W[w].item_pos = X[k].pos;
+		}
+	}
+	if (W[0].item_pos == UINT_MAX)
+		held_failed ("GMT: The grid stack is not a grid input of this module\n");
+	for (w = 0; w < n_workers; w++) {
+		W[w].S = &S;	W[w].out = out;
+	}
+	convert_shared (W, n_workers, &prhs[1]);
+
+	if ((status = run_workers (W, n_workers)) == GMT_NOERROR) {	/* Hook up the outputs to the plhs array */
+		for (k = 0; k < n_out; k++)
+			if ((int)k < nlhs || k == 0)
+				plhs[k] = GMTMEX_Get_Layers (W[0].job->API, out_family[k], &out[k], S.n_layers, n_out, true);
+	}
+	else if (status > GMT_MODULE_PURPOSE)
+		snprintf (message, BUFSIZ, "GMT: Module return with failure while executing the command on a grid stack\n%s %s\n", module, args);
+	release_held ();
+	GMTMEX_Log_Flush ();
+	if (message[0]) mexErrMsgTxt (message);
+}
+
+static void run_map (unsigned int verbose, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+	/* prhs[0] is an optional number of workers, then come the 'module options' string, the cell array and the other inputs */
+	int status = GMT_NOERROR;
+	unsigned int k, w, n_workers = 0, n_out, *out_family = NULL, *item_family = NULL, family = GMT_NOTSET, module_input = 0;
+	uint64_t item, n_total;
+	char *args = NULL, module[MODULE_LEN] = {""}, message[BUFSIZ] = {""};
+	void **out = NULL, **items = NULL;
+	struct GMTMEX_WORKER *W = NULL;
+	struct GMT_RESOURCE *X = NULL;
+
+	if (nrhs > 0 && mxIsNumeric (prhs[0]) && mxGetNumberOfElements (prhs[0]) == 1) {	/* Number of worker sessions */
+		double n_asked = mxGetScalar (prhs[0]);
+		if (!(n_asked >= 1.0))	/* Also catches NaN */
+			mexErrMsgTxt ("GMT: gmt ('map', n_workers, ...) needs at least one worker\n");
+		n_workers = (n_asked > (double)GMTMEX_MAX_JOBS) ? GMTMEX_MAX_JOBS : (unsigned int)n_asked;	/* No more than we can run */
+		prhs++;	nrhs--;
+	}
+	if (nrhs < 2 || !mxIsChar (prhs[0]) || !mxIsCell (prhs[1]))
+		mexErrMsgTxt ("GMT: Usage is out = gmt ('map'[, n_workers], 'module_name options', {in1, in2, ...}[, <matlab arrays>]);\n");
+	if ((n_total = mxGetNumberOfElements (prhs[1])) == 0) {	/* Nothing to do, so one empty cell per output */
+		for (k = 0; (int)k < nlhs || k == 0; k++)
+			plhs[k] = mxCreateCellArray (mxGetNumberOfDimensions (prhs[1]), mxGetDimensions (prhs[1]));
+		return;
+	}
+	args = split_command (prhs[0], module);
+	if (n_workers == 0) n_workers = n_workers_for (n_total);
+	if ((uint64_t)n_workers > n_total) n_workers = (unsigned int)n_total;
+	W = new_workers (verbose, n_workers, n_total, module, args, nrhs - 1, "map");
+	n_out = W[0].n_out;	X = W[0].X;
+	if ((out_family = held_calloc (n_out, sizeof (unsigned int))) == NULL ||
+	    (out = held_calloc (n_total * n_out, sizeof (void *))) == NULL ||
+	    (items = held_calloc (n_total, sizeof (void *))) == NULL ||
+	    (item_family = held_calloc (n_total, sizeof (unsigned int))) == NULL)
+		held_failed ("GMT: Failure to allocate map outputs\n");
+	for (k = 0; k < W[0].n_items; k++) {
+		if (X[k].direction == GMT_OUT)
+			out_family[X[k].pos] = X[k].family;
+		else if (X[k].pos == 0)	/* The cell is the first input */
+			family = X[k].family, module_input = (X[k].option->option == GMT_OPT_INFILE);
+	}
+	if (family == GMT_NOTSET)
+		held_failed ("GMT: The cell array is not an input of this module\n");
+	for (w = 0; w < n_workers; w++) {
+		W[w].item_pos = 0;	W[w].items = items;	W[w].item_family = item_family;	W[w].out = out;
+	}
+	/* The MATLAB API may only be used here, so convert every item into the session of the worker that runs it */
+	for (item = 0; item < n_total; item++)
+		items[item] = GMTMEX_Convert_Input (W[item % n_workers].job->API, family, module_input,
+		                                    mxGetCell (prhs[1], (mwIndex)item), &item_family[item]);
+	convert_shared (W, n_workers, &prhs[1]);
+
+	if ((status = run_workers (W, n_workers)) == GMT_NOERROR) {	/* Hook up the outputs, shaped like the input cell */
+		for (k = 0; k < n_out; k++) {
+			if ((int)k >= nlhs && k > 0) continue;
+			plhs[k] = GMTMEX_Get_Layers (W[0].job->API, out_family[k], &out[k], n_total, n_out, false);
+			mxSetDimensions (plhs[k], mxGetDimensions (prhs[1]), mxGetNumberOfDimensions (prhs[1]));
+		}
+	}
+	else if (status > GMT_MODULE_PURPOSE)
+		snprintf (message, BUFSIZ, "GMT: Module return with failure while executing the command on a cell array\n%s %s\n", module, args);
+	release_held ();
+	GMTMEX_Log_Flush ();
+	if (message[0]) mexErrMsgTxt (message);
+}
+
+static bool tile_operator (const char *arg) {
+	/* true if the grdmath operator needs the whole grid or reads its region from the grid header */
+	static const char *whole[] = {"CORRCOEFF", "CUMSUM", "EXTREMA", "FLIPLR", "FLIPUD", "LMSSCL", "LMSSCLW", "LOWER",
+		"LSQFIT", "MAD", "MEAN", "MEANW", "MEDIAN", "MEDIANW", "MODE", "MODEW", "NODE", "NODEP", "NX", "NY", "PQUANT",
+		"PQUANTW", "RMS", "RMSW", "ROTX", "ROTY", "STD", "STDW", "SUM", "SVDFIT", "TAPER", "TRIM", "UPPER", "VAR",
+		"VARW", "XCOL", "XMAX", "XMIN", "XNORM", "XRANGE", "YMAX", "YMIN", "YNORM", "YRANGE", "YROW", NULL};
+	unsigned int k;
+	for (k = 0; whole[k]; k++)
+		if (!strcmp (arg, whole[k])) return (true);
+	return (false);
+}
+
+static int tile_halo (const char *module, struct GMT_OPTION *options, struct GMT_GRID_HEADER *h, int64_t *halo, char *message) {
+	/* Check that the command only looks at nearby nodes and, unless *halo is already set, work out how many
+	 * rows of halo it needs.  Returns GMT_NOERROR or an error with the reason in message */
+	char *c = NULL, mode = 0;
+	double width = 0.0, pixels;
+	struct GMT_OPTION *opt = NULL, *F = NULL;
+
+	for (opt = options; opt; opt = opt->next)
+		if (opt->option == 'R') {
+			snprintf (message, BUFSIZ, "GMT: %s -R cannot be tiled\n", module);
+			return (GMT_RUNTIME_ERROR);
+		}
+	if (!strcmp (module, "grdfilter")) {	/* Half the filter width, in rows */
+		for (opt = options; opt; opt = opt->next) {
+			if (strchr ("IT", opt->option)) {
+				snprintf (message, BUFSIZ, "GMT: grdfilter -%c changes the grid lattice and cannot be tiled\n", opt->option);
+				return (GMT_RUNTIME_ERROR);
+			}
+			if (opt->option == 'F') F = opt;
+			if (opt->option == 'D') mode = opt->arg[0];
+		}
+		if (*halo >= 0) return (GMT_NOERROR);
+		if (F == NULL || strchr ("fo", F->arg[0]) || strchr ("p01234", mode) == NULL || mode == 0) {
+			snprintf (message, BUFSIZ, "GMT: The halo for this grdfilter command must be given: gmt ('tile', halo, ...)\n");
+			return (GMT_RUNTIME_ERROR);
+		}
+		width = strtod (&F->arg[1], &c);
+		if (*c == '/' && strtod (&c[1], NULL) > width) width = strtod (&c[1], NULL);	/* Rectangular filter */
+		if (mode == 'p')	/* Width in nodes */
+			pixels = width;
+		else if (mode == '0')	/* Width in grid units */
+			pixels = width / h->inc[GMT_Y];
+		else	/* Width in km on a geographic grid */
+			pixels = width / (h->inc[GMT_Y] * 111.195);
+		*halo = (int64_t)ceil (pixels / 2.0) + 2;	/* Plus a little for rounding of the weight grid */
+	}
+	else if (!strcmp (module, "grdgradient")) {	/* Derivatives use the neighbouring rows */
+		for (opt = options; opt; opt = opt->next) {
+			if (opt->option == 'Q' || (opt->option == 'N' && !(strstr (opt->arg, "+o") && strstr (opt->arg, "+s")))) {
+				snprintf (message, BUFSIZ, "GMT: grdgradient -%c uses statistics of the whole grid and cannot be tiled; give -N with +o and +s\n", opt->option);
+				return (GMT_RUNTIME_ERROR);
+			}
+			if (opt->option == 'S') {	/* Every tile would write its own part of the slope grid to the same file */
+				snprintf (message, BUFSIZ, "GMT: grdgradient -S writes a second grid and cannot be tiled\n");
+				return (GMT_RUNTIME_ERROR);
+			}
+		}
+		if (*halo < 0) *halo = 2;
+	}
+	else if (!strcmp (module, "grdmath")) {	/* Operators are node by node or use the neighbouring rows */
+		for (opt = options; opt; opt = opt->next) {
+			if (opt->option == 'I' || (opt->option == GMT_OPT_INFILE && tile_operator (opt->arg))) {
+				snprintf (message, BUFSIZ, "GMT: grdmath %s%s needs the whole grid and cannot be tiled\n", (opt->option == 'I') ? "-I" : "", (opt->option == 'I') ? "" : opt->arg);
+				return (GMT_RUNTIME_ERROR);
+			}
+		}
+		if (*halo < 0) *halo = 2;
+	}
+	else if (!strcmp (module, "grdsample")) {	/* Output rows do not line up with input rows */
+		snprintf (message, BUFSIZ, "GMT: grdsample changes the grid lattice and cannot be tiled\n");
+		return (GMT_RUNTIME_ERROR);
+	}
+	else if (*halo < 0) {
+		snprintf (message, BUFSIZ, "GMT: The halo for %s must be given: gmt ('tile', halo, ...)\n", module);
+		return (GMT_RUNTIME_ERROR);
+	}
+	return (GMT_NOERROR);
+}
+
+static void run_tile (unsigned int verbose, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+	/* prhs[0] is an optional halo, then come the 'module options' string and the inputs, the first grid of which is tiled */
+	int status = GMT_NOERROR;
+	int64_t halo = -1;
+	unsigned int k, w, n_tiles, actual_family;
+	uint64_t t, min_rows;
+	char *args = NULL, module[MODULE_LEN] = {""}, message[BUFSIZ] = {""};
+	void *API = NULL;
+	struct GMT_GRID *G = NULL;
+	struct GMT_GRID_HEADER *h = NULL;
+	struct GMTMEX_TILING T;
+	struct GMTMEX_WORKER *W = NULL;
+	struct GMT_RESOURCE *X = NULL;
+
+	if (nrhs > 0 && mxIsNumeric (prhs[0]) && mxGetNumberOfElements (prhs[0]) == 1) {	/* Rows of halo */
+		if (mxGetScalar (prhs[0]) < 0.0)
+			mexErrMsgTxt ("GMT: gmt ('tile', halo, ...) needs a halo of zero or more rows\n");
+		halo = (int64_t)mxGetScalar (prhs[0]);
+		prhs++;	nrhs--;
+	}
+	if (nrhs < 2 || !mxIsChar (prhs[0]) || nlhs > 1)
+		mexErrMsgTxt ("GMT: Usage is G = gmt ('tile'[, halo], 'module_name options', G[, <matlab arrays>]);\n");
+	args = split_command (prhs[0], module);
+	memset (&T, 0, sizeof (struct GMTMEX_TILING));
+
+	/* The first worker holds the whole grids and the output; the others are added once we know the tiles */
+	W = new_workers (verbose, 1, 1, module, args, nrhs - 1, "tile");
+	API = W[0].job->API;	X = W[0].X;
+	if ((T.full = held_calloc (nrhs, sizeof (struct GMT_GRID *))) == NULL)
+		held_failed ("GMT: Failure to allocate tiles\n");
+	for (k = 0; k < W[0].n_items && !message[0]; k++) {
+		if (X[k].direction == GMT_OUT) {
+			if (X[k].family != GMT_IS_GRID || W[0].n_out > 1)
+				snprintf (message, BUFSIZ, "GMT: gmt ('tile', ...) needs a module that returns one grid\n");
+			continue;
+		}
+		if (X[k].family != GMT_IS_GRID) continue;
+		G = GMTMEX_Convert_Input (API, X[k].family, X[k].option->option == GMT_OPT_INFILE, prhs[X[k].pos+1], &actual_family);
+		if (actual_family == GMT_IS_GRID && G && (h == NULL || (G->header->n_columns == h->n_columns &&
+		    G->header->n_rows == h->n_rows && G->header->registration == h->registration))) {
+			if (h == NULL) h = G->header;	/* The first grid sets the tiles */
+			T.full[X[k].pos] = G;
+		}
+		else {	/* Given as something else or not on the same lattice, so every worker gets all of it; this is the first one's */
+			W[0].shared[X[k].pos] = G;	W[0].shared_family[X[k].pos] = actual_family;
+		}
+	}
+	if (!message[0] && h == NULL)
+		snprintf (message, BUFSIZ, "GMT: gmt ('tile', ...) needs a grid input\n");
+	if (!message[0]) tile_halo (module, W[0].options, h, &halo, message);
+	if (message[0]) held_failed (message);
+
+	/* Bands of rows, each with at least as many interior rows as the two halos together */
+	T.halo = (uint64_t)halo;
+	min_rows = (2 * T.halo > 16) ? 2 * T.halo : 16;
+	n_tiles = n_workers_for (h->n_rows / min_rows);
+	if (n_tiles > 1) {	/* One worker per tile */
+		struct GMTMEX_WORKER *W2 = NULL;
+		if ((W2 = realloc (W, n_tiles * sizeof (struct GMTMEX_WORKER))) == NULL)
+			held_failed ("GMT: Failure to allocate tile workers\n");
+		W = W2;
+		memset (&W[1], 0, (n_tiles - 1) * sizeof (struct GMTMEX_WORKER));
+		hold_workers (W, n_tiles);
+		start_workers (W, 1, n_tiles, verbose, n_tiles, module, args, nrhs - 1, "tile");
+	}
+	if ((T.row = held_calloc (n_tiles + 1, sizeof (uint64_t))) == NULL ||
+	    (T.out = GMT_Create_Data (API, GMT_IS_GRID, GMT_IS_SURFACE, GMT_GRID_ALL, NULL, h->wesn, h->inc, h->registration,
+	                              GMT_NOTSET, NULL)) == NULL)
+		held_failed ("GMT: Failure to allocate the tiled output grid\n");
+	for (t = 0; t <= n_tiles; t++) T.row[t] = t * h->n_rows / n_tiles;
+	strncpy (T.out->header->x_units, h->x_units, GMT_GRID_UNIT_LEN80 - 1);
+	strncpy (T.out->header->y_units, h->y_units, GMT_GRID_UNIT_LEN80 - 1);
+
+	for (w = 0; w < n_tiles; w++) {
+		W[w].n_workers = n_tiles;	W[w].n_total = n_tiles;	W[w].T = &T;
+	}
+	convert_shared (W, n_tiles, &prhs[1]);
+
+	if ((status = run_workers (W, n_tiles)) == GMT_NOERROR)
+		plhs[0] = GMTMEX_Get_Layers (API, GMT_IS_GRID, (void **)&T.out, 1, 1, true);
+	else if (status > GMT_MODULE_PURPOSE)
+		snprintf (message, BUFSIZ, "GMT: Module return with failure while executing the command on tiles\n%s %s\n", module, args);
+	release_held ();	/* The worker sessions also free the whole grids and the output */
+	GMTMEX_Log_Flush ();
+	if (message[0]) mexErrMsgTxt (message);
+}
+
+/* mexErrMsgTxt never returns, so a module call that fails part way skips the cleanup at the end
+ * of mexFunction.  Everything such a call holds is recorded in Call and released by unwind_call,
+ * either right before we report the error ourselves or at the start of the next call (errors
+ * raised inside the conversions in gmtmex_parser.c), or when the MEX file is cleared. */
+
+static struct GMTMEX_CALL {
+	bool active;                    /* true from step 2 until the call has cleaned up after itself */
+	bool pad_changed;               /* true if gmtread -Ti set API_PAD to 0 */
+	bool matrix_output;             /* true if gmt ('matrix', ...) changed GMT_EXPORT_TYPE */
+	bool grid_layout;               /* true if gmt ('layout', ...) changed the grid output layout */
+	bool segment_class;             /* true if gmt ('segments', ...) changed the class of segment data */
+	void *API;                      /* Session used by the call */
+	struct GMT_OPTION *options;     /* Linked list of module options */
+	struct GMT_RESOURCE *X;         /* Array of information about MATLAB args */
+	unsigned int n_items;           /* Number of entries in X */
+	struct GMTMEX_JOB *job;         /* Asynchronous job not yet handed to its thread */
+} GMTMEX_TLS Call;	/* One per calling thread */
+
+static void unwind_call (void) {
+	/* Release what an abandoned call left behind: virtual files, containers, options and unlaunched jobs */
+	unsigned int k;
+	GMTMEX_Log_Flush ();	/* Buffered messages, which may explain the error */
+	release_held ();	/* Workers of a stack, map or tile run that failed in a conversion */
+	if (!Call.active) {	/* Nothing abandoned; any containers still tracked are owned by jobs */
+		GMTMEX_Forget_Objects ();
+		return;
+	}
+	Call.active = false;	/* In case anything below raises an error */
+	if (Call.pad_changed) GMT_Set_Default (Call.API, "API_PAD", "2");
+	if (Call.matrix_output) GMTMEX_Set_Matrix_Output (Call.API, NULL);
+	if (Call.grid_layout) GMTMEX_Set_Grid_Layout (NULL);
+	if (Call.segment_class) GMTMEX_Set_Segment_Class (NULL);
+	for (k = 0; k < Call.n_items; k++)
+		if (Call.X[k].name[0]) GMT_Close_VirtualFile (Call.API, Call.X[k].name);
+	GMTMEX_Unwind_Objects ();
+	GMTMEX_Stage_End ();	/* Only now that the grids using them are gone */
+	if (Call.options) GMT_Destroy_Options (Call.API, &Call.options);
+	if (Call.job) {	/* Not started, so it is not in Jobs and there is no thread to join */
+		Call.job->X = NULL;	Call.job->n_items = 0;	Call.job->options = NULL;
+		drop_job (Call.job);
+	}
+#ifdef SINGLE_SESSION
+	else
+		pool_release (Call.API, false);	/* May have been left in any state */
+#endif
+	memset (&Call, 0, sizeof (struct GMTMEX_CALL));
+}
+
+static void call_failed (const char *message) {
+	/* Clean up first, then report the error */
+	unwind_call ();
+	mexErrMsgTxt (message);
+}
+
+static void call_done (void) {
+	/* The call cleaned up after itself or handed its resources over to a job or resident object */
+	memset (&Call, 0, sizeof (struct GMTMEX_CALL));
+	GMTMEX_Forget_Objects ();
+	GMTMEX_Log_Flush ();
+}
+
+#ifdef SINGLE_SESSION
+static void release_all (void) {
+	/* Exit function for single-session builds */
+	unwind_call ();
+	release_all_jobs ();
+	GMTMEX_Unshare_All ();
+	cache_flush (true);
+	GMTMEX_Stage_Flush ();
+	pool_flush ();
+}
+#endif
+
+/* Read cache: with gmt ('cache', bytes) the outputs of gmtread are kept, up to a total of bytes, keyed by
+ * the module and its options, and reused as long as the file has the same modification time and size.
+ * A hit returns a copy of the kept MATLAB array without reading, decoding or changing layout.  The least
+ * recently used outputs are dropped to stay within the budget.  The cache is off (budget 0) by default,
+ * and is shared by all threads under cache_lock.  It does not notice changes to GMT defaults that
+ * affect reading; flush it with gmt ('cache', 'flush') after such changes. */
+
+struct GMTMEX_CACHED {
+	char *key;                      /* "module options" */
+	int64_t mtime;                  /* Modification time of the file when it was read */
+	uint64_t size;                  /* Its size */
+	mxArray *value;                 /* Persistent copy of the output */
+	size_t bytes;                   /* Memory held by value */
+	uint64_t last_use;              /* cache_tick of the last store or hit */
+	unsigned int pins;              /* Number of hits still copying value */
+};
+
+static struct GMTMEX_CACHED *Cache = NULL;
+static unsigned int n_cached = 0, n_cache_alloc = 0;
+static size_t cache_budget = 0, cache_bytes = 0;
+static uint64_t cache_tick = 0, cache_hits = 0, cache_misses = 0, cache_evictions = 0;
+static gmtmex_mutex_t cache_lock = GMTMEX_MUTEX_INITIALIZER;
+
+static size_t mx_bytes (const mxArray *p) {
+	/* Memory held by the data of a MATLAB array, counting the contents of structures and cells */
+	size_t k, n, bytes = 0;
+	int j, n_fields;
+	if (p == NULL) return (0);
+	n = mxGetNumberOfElements (p);
+	if (mxIsStruct (p)) {
+		n_fields = mxGetNumberOfFields (p);
+		for (k = 0; k < n; k++) for (j = 0; j < n_fields; j++) bytes += mx_bytes (mxGetFieldByNumber (p, (mwIndex)k, j));
+	}
+	else if (mxIsCell (p)) {
+		for (k = 0; k < n; k++) bytes += mx_bytes (mxGetCell (p, (mwIndex)k));
+	}
+	else
+		bytes = n * mxGetElementSize (p);
+	return (bytes);
+}
+
+static bool cache_file_stat (const char *file, int64_t *mtime, uint64_t *size) {
+	/* Get the modification time and size of file.  If there is no such file the name may end in GMT ?var,
+	 * =id or +modifiers, so strip those one at a time from the right, since file names may contain them too */
+	char path[BUFSIZ] = {""};
+	size_t k;
+	struct stat st;
+	strncpy (path, file, BUFSIZ - 1);
+	for (k = strlen (path); stat (path, &st); path[k] = '\0') {
+		while (k > 0 && !strchr ("?=+", path[--k]));
+		if (k == 0) return (false);	/* Remote or missing files are not cached */
+	}
+	*mtime = (int64_t)st.st_mtime;	*size = (uint64_t)st.st_size;
+	return (true);
+}
+
+static void cache_drop (unsigned int k) {
+	/* Remove entry k; cache_lock must be held */
+	mxDestroyArray (Cache[k].value);
+	free (Cache[k].key);
+	cache_bytes -= Cache[k].bytes;
+	Cache[k] = Cache[--n_cached];
+}
+
+static void cache_flush (bool all) {
+	/* Drop all entries, or only those exceeding the budget (least recently used first) */
+	unsigned int k, lru;
+	gmtmex_mutex_lock (&cache_lock);
+	for (k = 0; all && k < n_cached;) {
+		if (Cache[k].pins) k++;	/* Being copied by another thread; it goes next time */
+		else cache_drop (k);
+	}
+	while (!all && cache_bytes > cache_budget) {
+		for (k = 0, lru = UINT_MAX; k < n_cached; k++)
+			if (!Cache[k].pins && (lru == UINT_MAX || Cache[k].last_use < Cache[lru].last_use)) lru = k;
+		if (lru == UINT_MAX) break;
+		cache_drop (lru);
+		cache_evictions++;
+	}
+	gmtmex_mutex_unlock (&cache_lock);
+}
+
+static mxArray *cache_lookup (const char *key, const char *file) {
+	/* Return a copy of the kept output for key, or NULL if there is none or file changed since */
+	unsigned int k;
+	int64_t mtime = 0;
+	uint64_t size = 0;
+	mxArray *value = NULL, *out = NULL;
+	bool found = cache_file_stat (file, &mtime, &size);
+	gmtmex_mutex_lock (&cache_lock);
+	for (k = 0; found && k < n_cached && strcmp (Cache[k].key, key); k++);
+	if (found && k < n_cached && (Cache[k].mtime != mtime || Cache[k].size != size)) {	/* The file changed */
+		if (Cache[k].pins == 0) cache_drop (k);
+		k = n_cached;
+	}
+	if (found && k < n_cached) {
+		value = Cache[k].value;
+		Cache[k].pins++;	Cache[k].last_use = ++cache_tick;
+		cache_hits++;
+	}
+	else
+		cache_misses++;
+	gmtmex_mutex_unlock (&cache_lock);
+	if (value == NULL) return (NULL);
+	out = mxDuplicateArray (value);
+	gmtmex_mutex_lock (&cache_lock);
+	for (k = 0; k < n_cached && Cache[k].value != value; k++);
+	if (k < n_cached) Cache[k].pins--;
+	gmtmex_mutex_unlock (&cache_lock);
+	return (out);
+}
+
+static void cache_store (const char *key, const char *file, const mxArray *out) {
+	/* Keep a copy of out for key, dropping the least recently used entries to stay within the budget */
+	int64_t mtime = 0;
+	uint64_t size = 0;
+	size_t bytes = mx_bytes (out);
+	mxArray *value = NULL;
+	struct GMTMEX_CACHED *tmp = NULL;
+	if (bytes > cache_budget || !cache_file_stat (file, &mtime, &size)) return;	/* Would never fit, or cannot tell if it changes */
+	value = mxDuplicateArray (out);
+	mexMakeArrayPersistent (value);
+	gmtmex_mutex_lock (&cache_lock);
+	if (n_cached == n_cache_alloc) {
+		unsigned int n_alloc = (n_cache_alloc) ? 2 * n_cache_alloc : 16;
+		if ((tmp = realloc (Cache, n_alloc * sizeof (struct GMTMEX_CACHED))) != NULL) Cache = tmp, n_cache_alloc = n_alloc;
+	}
+	if (n_cached < n_cache_alloc && (Cache[n_cached].key = strdup (key)) != NULL) {
+		Cache[n_cached].mtime = mtime;	Cache[n_cached].size = size;
+		Cache[n_cached].value = value;	Cache[n_cached].bytes = bytes;
+		Cache[n_cached].last_use = ++cache_tick;	Cache[n_cached].pins = 0;
+		n_cached++;
+		cache_bytes += bytes;
+		value = NULL;
+	}
+	gmtmex_mutex_unlock (&cache_lock);
+	if (value) mxDestroyArray (value);	/* Could not keep it */
+	cache_flush (false);
+}
+
+static mxArray *helper_cache (int nrhs, const mxArray *prhs[]) {
+	/* gmt ('cache', bytes) sets the budget (0 turns the cache off), gmt ('cache', 'flush') empties it;
+	 * both, and S = gmt ('cache'), return the budget, bytes held, entries and hit/miss/eviction counts */
+	unsigned int k;
+	const char *fields[6] = {"budget", "bytes", "entries", "hits", "misses", "evictions"};
+	double v[6];
+	mxArray *S = NULL;
+	if (nrhs == 1 && mxIsChar (prhs[0])) {
+		char what[GMT_LEN16] = {""};
+		if (mxGetString (prhs[0], what, GMT_LEN16) || strcmp (what, "flush"))
+			mexErrMsgTxt ("GMT: Usage is gmt ('cache', bytes) or gmt ('cache', 'flush')\n");
+		cache_flush (true);
+	}
+	else if (nrhs == 1) {
+		if (!mxIsNumeric (prhs[0]) || mxGetNumberOfElements (prhs[0]) != 1 || mxGetScalar (prhs[0]) < 0.0)
+			mexErrMsgTxt ("GMT: The cache budget must be a number of bytes, or 0 to turn it off\n");
+		gmtmex_mutex_lock (&cache_lock);
+		cache_budget = (size_t)mxGetScalar (prhs[0]);
+		gmtmex_mutex_unlock (&cache_lock);
+		cache_flush (false);
+	}
+	gmtmex_mutex_lock (&cache_lock);
+	v[0] = (double)cache_budget;	v[1] = (double)cache_bytes;	v[2] = (double)n_cached;
+	v[3] = (double)cache_hits;	v[4] = (double)cache_misses;	v[5] = (double)cache_evictions;
+	gmtmex_mutex_unlock (&cache_lock);
+	S = mxCreateStructMatrix (1, 1, 6, fields);
+	for (k = 0; k < 6; k++) mxSetField (S, 0, fields[k], mxCreateDoubleScalar (v[k]));
+	return (S);
+}
+
+/* Commands that only rearrange MATLAB arrays or the log and need no GMT session.  They are looked up in this
+ * table before any session is created, so calling them costs no GMT startup. */
+
+static mxArray *helper_colorize (int nrhs, const mxArray *prhs[]) {
+	return (GMTMEX_colorize (prhs[0], prhs[1]));
+}
+
+static mxArray *helper_log (int nrhs, const mxArray *prhs[]) {
+	char mode[GMT_LEN16] = {""};
+	if (nrhs == 0) return (GMTMEX_Get_Log ());
+	if (!mxIsChar (prhs[0]) || mxGetString (prhs[0], mode, GMT_LEN16) || GMTMEX_Set_Log (mode) != GMT_NOERROR)
+		mexErrMsgTxt ("GMT: Unknown log mode; use console, buffer or keep\n");
+	return (mxCreateString (mode));
+}
+
+static struct GMTMEX_HELPER {
+	const char *name;
+	int min_args, max_args;         /* Number of arguments after the command name */
+	mxArray *(*func) (int nrhs, const mxArray *prhs[]);
+	const char *usage;
+} Helpers[] = {
+	{"catseg",     1, 2, GMTMEX_catseg,   "all = gmt ('catseg', D[, opt])"},
+	{"catsegment", 1, 2, GMTMEX_catseg,   "all = gmt ('catsegment', D[, opt])"},
+	{"cache",      0, 1, helper_cache,    "S = gmt ('cache'[, bytes | 'flush'])"},
+	{"catcpt",     2, 2, GMTMEX_catcpt,   "cpt = gmt ('catcpt', cpt1, cpt2)"},
+	{"colorize",   2, 2, helper_colorize, "I = gmt ('colorize', G, cpt)"},
+	{"log",        0, 1, helper_log,      "gmt ('log', 'console' | 'buffer' | 'keep') or L = gmt ('log')"},
+	{"record",     2, 2, GMTMEX_record,   "R = gmt ('record', data, text)"},
+	{"staging",    0, 2, GMTMEX_Staging,  "S = gmt ('staging'[, 'off' | 'on' | 'prefault'[, keep]])"},
+	{"wrapgrid",   2, 3, GMTMEX_wrapgrid, "G = gmt ('wrapgrid', Z, head)"},
+	{"wrapseg",    1, 6, GMTMEX_wrapseg,  "D = gmt ('wrapseg', in[, headers, text, comm, proj_s, wkt_s])"},
+	{NULL,         0, 0, NULL,            NULL}
+};
+
+static bool run_helper (int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+	/* Run prhs[0] if it names one of the Helpers and return true, else return false */
+	char name[MODULE_LEN] = {""}, message[BUFSIZ] = {""};
+	unsigned int k;
+	if (!mxIsChar (prhs[0]) || mxGetNumberOfElements (prhs[0]) >= MODULE_LEN) return (false);
+	mxGetString (prhs[0], name, MODULE_LEN);
+	for (k = 0; Helpers[k].name && strcmp (Helpers[k].name, name); k++);
+	if (Helpers[k].name == NULL) return (false);
+	if (nrhs - 1 < Helpers[k].min_args || nrhs - 1 > Helpers[k].max_args || nlhs > 1) {
+		snprintf (message, BUFSIZ, "GMT: Usage is %s;\n", Helpers[k].usage);
+		mexErrMsgTxt (message);
+	}
+	plhs[0] = Helpers[k].func (nrhs - 1, &prhs[1]);
+	return (true);
+}
+
 /* This is the function that is called when we type gmt in MATLAB/Octave */
 void mexFunction (int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 	int status = 0;                 /* Status code from GMT API */
@@ -132,7 +1536,10 @@ void mexFunction (int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 	char *opt_args = NULL;          /* Pointer to the user's module options */
 	char module[MODULE_LEN] = {""}; /* Name of GMT module to call */
 	char opt_buffer[BUFSIZ] = {""}; /* Local copy of command line options */
+	char cache_key[BUFSIZ] = {""};  /* Module and options, if the output may be kept in the read cache */
+	char cache_file[BUFSIZ] = {""}; /* The file being read, if so */
 	void *ptr = NULL;
+	struct GMTMEX_JOB *job = NULL;  /* Set when the module is to run asynchronously */
 #ifndef SINGLE_SESSION
 	uintptr_t *pti = NULL;          /* To locally store the API address */
 #endif
@@ -153,12 +1560,23 @@ void mexFunction (int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 		mexErrMsgTxt (message); 
 	}
 
+	/* -0. Release anything left behind by a previous call that ended in an error */
+
+	unwind_call ();
+
 	/* 0. No arguments at all results in the GMT banner message */
 	if (nrhs == 0) {
 		usage (nlhs, nrhs);
 		return;
 	}
 
+	/* 0+ Commands that need no GMT session, possibly after the API id */
+	if (mxIsScalar_(prhs[0]) && mxIsUint64(prhs[0])) {
+		if (nrhs > 1 && run_helper (nlhs, plhs, nrhs - 1, &prhs[1])) return;
+	}
+	else if (run_helper (nlhs, plhs, nrhs, prhs))
+		return;
+
 	/* 1. Check for the special commands create and help */
 	
 	if (nrhs == 1) {	/* This may be create or help */
@@ -172,9 +1590,7 @@ void mexFunction (int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 		if (!strncmp (cmd, "create", 6U)) {	/* Asked to create a new GMT session */
 			if (nlhs > 1)	/* Asked for too much output, only 1 or 0 is allowed */
 				mexErrMsgTxt ("GMT: Usage: gmt ('create') or API = gmt ('create');\n");
-			if (pPersistent)                        /* See if have a GMT API pointer */
-				API = (void *)pPersistent[0];
-			if (API != NULL) {                      /* If another session still exists */
+			if ((API = this_API) != NULL) {         /* If another session of this thread still exists */
 				GMT_Report (API, GMT_MSG_VERBOSE,
 				            "GMT: A previous GMT session is still active. Ignoring your 'create' request.\n");
 				if (nlhs) /* Return nothing */
@@ -187,7 +1603,7 @@ void mexFunction (int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 			if (nlhs) {	/* Return the API address as an integer (nlhs == 1 here) )*/
 				plhs[0] = mxCreateNumericMatrix (1, 1, mxUINT64_CLASS, mxREAL);
 				pti = mxGetData(plhs[0]);
-				*pti = *pPersistent;
+				*pti = (uintptr_t)API;
 			}
 
 			mexAtExit(force_Destroy_Session);	/* Register an exit function. */
@@ -195,30 +1611,31 @@ void mexFunction (int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 		}
 
 		/* OK, neither create nor help, must be a single command with no arguments nor the API. So get it: */
-		if (!pPersistent || (API = (void *)pPersistent[0]) == NULL) {	/* No session yet, create one under the hood */
+		if ((API = this_API) == NULL) {	/* No session yet in this thread, create one under the hood */
 			API = Initiate_Session(verbose);    /* Initializing a new GMT session */
 			mexAtExit(force_Destroy_Session);   /* Register an exit function. */
 		}
-		else
-			API = (void *)pPersistent[0];       /* Get the GMT API pointer */
 		if (API == NULL) mexErrMsgTxt ("GMT: This GMT5 session has is corrupted. Better to start from scratch.\n"); 
 	}
 	else if (mxIsScalar_(prhs[0]) && mxIsUint64(prhs[0])) {
 		/* Here, nrhs > 1 . If first arg is a scalar int, we assume it is the API memory address */
 		pti = (uintptr_t *)mxGetData(prhs[0]);
 		API = (void *)pti[0];	/* Get the GMT API pointer */
+		if (!session_owned (API))	/* Sessions are not thread safe, so each thread must use its own */
+			mexErrMsgTxt ("GMT: Unknown GMT session, or one created by another thread. Use the session of this thread or none.\n");
 		first = 1;		/* Commandline args start at prhs[1] since prhs[0] had the API id argument */
 	}
 	else {		/* We still don't have the API, so we must get it from the past or initiate a new session */
-		if (!pPersistent || (API = (void *)pPersistent[0]) == NULL)
+		if ((API = this_API) == NULL)
 			API = Initiate_Session (verbose);	/* Initializing new GMT session */
 			mexAtExit(force_Destroy_Session);	/* Register an exit function. */
 #endif
 	}
 
 #ifdef SINGLE_SESSION
-	/* Initiate a new session */
-	API = Initiate_Session (verbose);	/* Initializing new GMT session */
+	/* Get a warm session from the pool, or initiate a new one */
+	API = pool_get (verbose);
+	mexAtExit (release_all);	/* Register an exit function. */
 #endif
 
 	if (!cmd) {	/* First argument is the command string, e.g., 'blockmean -R0/5/0/5 -I1' or just 'destroy' */
@@ -232,24 +1649,214 @@ void mexFunction (int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 			mexErrMsgTxt ("GMT: Usage is gmt ('destroy');\n");
 
 		if (GMT_Destroy_Options (API, &options)) mexErrMsgTxt ("GMT: Failure to destroy GMT5 options\n");
+		GMTMEX_Free_Residents (API);
+		session_remove (API);	/* Wipe the persistent memory */
 		if (GMT_Destroy_Session (API)) mexErrMsgTxt ("GMT: Failure to destroy GMT5 session\n");
-		*pPersistent = 0;	/* Wipe the persistent memory */
+#else
+		pool_release (API, false);	/* Also empty the pool of warm sessions */
+		pool_flush ();
+#endif
+		return;
+	}
+
+	if (!strcmp (cmd, "warm")) {	/* Start sessions ahead of time so later calls skip the GMT startup */
+		unsigned int n_warm = 1;	/* A persistent session is already warm */
+		if (nrhs - first > 2 || nlhs > 1 || (nrhs - first == 2 && !mxIsNumeric (prhs[first+1])))
+			mexErrMsgTxt ("GMT: Usage is gmt ('warm'[, n]);\n");
+#ifdef SINGLE_SESSION
+		if (nrhs - first == 2) n_warm = (unsigned int)mxGetScalar (prhs[first+1]);
+		n_warm = pool_warm (n_warm, verbose);
+		pool_release (API, true);
+#endif
+		if (nlhs) plhs[0] = mxCreateDoubleScalar ((double)n_warm);
+		return;
+	}
+
+	if (!strcmp (cmd, "wait") || !strcmp (cmd, "ready")) {	/* Collect the outputs of an asynchronous module call */
+		collect_job (nlhs, plhs, nrhs - first - 1, &prhs[first+1], cmd[0] == 'w');
+		GMTMEX_Forget_Objects ();	/* The outputs were freed with the job */
+#ifdef SINGLE_SESSION
+		pool_release (API, true);
+#endif
+		return;
+	}
+
+	if (!strcmp (cmd, "register") || !strcmp (cmd, "unregister") || !strcmp (cmd, "registered")) {	/* Resident objects */
+#ifdef SINGLE_SESSION
+		pool_release (API, true);
+		mexErrMsgTxt ("GMT: Resident objects require a persistent session, which this build does not have\n");
+#endif
+		if (!strcmp (cmd, "registered")) {
+			if (nrhs - first != 1 || nlhs > 1)
+				mexErrMsgTxt ("GMT: Usage is L = gmt ('registered');\n");
+			plhs[0] = GMTMEX_List_Residents (API, nlhs == 0);
+		}
+		else if (nrhs - first != 2)
+			mexErrMsgTxt ("GMT: Usage is h = gmt ('register', obj); or gmt ('unregister', h);\n");
+		else if (cmd[0] == 'r') {
+			if (nlhs != 1) mexErrMsgTxt ("GMT: Usage is h = gmt ('register', obj);\n");
+			Call.active = true;	Call.API = API;	/* So a failed conversion is unwound */
+			plhs[0] = GMTMEX_Register (API, prhs[first+1]);
+			call_done ();
+		}
+		else {
+			if (nlhs != 0) mexErrMsgTxt ("GMT: Usage is gmt ('unregister', h);\n");
+			GMTMEX_Unregister (API, prhs[first+1]);
+		}
+		return;
+	}
+
+	if (!strcmp (cmd, "share") || !strcmp (cmd, "unshare") || !strcmp (cmd, "attach")) {	/* Objects in shared memory */
+		char name[GMT_LEN64] = {""};
+		int n_args = (cmd[0] == 's') ? 3 : 2;
+		if (nrhs - first != n_args || !mxIsChar (prhs[nrhs-1]) || mxGetString (prhs[nrhs-1], name, GMT_LEN64) ||
+		    nlhs != ((cmd[0] == 'a') ? 1 : 0)) {
+#ifdef SINGLE_SESSION
+			pool_release (API, true);
+#endif
+			mexErrMsgTxt ("GMT: Usage is gmt ('share', obj, name); h = gmt ('attach', name); or gmt ('unshare', name);\n");
+		}
+#ifdef SINGLE_SESSION
+		if (cmd[0] == 'a') {
+			pool_release (API, true);
+			mexErrMsgTxt ("GMT: Attached objects are resident objects, which require a persistent session that this build does not have\n");
+		}
+#endif
+		Call.active = true;	Call.API = API;	/* So a failed conversion is unwound */
+		if (cmd[0] == 's')
+			GMTMEX_Share (API, prhs[first+1], name);
+		else if (cmd[0] == 'a')
+			plhs[0] = GMTMEX_Attach (API, name);
+		else
+			GMTMEX_Unshare (name);
+		call_done ();
+#ifdef SINGLE_SESSION
+		pool_release (API, true);
+#endif
+		return;
+	}
+
+	if (!strcmp (cmd, "save") || !strcmp (cmd, "load")) {	/* Objects in native files */
+		char *file = NULL, *mode = NULL;
+		bool resident = false, save = (cmd[0] == 's');
+		int n_args = nrhs - first;
+		if (nlhs != ((save) ? 0 : 1) || n_args < ((save) ? 3 : 2) || n_args > 3 || !mxIsChar (prhs[(save) ? first+2 : first+1]) ||
+		    (!save && n_args == 3 && (!mxIsChar (prhs[first+2]) || strcmp ((mode = mxArrayToString (prhs[first+2])), "resident")))) {
+#ifdef SINGLE_SESSION
+			pool_release (API, true);
+#endif
+			mexErrMsgTxt ("GMT: Usage is gmt ('save', obj, file); obj = gmt ('load', file); or h = gmt ('load', file, 'resident');\n");
+		}
+		resident = (mode != NULL);
+#ifdef SINGLE_SESSION
+		if (resident) {
+			pool_release (API, true);
+			mexErrMsgTxt ("GMT: Loaded resident objects require a persistent session that this build does not have\n");
+		}
+#endif
+		file = mxArrayToString (prhs[(save) ? first+2 : first+1]);
+		Call.active = true;	Call.API = API;	/* So a failed conversion is unwound */
+		if (save)
+			GMTMEX_Save (prhs[first+1], file);
+		else
+			plhs[0] = GMTMEX_Load (API, file, resident);
+		call_done ();
+#ifdef SINGLE_SESSION
+		pool_release (API, true);
+#endif
+		return;
+	}
+
+	if (!strcmp (cmd, "memstats")) {	/* Report the memory accounting of the conversions */
+		if (nrhs - first != 1 || nlhs > 1)
+			mexErrMsgTxt ("GMT: Usage is S = gmt ('memstats');\n");
+		plhs[0] = GMTMEX_Stats (nlhs == 0);
+#ifdef SINGLE_SESSION
+		pool_release (API, true);
+#endif
+		return;
+	}
+
+	if (!strcmp (cmd, "stack")) {	/* Run the module on every layer of a grid stack */
+#ifdef SINGLE_SESSION
+		pool_release (API, true);	/* Not needed since each worker has its own session */
+#endif
+		run_stack (verbose, nlhs, plhs, nrhs - first - 1, &prhs[first+1]);
+		return;
+	}
+
+	if (!strcmp (cmd, "map")) {	/* Run the module on every item of a cell array */
+#ifdef SINGLE_SESSION
+		pool_release (API, true);	/* Not needed since each worker has its own session */
+#endif
+		run_map (verbose, nlhs, plhs, nrhs - first - 1, &prhs[first+1]);
+		return;
+	}
+
+	if (!strcmp (cmd, "tile")) {	/* Run the module on bands of rows of a grid and stitch the results */
+#ifdef SINGLE_SESSION
+		pool_release (API, true);	/* Not needed since each worker has its own session */
 #endif
+		run_tile (verbose, nlhs, plhs, nrhs - first - 1, &prhs[first+1]);
 		return;
 	}
 
+	if (!strcmp (cmd, "async")) {	/* Run the module in its own session on a background thread */
+		if (nrhs < (int)first + 2 || !mxIsChar (prhs[first+1]) || nlhs > 1)
+			mexErrMsgTxt ("GMT: Usage is f = gmt ('async', 'module_name options'[, <matlab arrays>]);\n");
+#ifdef SINGLE_SESSION
+		pool_release (API, true);	/* Not needed since the job has its own session */
+#endif
+		first++;	/* Skip the 'async' argument */
+		job = new_job (verbose, &prhs[first+1], nrhs - first - 1);
+		API = job->API;
+		cmd = mxArrayToString (prhs[first]);
+		if ((job->cmd = malloc (strlen (cmd) + 1)) != NULL) strcpy (job->cmd, cmd);
+	}
+
 	/* 2. Get module name and separate out args */
 	
 	/* Here we have a GMT module call. The documented use is to give the module name separately from
 	 * the module options, but users may forget and combine the two.  So we check both cases. */
 	
-	n_in_objects = nrhs - 1;
+	Call.active = true;	Call.API = API;	Call.job = job;	/* From here on, failures must be unwound */
+	while (!strcmp (cmd, "matrix") || !strcmp (cmd, "layout") || !strcmp (cmd, "segments")) {	/* Output options that take one argument and precede the module */
+		char *type = NULL;
+		if (job || nrhs < (int)first + 3 || !mxIsChar (prhs[first+1]) || !mxIsChar (prhs[first+2]))
+			call_failed ("GMT: Usage is out = gmt ('matrix', class, ...), gmt ('layout', 'TRF', ...) or gmt ('segments', 'single', ...) followed by 'module_name options'[, <matlab arrays>]\n");
+		type = mxArrayToString (prhs[first+1]);
+		if (cmd[0] == 'm') {	/* Return dataset outputs as bare matrices of the given class */
+			Call.matrix_output = true;
+			if (GMTMEX_Set_Matrix_Output (API, type) != GMT_NOERROR) {
+				mxFree (type);
+				call_failed ("GMT: Unknown matrix class; use double, single, [u]int64, [u]int32, [u]int16 or [u]int8\n");
+			}
+		}
+		else if (cmd[0] == 's') {	/* Return dataset segment data in the given class */
+			Call.segment_class = true;
+			if (GMTMEX_Set_Segment_Class (type) != GMT_NOERROR) {
+				mxFree (type);
+				call_failed ("GMT: Unknown segment class; use single or double (the default)\n");
+			}
+		}
+		else {	/* Return grids in the given memory layout */
+			Call.grid_layout = true;
+			if (GMTMEX_Set_Grid_Layout (type) != GMT_NOERROR) {
+				mxFree (type);
+				call_failed ("GMT: Unknown grid layout; use TRF (GMT row order) or TCF (the default)\n");
+			}
+		}
+		mxFree (type);
+		first += 2;	/* Skip the option and its argument */
+		cmd = mxArrayToString (prhs[first]);
+	}
+	n_in_objects = nrhs - first - 1;
 	str_length = strlen (cmd);				/* Length of module (or command) argument */
 	for (k = 0; k < str_length && cmd[k] != ' '; k++);	/* Determine first space in command */
 	
 	if (k == str_length) {	/* Case 2a): No spaces found: User gave 'module' separately from 'options' */
 		strcpy (module, cmd);				/* Isolate the module name in this string */
-		if (nrhs > 1 && mxIsChar (prhs[first+1])) {	/* Got option string */
+		if (nrhs > (int)first + 1 && mxIsChar (prhs[first+1])) {	/* Got option string */
 			first++;	/* Since we have a 2nd string to skip now */
 			opt_args = mxArrayToString (prhs[first]);
 			n_in_objects--;
@@ -258,7 +1865,7 @@ void mexFunction (int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 	}
 	else {	/* Case b2. Get mex arguments, if any, and extract the GMT module name */
 		if (k >= MODULE_LEN)
-			mexErrMsgTxt ("GMT: Module name in command is too long\n");
+			call_failed ("GMT: Module name in command is too long\n");
 		strncpy (module, cmd, k);	/* Isolate the module name in this string */
 
 		while (cmd[k] == ' ') k++;	/* Skip any spaces between module name and start of options */
@@ -271,6 +1878,7 @@ void mexFunction (int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 		char t[256] = {""};
 		if (!opt_args) {
 			mexPrintf("Warning: calling the 'gmt' program by itself does nothing here.\n");
+			unwind_call ();
 			return;
 		}
 		if (!strcmp(opt_args, "--show-bindir")) 	/* Show the directory that contains the 'gmt' executable */
@@ -292,19 +1900,39 @@ void mexFunction (int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 		}
 		else
 			mexPrintf ("Warning: called the 'gmt' program with unknown option.\n");
+		unwind_call ();
 		return;
 	}
 
 	/* Make sure this is a valid module */
 	if ((status = GMT_Call_Module (API, module, GMT_MODULE_EXIST, NULL)) != GMT_NOERROR) 	/* No, not found */
-		mexErrMsgTxt ("GMT: No module by that name was found.\n"); 
+		call_failed ("GMT: No module by that name was found.\n");
+
+	/* 2- gmtread outputs may be in the read cache, in which case we are done already */
+	if (cache_budget && !job && n_in_objects == 0 && nlhs <= 1 && opt_args && !Call.matrix_output && !Call.grid_layout &&
+	    !Call.segment_class &&
+	    (!strcmp (module, "read") || !strcmp (module, "gmtread"))) {
+		struct GMT_OPTION *head = GMT_Create_Options (API, 0, opt_args), *opt = NULL;
+		if (head && (opt = GMT_Find_Option (API, GMT_OPT_INFILE, head)) != NULL && opt->arg) {
+			snprintf (cache_key, BUFSIZ, "%s %s", module, opt_args);
+			strncpy (cache_file, opt->arg, BUFSIZ - 1);
+		}
+		if (head) GMT_Destroy_Options (API, &head);
+		if (cache_file[0] && (plhs[0] = cache_lookup (cache_key, cache_file)) != NULL) {
+			call_done ();
+#ifdef SINGLE_SESSION
+			pool_release (API, true);
+#endif
+			return;
+		}
+	}
 	
 	/* Below here we may actually wish to add options to the opt_args, but it is a pointer.  So we duplicate to
 	 * another string with enough space. */
 	
 	if (opt_args) strcpy (opt_buffer, opt_args);	/* opt_buffer has lots of space for additions */
 	/* 2+ Add -F to psconvert if user requested a return image but did not explicitly give -F */
-	if (!strncmp (module, "psconvert", 9U) && nlhs == 1 && (!opt_args || !strstr ("-F", opt_args))) {	/* OK, add -F */
+	if (!strncmp (module, "psconvert", 9U) && nlhs == 1 && !job && (!opt_args || !strstr ("-F", opt_args))) {	/* OK, add -F */
 		if (opt_args)
 			strcat (opt_buffer, " -F");
 		else
@@ -319,22 +1947,24 @@ void mexFunction (int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 	}
 	/* 2+++ If gmtread -Ti then temporarily set pad to 0 since we don't want padding in image arrays */
 	else if (strstr(module, "read") && opt_args && strstr(opt_args, "-Ti"))
-		GMT_Set_Default(API, "API_PAD", "0");
+		GMT_Set_Default(API, "API_PAD", "0"), Call.pad_changed = true;
 
 	/* 3. Convert mex command line arguments to a linked GMT option list */
 	if (opt_buffer[0] && (options = GMT_Create_Options (API, 0, opt_buffer)) == NULL)
-		mexErrMsgTxt ("GMT: Failure to parse GMT5 command options\n");
+		call_failed ("GMT: Failure to parse GMT5 command options\n");
 
 	if (!options && nlhs == 0 && nrhs == 1 && strcmp (module, "end")) 	/* Just requesting usage message, so add -? to options */
 		options = GMT_Create_Options (API, 0, "-?");
+	Call.options = options;
 	
 	/* 4. Preprocess to update GMT option lists and return info array X */
 	if ((X = GMT_Encode_Options (API, module, n_in_objects, &options, &n_items)) == NULL) {
 		if (n_items == UINT_MAX)	/* Just got usage/synopsis option */
 			n_items = 0;
 		else
-			mexErrMsgTxt ("GMT: Failure to encode mex command options\n");
+			call_failed ("GMT: Failure to encode mex command options\n");
 	}
+	Call.options = options;	Call.X = X;	Call.n_items = n_items;
 	
 	if (options) {	/* Only for debugging - remove this section when stable */
 		gtxt = GMT_Create_Cmd (API, options);
@@ -344,12 +1974,17 @@ void mexFunction (int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 	
 	/* 5. Assign input sources (from MATLAB to GMT) and output destinations (from GMT to MATLAB) */
 	
+	GMTMEX_Stats_Begin ();
+	GMTMEX_Stage_Begin (job == NULL);	/* The inputs of a job outlive this call */
+	GMTMEX_Set_Resident_Use (module);	/* Modules that may change their inputs get copies of resident objects */
 	for (k = 0; k < n_items; k++) {	/* Number of GMT containers involved in this module call */
 		if (X[k].direction == GMT_IN) {
-			if ((X[k].pos+first+1) < (unsigned int)nrhs)
+			if (job && X[k].pos < job->n_inputs)	/* Use the private copy owned by the job */
+				ptr = (void *)job->input[X[k].pos];
+			else if ((X[k].pos+first+1) < (unsigned int)nrhs)
 				ptr = (void *)prhs[X[k].pos+first+1];
 			else
-				mexErrMsgTxt ("GMT: Attempting to address a prhs entry that does not exist\n");
+				call_failed ("GMT: Attempting to address a prhs entry that does not exist\n");
 		}
 		else {
 			if ((X[k].pos) < nlhs)
@@ -362,14 +1997,34 @@ void mexFunction (int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 		GMTMEX_Set_Object (API, &X[k], ptr);	/* Set object pointer */
 	}
 	
+	if (job) {	/* Hand the module call over to a background thread and return the job handle */
+		strcpy (job->module, module);
+		job->options = options;
+		job->X = X;
+		job->n_items = n_items;
+		if (gmtmex_thread_create (&job->thread, job_worker, job)) {
+			job->done = true;	/* So the job can be released */
+			call_failed ("GMT: Failure to start background thread for asynchronous job\n");
+		}
+		publish_job (job);
+		GMTMEX_Stage_End ();	/* Nothing was staged */
+		call_done ();	/* The job owns the containers and options now */
+		plhs[0] = mxCreateNumericMatrix (1, 1, mxUINT64_CLASS, mxREAL);
+		*(uint64_t *)mxGetData (plhs[0]) = job->id;
+		return;
+	}
+
 	/* 6. Run GMT module; give usage message if errors arise during parsing */
 	status = GMT_Call_Module (API, module, GMT_MODULE_OPT, options);
 	if (status != GMT_NOERROR) {
-		if (status <= GMT_MODULE_PURPOSE)
+		if (status <= GMT_MODULE_PURPOSE) {	/* Just gave usage or synopsis */
+			unwind_call ();
 			return;
+		}
 		else {
+			GMTMEX_Log_Flush ();	/* So the module messages come before ours */
 			mexPrintf("GMT: Module return with failure while executing the command\n%s\n", cmd);
-			mexErrMsgTxt("GMT: exiting\n");
+			call_failed ("GMT: exiting\n");
 		}
 	}
 
@@ -380,32 +2035,31 @@ void mexFunction (int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 		pos = X[k].pos;		/* Short-hand for index into the plhs[] array being returned to MATLAB */
 		plhs[pos] = GMTMEX_Get_Object (API, &X[k]);	/* Hook mex object onto rhs list */
 	}
+	if (cache_file[0] && plhs[0]) cache_store (cache_key, cache_file, plhs[0]);
+	if (Call.matrix_output) GMTMEX_Set_Matrix_Output (API, NULL), Call.matrix_output = false;
+	if (Call.grid_layout) GMTMEX_Set_Grid_Layout (NULL), Call.grid_layout = false;
+	if (Call.segment_class) GMTMEX_Set_Segment_Class (NULL), Call.segment_class = false;
 
 	/* 2++- If gmtread -Ti then reset the sessions pad value that was temporarily changed above (2+++) */
 	if (strstr(module, "read") && opt_args && strstr(opt_args, "-Ti"))
 		GMT_Set_Default (API, "API_PAD", "2");
+	Call.pad_changed = false;
 
 	/* 8. Free all GMT containers involved in this module call */
 	
-	for (k = 0; k < n_items; k++) {
-		void *ppp = X[k].object;
-		if (GMT_Close_VirtualFile (API, X[k].name) != GMT_NOERROR)
-			mexErrMsgTxt ("GMT: Failed to close virtual file\n");
-		if (GMT_Destroy_Data (API, &X[k].object) != GMT_NOERROR)
-			mexErrMsgTxt ("GMT: Failed to destroy object used in the interface between GMT and MATLAB\n");
-		else {	/* Success, now make sure we don't destroy the same pointer more than once */
-			for (size_t kk = k+1; kk < n_items; kk++)
-				if (X[kk].object == ppp) X[kk].object = NULL;
-		}
-	}
+	GMTMEX_Forget_Objects ();	/* Since free_containers takes over from here */
+	Call.n_items = 0;
+	free_containers (API, X, n_items);
+	GMTMEX_Stage_End ();
 
 	/* 9. Destroy linked option list */
 	
+	Call.options = NULL;
 	if (GMT_Destroy_Options (API, &options) != GMT_NOERROR)
 		mexErrMsgTxt ("GMT: Failure to destroy GMT5 options\n");
+	call_done ();
 #ifdef SINGLE_SESSION
-	if (GMT_Destroy_Session (API))
-		mexErrMsgTxt ("GMT: Failure to destroy GMT5 session\n");
+	pool_release (API, pool_keeps (module));
 #endif
 	return;
 }
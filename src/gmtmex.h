@@ -94,6 +94,7 @@
 
 #if MATLAB_VERSION < 0x2006b
 typedef int mwSize;
+typedef int mwIndex;
 #endif
 #endif
 
@@ -102,9 +103,9 @@ typedef int mwSize;
 #	define MEX_COL_ORDER GMT_IS_ROW_FORMAT
 	/* Macros for getting the Octave(oct) ij that correspond to (row,col) [no pad involved] */
 	/* This one operates on GMT_MATRIX */
-#	define MEXM_IJ(M,row,col) ((row)*M->n_columns + (col))
+#	define MEXM_IJ(M,row,col) ((uint64_t)(row)*M->n_columns + (col))
 	/* And this on GMT_GRID */
-#	define MEXG_IJ(M,row,col) ((row)*M->header->n_columns + (col))
+#	define MEXG_IJ(M,row,col) ((uint64_t)(row)*M->header->n_columns + (col))
 #else	/* Here we go for Matlab or Octave(mex) */
 #	ifdef GMT_MATLAB
 #		define MEX_PROG "Matlab"
@@ -114,9 +115,9 @@ typedef int mwSize;
 #	define MEX_COL_ORDER GMT_IS_COL_FORMAT
 	/* Macros for getting the Matlab/Octave(mex) ij that correspond to (row,col) [no pad involved] */
 	/* This one operates on GMT_MATRIX */
-#	define MEXM_IJ(M,row,col) ((col)*M->n_rows + (row))
+#	define MEXM_IJ(M,row,col) ((uint64_t)(col)*M->n_rows + (row))
 	/* And this on GMT_GRID */
-#	define MEXG_IJ(M,row,col) ((col)*M->header->n_rows + M->header->n_rows - (row) - 1)
+#	define MEXG_IJ(M,row,col) ((uint64_t)(col)*M->header->n_rows + M->header->n_rows - (row) - 1)
 #endif
 
 /* Definitions of MEX structures used to hold GMT objects.
@@ -172,9 +173,107 @@ static const char *GMTMEX_fieldname_ps[N_MEX_FIELDNAMES_PS] =
 
 #define MODULE_LEN 	32	/* Max length of a GMT module name */
 
-/* These 4 functions are used by gmtmex.c: */
+/* Minimal portable threads and mutexes, used to run modules in separate sessions in the background
+ * and to guard the state shared by the threads of a MATLAB thread-based pool.  GMTMEX_MUTEX_INITIALIZER
+ * sets up a static mutex without any call, so it is ready before the first thread gets to it. */
+#if defined(WIN32)
+#	include <windows.h>
+	typedef HANDLE gmtmex_thread_t;
+	typedef SRWLOCK gmtmex_mutex_t;
+#	define GMTMEX_THREAD_FUNC(name) DWORD WINAPI name (LPVOID arg)
+#	define GMTMEX_THREAD_RETURN return 0
+#	define gmtmex_thread_create(t,func,arg) ((*(t) = CreateThread (NULL, 0, func, arg, 0, NULL)) == NULL)
+#	define gmtmex_thread_join(t) (WaitForSingleObject (t, INFINITE), CloseHandle (t))
+#	define GMTMEX_MUTEX_INITIALIZER SRWLOCK_INIT
+#	define gmtmex_mutex_init(m) InitializeSRWLock (m)
+#	define gmtmex_mutex_free(m)
+#	define gmtmex_mutex_lock(m) AcquireSRWLockExclusive (m)
+#	define gmtmex_mutex_unlock(m) ReleaseSRWLockExclusive (m)
+#	define GMTMEX_TLS __declspec(thread)
+#else
+#	include <pthread.h>
+	typedef pthread_t gmtmex_thread_t;
+	typedef pthread_mutex_t gmtmex_mutex_t;
+#	define GMTMEX_THREAD_FUNC(name) void *name (void *arg)
+#	define GMTMEX_THREAD_RETURN return NULL
+#	define gmtmex_thread_create(t,func,arg) pthread_create (t, NULL, func, arg)
+#	define gmtmex_thread_join(t) pthread_join (t, NULL)
+#	define GMTMEX_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#	define gmtmex_mutex_init(m) pthread_mutex_init (m, NULL)
+#	define gmtmex_mutex_free(m) pthread_mutex_destroy (m)
+#	define gmtmex_mutex_lock(m) pthread_mutex_lock (m)
+#	define gmtmex_mutex_unlock(m) pthread_mutex_unlock (m)
+#	define GMTMEX_TLS __thread
+#endif
+
+#define GMTMEX_MAX_JOBS	64	/* Max number of asynchronous module calls in flight at any time */
+#define GMTMEX_MAX_SESSIONS	256	/* Max number of threads that each hold a persistent session */
+
+/* Number of processors available to run worker threads */
+#if defined(WIN32)
+#	define gmtmex_n_cores() ((unsigned int)GetActiveProcessorCount (ALL_PROCESSOR_GROUPS))
+#else
+#	include <unistd.h>
+#	define gmtmex_n_cores() ((unsigned int)sysconf (_SC_NPROCESSORS_ONLN))
+#endif
+
+/* A grid stack: the layers of a rows x columns x layers MATLAB array sharing one grid header */
+struct GMTMEX_STACK {
+	double range[6], inc[2];        /* Header shared by all layers */
+	unsigned int registration;
+	double nan_value;               /* No-data sentinel, turned into NaN on input (NaN if none) */
+	uint64_t n_rows, n_columns, n_layers;
+	bool is_single;                 /* true if data is float, else double */
+	void *data;                     /* The MATLAB array, in MATLAB order */
+};
+
+/* Statistics of the grid nodes, gathered while copying a grid between MATLAB and GMT */
+struct GMTMEX_ZSTATS {
+	double z_min, z_max;            /* NaN if all nodes are NaN */
+	double mean;                    /* Mean of the non-NaN nodes */
+	uint64_t n_nan;                 /* Number of NaN nodes */
+};
+
+/* These functions are used by gmtmex.c: */
 EXTERN_MSC char   GMTMEX_objecttype (const mxArray *ptr);
 EXTERN_MSC int    GMTMEX_print_func (FILE *fp, const char *message);
+EXTERN_MSC void   GMTMEX_Log_Text (const char *text);
+EXTERN_MSC int    GMTMEX_Set_Log (const char *mode);
+EXTERN_MSC void   GMTMEX_Log_Flush (void);
+EXTERN_MSC mxArray *GMTMEX_Get_Log (void);
 EXTERN_MSC void   GMTMEX_Set_Object (void *API, struct GMT_RESOURCE *X, const mxArray *ptr);
 EXTERN_MSC void * GMTMEX_Get_Object (void *API, struct GMT_RESOURCE *X);
+EXTERN_MSC mxArray *GMTMEX_colorize (const mxArray *grid, const mxArray *cpt);
+EXTERN_MSC mxArray *GMTMEX_Register (void *API, const mxArray *ptr);
+EXTERN_MSC void   GMTMEX_Unregister (void *API, const mxArray *ptr);
+EXTERN_MSC void   GMTMEX_Free_Residents (void *API);
+EXTERN_MSC bool   GMTMEX_Is_Resident (void *object);
+EXTERN_MSC mxArray *GMTMEX_List_Residents (void *API, bool print);
+EXTERN_MSC void   GMTMEX_Share (void *API, const mxArray *ptr, const char *name);
+EXTERN_MSC void   GMTMEX_Unshare (const char *name);
+EXTERN_MSC void   GMTMEX_Unshare_All (void);
+EXTERN_MSC mxArray *GMTMEX_Attach (void *API, const char *name);
+EXTERN_MSC void    GMTMEX_Save (const mxArray *ptr, const char *file);
+EXTERN_MSC mxArray *GMTMEX_Load (void *API, const char *file, bool resident);
+EXTERN_MSC void   GMTMEX_Stats_Begin (void);
+EXTERN_MSC mxArray *GMTMEX_Stats (bool print);
+EXTERN_MSC void   GMTMEX_Forget_Objects (void);
+EXTERN_MSC void   GMTMEX_Unwind_Objects (void);
+EXTERN_MSC bool   GMTMEX_Get_Stack (const mxArray *ptr, struct GMTMEX_STACK *S);
+EXTERN_MSC void * GMTMEX_Convert_Input (void *API, unsigned int family, unsigned int module_input, const mxArray *ptr, unsigned int *actual_family);
+EXTERN_MSC mxArray *GMTMEX_Get_Layers (void *API, unsigned int family, void **objects, uint64_t n_layers, unsigned int stride, bool stack);
+EXTERN_MSC int    GMTMEX_Set_Matrix_Output (void *API, const char *type);
+EXTERN_MSC mxArray *GMTMEX_catseg (int nrhs, const mxArray *prhs[]);
+EXTERN_MSC mxArray *GMTMEX_wrapgrid (int nrhs, const mxArray *prhs[]);
+EXTERN_MSC mxArray *GMTMEX_wrapseg (int nrhs, const mxArray *prhs[]);
+EXTERN_MSC mxArray *GMTMEX_record (int nrhs, const mxArray *prhs[]);
+EXTERN_MSC mxArray *GMTMEX_catcpt (int nrhs, const mxArray *prhs[]);
+EXTERN_MSC void   GMTMEX_Copy_Grid_In (struct GMT_GRID *G, const void *data, bool is_single, bool row_major, double sentinel, struct GMTMEX_ZSTATS *Z);
+EXTERN_MSC int    GMTMEX_Set_Grid_Layout (const char *layout);
+EXTERN_MSC int    GMTMEX_Set_Segment_Class (const char *type);
+EXTERN_MSC void   GMTMEX_Set_Resident_Use (const char *module);
+EXTERN_MSC void   GMTMEX_Stage_Begin (bool synchronous);
+EXTERN_MSC void   GMTMEX_Stage_End (void);
+EXTERN_MSC void   GMTMEX_Stage_Flush (void);
+EXTERN_MSC mxArray *GMTMEX_Staging (int nrhs, const mxArray *prhs[]);
 #endif
@@ -30,6 +30,14 @@
 #include <float.h>
 #include <math.h>
 #include <limits.h>
+#if !defined(WIN32)
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #ifndef rint
 	#define rint(x) (floor((x)+0.5f)) //does not work reliable.
@@ -70,6 +78,9 @@ enum MEX_dim {
  *		  + A 2-D matrix with rows and columns (double precision)
  *		  + An optional cell array with strings from trailing columns that could not be deciphered as data.
  *		  + First segment may also have dataset comment and proj4/wtk strings
+ *		As input we also accept all segments in one matrix, as {M} with NaN-rows between segments
+ *		or {M, idx} with a vector of segment ids or segment start rows, and a scalar structure of
+ *		numeric column vectors (e.g., from a MATLAB table) which is passed via GMT_VECTOR.
  * GMT_PALETTE: Handled with a MATLAB structure and we use GMT's native GMT_PALETTE for the passing.
  *		  + colormap is the N*3 matrix for MATLAB colormaps
  *		  + range is a N-element array with z-values at color changes
@@ -87,16 +98,168 @@ enum MEX_dim {
  *		  + comment holds any PostScript comments
  */
 
+/* Log sink: by default every GMT message goes straight to the MATLAB console, which with -Vd on a
+ * big module serializes the call through the command window.  gmt ('log', 'buffer') instead keeps
+ * the messages in a ring buffer with their time, level and module and prints them all at once at the
+ * end of the module call.  gmt ('log', 'keep') prints nothing but errors, and L = gmt ('log') returns
+ * the kept messages as a structure array.  Like the session, the buffer belongs to the calling thread. */
+
+#define GMTMEX_LOG_SIZE	4096	/* Oldest messages are dropped beyond this */
+
+enum GMTMEX_log_modes {GMTMEX_LOG_CONSOLE = 0, GMTMEX_LOG_BUFFER, GMTMEX_LOG_KEEP};
+static const char *GMTMEX_log_mode_name[3] = {"console", "buffer", "keep"};
+
+struct GMTMEX_LOGITEM {
+	double time;                    /* Seconds since 1970 */
+	char level[GMT_LEN16];          /* ERROR, WARNING, INFORMATION, DEBUG, ... or empty for continued lines */
+	char module[MODULE_LEN];        /* Module or function that produced it, if known */
+	char *text;                     /* The message without the module and level prefix */
+};
+
+static GMTMEX_TLS struct GMTMEX_LOGITEM *Log = NULL;	/* Ring of GMTMEX_LOG_SIZE items, allocated on first use */
+static GMTMEX_TLS unsigned int log_first = 0, log_n = 0, log_mode = GMTMEX_LOG_CONSOLE;
+static GMTMEX_TLS uint64_t log_dropped = 0;	/* Messages lost since the buffer was last emptied */
+
+static double gmtmex_now (void) {
+	/* Wall-clock time in seconds since 1970 */
+#if defined(WIN32)
+	FILETIME t;
+	GetSystemTimeAsFileTime (&t);	/* 100 ns ticks since 1601 */
+	return (((((uint64_t)t.dwHighDateTime) << 32) + t.dwLowDateTime) * 1.0e-7 - 11644473600.0);
+#else
+	struct timeval t;
+	gettimeofday (&t, NULL);
+	return ((double)t.tv_sec + 1.0e-6 * t.tv_usec);
+#endif
+}
+
+static void gmtmex_log_clear (void) {
+	unsigned int k;
+	for (k = 0; k < log_n; k++) free (Log[(log_first + k) % GMTMEX_LOG_SIZE].text);
+	log_first = log_n = 0;
+	log_dropped = 0;
+}
+
+static struct GMTMEX_LOGITEM *gmtmex_log_add (const char *message, size_t len) {
+	/* Append one message to the ring, splitting off the "module [LEVEL]: " prefix that GMT_Report adds.
+	 * Returns the new item, or NULL if there is no ring and the message was printed instead */
+	size_t n = 0;
+	const char *c = NULL, *e = NULL;
+	struct GMTMEX_LOGITEM *L = NULL;
+	if (Log == NULL && (Log = calloc (GMTMEX_LOG_SIZE, sizeof (struct GMTMEX_LOGITEM))) == NULL) {
+		mexPrintf ("%.*s", (int)len, message);	/* Better printed than lost */
+		return (NULL);
+	}
+	if (log_n == GMTMEX_LOG_SIZE) {	/* Full; overwrite the oldest */
+		free (Log[log_first].text);
+		log_first = (log_first + 1) % GMTMEX_LOG_SIZE;
+		log_n--;	log_dropped++;
+	}
+	L = &Log[(log_first + log_n++) % GMTMEX_LOG_SIZE];
+	memset (L, 0, sizeof (struct GMTMEX_LOGITEM));
+	L->time = gmtmex_now ();
+	if ((c = memchr (message, '[', len)) != NULL && c > message && c[-1] == ' ' && (n = c - message - 1) < MODULE_LEN &&
+	    (e = memchr (c, ']', len - (c - message))) != NULL && (size_t)(e - c - 1) < GMT_LEN16 && e[1] == ':') {
+		memcpy (L->module, message, n);
+		memcpy (L->level, c + 1, e - c - 1);
+		e += 2;	/* Skip "]:" and the blank that follows */
+		if (*e == ' ') e++;
+		len -= (e - message);
+		message = e;
+	}
+	while (len && (message[len-1] == '\n' || message[len-1] == '\r')) len--;	/* One message per item, so no line breaks */
+	if ((L->text = malloc (len + 1)) != NULL) {
+		memcpy (L->text, message, len);
+		L->text[len] = '\0';
+	}
+	return (L);
+}
+
 int GMTMEX_print_func (FILE *fp, const char *message) {
 	/* Replacement for GMT's gmt_print_func.  It is being used indirectly via
 	 * API->print_func.  Purpose of this is to allow MATLAB (which cannot use
 	 * printf) to reset API->print_func to this function via GMT_Create_Session.
-	 * This allows GMT's errors and warnings to appear in MATLAB console. */
+	 * This allows GMT's errors and warnings to appear in MATLAB console, now or
+	 * when the log is flushed. */
+	struct GMTMEX_LOGITEM *L = NULL;
 
-	mexPrintf (message);
+	if (log_mode == GMTMEX_LOG_CONSOLE) {
+		mexPrintf ("%s", message);	/* Not as the format, since messages may contain % */
+		return 0;
+	}
+	L = gmtmex_log_add (message, strlen (message));
+	if (log_mode == GMTMEX_LOG_KEEP && L && !strcmp (L->level, "ERROR"))
+		mexPrintf ("%s", message);	/* A failing call should still say why */
 	return 0;
 }
 
+void GMTMEX_Log_Text (const char *text) {
+	/* Log the messages collected from a worker thread, one item per line */
+	const char *eol = NULL;
+	if (text == NULL) return;
+	if (log_mode == GMTMEX_LOG_CONSOLE) {
+		mexPrintf ("%s", text);
+		return;
+	}
+	for (; *text; text = eol) {
+		if ((eol = strchr (text, '\n')) == NULL) eol = text + strlen (text);
+		else eol++;
+		gmtmex_log_add (text, eol - text);
+	}
+}
+
+int GMTMEX_Set_Log (const char *mode) {
+	/* Select where GMT messages go; pending buffered messages are printed first */
+	unsigned int k;
+	for (k = 0; k < 3 && strcmp (mode, GMTMEX_log_mode_name[k]); k++);
+	if (k == 3) return (GMT_NOTSET);
+	GMTMEX_Log_Flush ();
+	log_mode = k;
+	return (GMT_NOERROR);
+}
+
+void GMTMEX_Log_Flush (void) {
+	/* In buffer mode print all pending messages with a single mexPrintf, at the end of a call */
+	unsigned int k;
+	size_t len = 0, n;
+	char *out = NULL;
+	struct GMTMEX_LOGITEM *L = NULL;
+	if (log_mode != GMTMEX_LOG_BUFFER || log_n == 0) return;
+	for (k = 0; k < log_n; k++) {
+		L = &Log[(log_first + k) % GMTMEX_LOG_SIZE];
+		len += strlen (L->module) + strlen (L->level) + ((L->text) ? strlen (L->text) : 0) + 6;
+	}
+	if ((out = malloc (len + GMT_LEN64)) != NULL) {
+		for (k = 0, len = 0; k < log_n; k++) {
+			L = &Log[(log_first + k) % GMTMEX_LOG_SIZE];
+			n = (L->level[0]) ? sprintf (&out[len], "%s [%s]: ", L->module, L->level) : 0;
+			len += n + sprintf (&out[len + n], "%s\n", (L->text) ? L->text : "");
+		}
+		if (log_dropped) sprintf (&out[len], "[%" PRIu64 " older messages were dropped]\n", log_dropped);
+		mexPrintf ("%s", out);
+		free (out);
+	}
+	gmtmex_log_clear ();
+}
+
+mxArray *GMTMEX_Get_Log (void) {
+	/* Return the kept messages as a structure array with fields time, level, module and message, and empty the buffer */
+	unsigned int k;
+	const char *fields[4] = {"time", "level", "module", "message"};
+	struct GMTMEX_LOGITEM *L = NULL;
+	mxArray *out = mxCreateStructMatrix (log_n, (log_n) ? 1 : 0, 4, fields);
+	for (k = 0; k < log_n; k++) {
+		L = &Log[(log_first + k) % GMTMEX_LOG_SIZE];
+		mxSetField (out, k, "time", mxCreateDoubleScalar (L->time));
+		mxSetField (out, k, "level", mxCreateString (L->level));
+		mxSetField (out, k, "module", mxCreateString (L->module));
+		mxSetField (out, k, "message", mxCreateString ((L->text) ? L->text : ""));
+	}
+	if (log_dropped) mexPrintf ("Warning: %" PRIu64 " older log messages were dropped\n", log_dropped);
+	gmtmex_log_clear ();
+	return (out);
+}
+
 static uint64_t gmtmex_getMNK (const mxArray *p, int which) {
 	/* Get number of columns or number of bands of a mxArray.
 	   which = 0 to inquire n_rows
@@ -132,24 +295,104 @@ static void gmtmex_quit_if_missing (const char *function, const char *field) {
 	mexErrMsgTxt (buffer);
 }
 
-static void *gmtmex_get_grid (void *API, struct GMT_GRID *G) {
-	/* Given an incoming GMT grid G, build a MATLAB structure and assign the output components.
+/* Containers created by the conversions of the current module call.  Until the call ends normally
+ * and GMTMEX_Forget_Objects is called they may be orphans of a mexErrMsgTxt long jump, so
+ * GMTMEX_Unwind_Objects can find and destroy them at the start of the next call. */
+struct GMTMEX_TRACKED {
+	void *API;
+	void *object;
+};
+static GMTMEX_TLS struct GMTMEX_TRACKED *Tracked = NULL;	/* Per thread, like the calls they belong to */
+static GMTMEX_TLS unsigned int n_tracked = 0, n_tracked_alloc = 0;
+
+static void gmtmex_track (void *API, void *object) {
+	struct GMTMEX_TRACKED *tmp = NULL;
+	if (n_tracked == n_tracked_alloc) {	/* Need more space; if we cannot get it the object is merely not tracked */
+		unsigned int n_alloc = (n_tracked_alloc) ? 2 * n_tracked_alloc : 32;
+		if ((tmp = realloc (Tracked, n_alloc * sizeof (struct GMTMEX_TRACKED))) == NULL) return;
+		Tracked = tmp;	n_tracked_alloc = n_alloc;
+	}
+	Tracked[n_tracked].API = API;
+	Tracked[n_tracked++].object = object;
+}
+
+static void gmtmex_untrack (void *object) {
+	/* The object is being destroyed by the call itself, so an unwind must not destroy it again */
+	unsigned int k;
+	for (k = 0; k < n_tracked; k++)
+		if (Tracked[k].object == object) Tracked[k].object = NULL;
+}
+
+void GMTMEX_Forget_Objects (void) {
+	/* The call ended normally and its containers were freed or handed over */
+	n_tracked = 0;
+}
+
+void GMTMEX_Unwind_Objects (void) {
+	/* Destroy all containers left behind by an abandoned call, except resident objects */
+	unsigned int k, j;
+	for (k = 0; k < n_tracked; k++) {
+		if (Tracked[k].object == NULL || GMTMEX_Is_Resident (Tracked[k].object)) continue;
+		for (j = k + 1; j < n_tracked; j++)	/* Only destroy each container once */
+			if (Tracked[j].object == Tracked[k].object) Tracked[j].object = NULL;
+		if (GMT_Destroy_Data (Tracked[k].API, &Tracked[k].object) != GMT_NOERROR)
+			GMT_Report (Tracked[k].API, GMT_MSG_DEBUG, "GMTMEX_Unwind_Objects: Failure to destroy an abandoned container\n");
+	}
+	n_tracked = 0;
+}
+
+/* Grid output layout: by default grids are returned to MATLAB column-major with the first row at the
+ * bottom.  gmt ('layout', 'TRF', ...) instead returns GMT's own row order with only the pad removed, i.e.
+ * z is n_columns x n_rows, z(:,1) is the top row and y runs from north to south.  Such grids are also
+ * accepted as input when their layout field says TRF. */
+
+static GMTMEX_TLS bool gmtmex_grid_row_major = false;	/* true if this call returns TRF grids */
+
+int GMTMEX_Set_Grid_Layout (const char *layout) {
+	/* Select the layout of grid outputs for the current call; NULL goes back to the default */
+	if (layout == NULL || !strcmp (layout, "TCF"))
+		gmtmex_grid_row_major = false;
+	else if (!strcmp (layout, "TRF"))
+		gmtmex_grid_row_major = true;
+	else
+		return (GMT_NOTSET);
+	return (GMT_NOERROR);
+}
+
+static void *gmtmex_get_grid_stack (void *API, struct GMT_GRID **L, uint64_t n_layers) {
+	/* Given n_layers incoming GMT grids of the same size, build a MATLAB structure with the grids
+	 * as the layers of a 3-D z array (a plain matrix if n_layers == 1) and assign the output components.
+	 * The header information is taken from the first grid, except the z range which covers all layers.
  	 * Note: Incoming GMT grid has standard padding while MATLAB grid has none. */
 
 	unsigned int k;
-	uint64_t row, col, gmt_ij;
-	float  *f = NULL;
+	uint64_t row, col, gmt_ij, layer, nm, n_nan = 0;
+	mwSize dim[3];
+	float  *f = NULL, z;
+	double z_min = DBL_MAX, z_max = -DBL_MAX, sum = 0.0;
 	double *d = NULL, *G_x = NULL, *G_y = NULL, *x = NULL, *y = NULL;
+	struct GMT_GRID *G = L[0];
 	mxArray *G_struct = NULL, *mxptr[N_MEX_FIELDNAMES_GRID];
 
-	if (!G->data)	/* Safety valve */
-		mexErrMsgTxt ("gmtmex_get_grid: programming error, output matrix G is empty\n");
+	for (layer = 0; layer < n_layers; layer++) {
+		if (L[layer] == NULL || !L[layer]->data)	/* Safety valve */
+			mexErrMsgTxt ("gmtmex_get_grid: programming error, output matrix G is empty\n");
+		if (L[layer]->header->n_rows != G->header->n_rows || L[layer]->header->n_columns != G->header->n_columns)
+			mexErrMsgTxt ("gmtmex_get_grid: The layers of a grid stack must all have the same dimensions\n");
+	}
 
 	/* Create a MATLAB struct to hold this grid [matrix will be a float (mxSINGLE_CLASS)]. */
 	G_struct = mxCreateStructMatrix (1, 1, N_MEX_FIELDNAMES_GRID, GMTMEX_fieldname_grid);
 
 	/* Get pointers and populate structure from the information in G */
-	mxptr[0]  = mxCreateNumericMatrix (G->header->n_rows, G->header->n_columns, mxSINGLE_CLASS, mxREAL);
+	if (gmtmex_grid_row_major) {	/* Each MATLAB column holds a grid row */
+		dim[0] = G->header->n_columns;	dim[1] = G->header->n_rows;
+	}
+	else {
+		dim[0] = G->header->n_rows;	dim[1] = G->header->n_columns;
+	}
+	dim[2] = (mwSize)n_layers;
+	mxptr[0]  = mxCreateNumericArray ((n_layers > 1) ? 3 : 2, dim, mxSINGLE_CLASS, mxREAL);
 	mxptr[1]  = mxCreateNumericMatrix (1, G->header->n_columns, mxDOUBLE_CLASS, mxREAL);
 	mxptr[2]  = mxCreateNumericMatrix (1, G->header->n_rows,    mxDOUBLE_CLASS, mxREAL);
 	mxptr[3]  = mxCreateNumericMatrix (1, 6, mxDOUBLE_CLASS, mxREAL);
@@ -163,26 +406,47 @@ static void *gmtmex_get_grid (void *API, struct GMT_GRID *G) {
 	mxptr[11] = mxCreateString (G->header->x_units);
 	mxptr[12] = mxCreateString (G->header->y_units);
 	mxptr[13] = mxCreateString (G->header->z_units);
-	mxptr[14] = (G->header->mem_layout[0]) ? mxCreateString(G->header->mem_layout) : mxCreateString ("TCF");
+	mxptr[14] = mxCreateString ((gmtmex_grid_row_major) ? "TRF" : "TCF");	/* What we actually return, whatever GMT used */
 	mxptr[15] = mxCreateString (G->header->ProjRefPROJ4);
 	mxptr[16] = mxCreateString (G->header->ProjRefWKT);
 
-	d = mxGetPr (mxptr[3]);	/* Range */
-	for (k = 0; k < 4; k++) d[k] = G->header->wesn[k];
-	d[4] = G->header->z_min;	d[5] = G->header->z_max;
-
 	d = mxGetPr (mxptr[4]);	/* Increments */
 	for (k = 0; k < 2; k++) d[k] = G->header->inc[k];
 
-	/* Load the real grd array into a float MATLAB array by transposing
-           from padded GMT grd format to unpadded MATLAB format */
-	f = mxGetData (mxptr[0]);
-	for (row = 0; row < G->header->n_rows; row++) {
-		for (col = 0; col < G->header->n_columns; col++) {
-			gmt_ij = GMT_IJP (G->header, row, col);
-			f[MEXG_IJ(G,row,col)] = G->data[gmt_ij];
+	/* Load the real grd arrays into a float MATLAB array by transposing from padded GMT grd format
+	 * to unpadded MATLAB format, finding the z range and NaN count in the same pass since the
+	 * header values may not have been updated by the module */
+	nm = G->header->nm;
+	for (layer = 0; layer < n_layers; layer++) {
+		f = (float *)mxGetData (mxptr[0]) + layer * nm;
+		for (row = 0; row < G->header->n_rows; row++) {
+			gmt_ij = GMT_IJP (L[layer]->header, row, 0);
+			if (gmtmex_grid_row_major) {	/* Just strip the pad; the row is still in cache for the statistics */
+				memcpy (&f[row * G->header->n_columns], &L[layer]->data[gmt_ij], G->header->n_columns * sizeof (float));
+				gmt_ij = row * G->header->n_columns;	/* Now scan the MATLAB copy instead */
+			}
+			for (col = 0; col < G->header->n_columns; col++, gmt_ij++) {
+				if (gmtmex_grid_row_major)
+					z = f[gmt_ij];
+				else
+					f[MEXG_IJ(G,row,col)] = z = L[layer]->data[gmt_ij];
+				if (isnan (z)) {
+					n_nan++;
+					continue;
+				}
+				if (z < z_min) z_min = z;
+				if (z > z_max) z_max = z;
+				sum += z;
+			}
 		}
 	}
+	if (n_nan == nm * n_layers) z_min = z_max = NAN;	/* All NaN */
+	GMT_Report (API, GMT_MSG_DEBUG, "gmtmex_get_grid: z range %g/%g, mean %g, %" PRIu64 " NaN nodes\n",
+	            z_min, z_max, (n_nan < nm * n_layers) ? sum / (nm * n_layers - n_nan) : NAN, n_nan);
+
+	d = mxGetPr (mxptr[3]);	/* Range */
+	for (k = 0; k < 4; k++) d[k] = G->header->wesn[k];
+	d[4] = z_min;	d[5] = z_max;
 
 	/* Also return the convenient x and y arrays */
 	G_x = GMT_Get_Coord (API, GMT_IS_GRID, GMT_X, G);	/* Get array of x coordinates */
@@ -190,8 +454,12 @@ static void *gmtmex_get_grid (void *API, struct GMT_GRID *G) {
 	x = mxGetData (mxptr[1]);
 	y = mxGetData (mxptr[2]);
 	memcpy (x, G_x, G->header->n_columns * sizeof (double));
-	for (k = 0; k < G->header->n_rows; k++)
-		y[G->header->n_rows-1-k] = G_y[k];	/* Must reverse the y-array */
+	if (gmtmex_grid_row_major)	/* y is in the same order as the rows, north to south */
+		memcpy (y, G_y, G->header->n_rows * sizeof (double));
+	else {
+		for (k = 0; k < G->header->n_rows; k++)
+			y[G->header->n_rows-1-k] = G_y[k];	/* Must reverse the y-array */
+	}
 	if (GMT_Destroy_Data (API, &G_x))
 		mexPrintf("Warning: Failure to delete G_x (x coordinate vector)\n");
 	if (GMT_Destroy_Data (API, &G_y))
@@ -201,6 +469,28 @@ static void *gmtmex_get_grid (void *API, struct GMT_GRID *G) {
 	return (G_struct);
 }
 
+static void *gmtmex_get_grid (void *API, struct GMT_GRID *G) {
+	/* Given an incoming GMT grid G, build a MATLAB structure and assign the output components */
+	return (gmtmex_get_grid_stack (API, &G, 1));
+}
+
+/* Segment data class: dataset structures normally return their segment data as double.  gmt ('segments',
+ * 'single', ...) returns it as single instead, which halves the memory of large point clouds and tracks.
+ * On input, segment data may be double, single or any integer class. */
+
+static GMTMEX_TLS bool gmtmex_segment_single = false;	/* true if this call returns single segment data */
+
+int GMTMEX_Set_Segment_Class (const char *type) {
+	/* Select the class of dataset segment data for the current call; NULL goes back to double */
+	if (type == NULL || !strcmp (type, "double"))
+		gmtmex_segment_single = false;
+	else if (!strcmp (type, "single"))
+		gmtmex_segment_single = true;
+	else
+		return (GMT_NOTSET);
+	return (GMT_NOERROR);
+}
+
 static void *gmtmex_get_dataset (void *API, struct GMT_DATASET *D) {
 	/* Given a GMT DATASET D, build a MATLAB array of segment structure and assign values.
 	 * Each segment will have 6 items:
@@ -215,6 +505,7 @@ static void *gmtmex_get_dataset (void *API, struct GMT_DATASET *D) {
 	int n_headers;
 	uint64_t tbl, seg, seg_out, col, row, start, k, n_items = 1;
 	double *data = NULL;
+	float *fdata = NULL;
 	struct GMT_DATASEGMENT *S = NULL;
 	mxArray *D_struct = NULL, *mxheader = NULL, *mxdata = NULL, *mxtext = NULL, *mxstring = NULL;
 
@@ -237,30 +528,40 @@ static void *gmtmex_get_dataset (void *API, struct GMT_DATASET *D) {
 			if (S->n_rows == 0) continue;		/* Skip empty segments */
 			if (S->header) {	/* Has segment header */
 				mxheader = mxCreateString (S->header);
-				mxSetField (D_struct, (mwSize)seg_out, "header", mxheader);
+				mxSetField (D_struct, (mwIndex)seg_out, "header", mxheader);
 			}
 			if (S->text) {	/* Has trailing text */
 				mxtext   = mxCreateCellMatrix (S->n_rows, 1);
 				for (row = 0; row < S->n_rows; row++) {
 					mxstring = mxCreateString (S->text[row]);
-					mxSetCell (mxtext, (int)row, mxstring);
+					mxSetCell (mxtext, (mwIndex)row, mxstring);
 				}
-				mxSetField (D_struct, (mwSize)seg_out, "text", mxtext);
+				mxSetField (D_struct, (mwIndex)seg_out, "text", mxtext);
 			}
 			if (S->n_columns) {	/* Has numerical data */
-				mxdata   = mxCreateNumericMatrix ((mwSize)S->n_rows, (mwSize)S->n_columns, mxDOUBLE_CLASS, mxREAL);
-				data      = mxGetPr (mxdata);
-				for (col = start = 0; col < S->n_columns; col++, start += S->n_rows) /* Copy the data columns */
-					memcpy (&data[start], S->data[col], S->n_rows * sizeof (double));
-				mxSetField (D_struct, (mwSize)seg_out, "data", mxdata);
+				if (gmtmex_segment_single) {	/* Narrow the data columns to single precision */
+					mxdata = mxCreateNumericMatrix ((mwSize)S->n_rows, (mwSize)S->n_columns, mxSINGLE_CLASS, mxREAL);
+					fdata  = (float *)mxGetData (mxdata);
+					for (col = start = 0; col < S->n_columns; col++, start += S->n_rows) {
+						const double *in = S->data[col];
+						for (row = 0; row < S->n_rows; row++) fdata[start+row] = (float)in[row];
+					}
+				}
+				else {
+					mxdata   = mxCreateNumericMatrix ((mwSize)S->n_rows, (mwSize)S->n_columns, mxDOUBLE_CLASS, mxREAL);
+					data      = mxGetPr (mxdata);
+					for (col = start = 0; col < S->n_columns; col++, start += S->n_rows) /* Copy the data columns */
+						memcpy (&data[start], S->data[col], S->n_rows * sizeof (double));
+				}
+				mxSetField (D_struct, (mwIndex)seg_out, "data", mxdata);
 			}
 			if (n_headers) {	/* First segment will get any headers, the rest nothing */
 				mxtext = mxCreateCellMatrix (n_headers, n_headers ? 1 : 0);
 				for (k = 0; k < n_headers; k++) {
 					mxstring = mxCreateString (D->table[0]->header[k]);
-					mxSetCell (mxtext, (int)k, mxstring);
+					mxSetCell (mxtext, (mwIndex)k, mxstring);
 				}
-				mxSetField (D_struct, (mwSize)seg_out, "comment", mxtext);
+				mxSetField (D_struct, (mwIndex)seg_out, "comment", mxtext);
 				n_headers = 0;	/* No other segment will have a non-empty comment cell array */
 			}
 			seg_out++;
@@ -269,6 +570,86 @@ static void *gmtmex_get_dataset (void *API, struct GMT_DATASET *D) {
 	return (D_struct);
 }
 
+/* Typed matrix output: gmt ('matrix', type, ...) asks GMT to return dataset outputs as a GMT_MATRIX of
+ * the given type, which we pass back to MATLAB as a bare numeric matrix instead of a dataset structure. */
+
+struct GMTMEX_MATRIX_TYPE {
+	const char *name;       /* MATLAB class name */
+	const char *export;     /* Value of GMT_EXPORT_TYPE for this class */
+	int type;               /* GMT data type */
+	mxClassID class_id;     /* MATLAB class */
+};
+
+static struct GMTMEX_MATRIX_TYPE GMTMEX_matrix_type[] = {
+	{"double", "double", GMT_DOUBLE, mxDOUBLE_CLASS},
+	{"single", "single", GMT_FLOAT,  mxSINGLE_CLASS},
+	{"int64",  "long",   GMT_LONG,   mxINT64_CLASS},
+	{"uint64", "ulong",  GMT_ULONG,  mxUINT64_CLASS},
+	{"int32",  "int",    GMT_INT,    mxINT32_CLASS},
+	{"uint32", "uint",   GMT_UINT,   mxUINT32_CLASS},
+	{"int16",  "short",  GMT_SHORT,  mxINT16_CLASS},
+	{"uint16", "ushort", GMT_USHORT, mxUINT16_CLASS},
+	{"int8",   "char",   GMT_CHAR,   mxINT8_CLASS},
+	{"uint8",  "uchar",  GMT_UCHAR,  mxUINT8_CLASS},
+	{NULL,     NULL,     GMT_NOTSET, mxUNKNOWN_CLASS}
+};
+
+static GMTMEX_TLS int gmtmex_matrix_output = GMT_NOTSET;	/* Entry in GMTMEX_matrix_type for this call, or GMT_NOTSET for dataset structures */
+static GMTMEX_TLS char gmtmex_export_type[GMT_LEN64];	/* GMT_EXPORT_TYPE before this call changed it */
+
+int GMTMEX_Set_Matrix_Output (void *API, const char *type) {
+	/* Select the class of dataset outputs for the current call; NULL goes back to dataset structures
+	 * and puts back the GMT_EXPORT_TYPE that was in effect before, which may have been set with gmtset */
+	int k;
+	if (type == NULL) {
+		if (gmtmex_matrix_output != GMT_NOTSET) GMT_Set_Default (API, "GMT_EXPORT_TYPE", gmtmex_export_type);
+		gmtmex_matrix_output = GMT_NOTSET;
+		return (GMT_NOERROR);
+	}
+	for (k = 0; GMTMEX_matrix_type[k].name && strcmp (GMTMEX_matrix_type[k].name, type); k++);
+	if (GMTMEX_matrix_type[k].name == NULL) return (GMT_NOTSET);
+	if (gmtmex_matrix_output == GMT_NOTSET && GMT_Get_Default (API, "GMT_EXPORT_TYPE", gmtmex_export_type))
+		return (GMT_NOTSET);
+	if (GMT_Set_Default (API, "GMT_EXPORT_TYPE", GMTMEX_matrix_type[k].export)) return (GMT_NOTSET);
+	gmtmex_matrix_output = k;
+	return (GMT_NOERROR);
+}
+
+static void *gmtmex_get_matrix (void *API, struct GMT_MATRIX *M) {
+	/* Given a GMT_MATRIX M holding a dataset output, return it as a bare MATLAB matrix of the same type.
+	 * GMT writes column-major matrices in this session, so normally the whole block is a single memcpy. */
+	int k;
+	uint64_t row, col;
+	size_t size;
+	char *in = NULL, *out = NULL;
+	mxArray *P = NULL;
+
+	if (M == NULL)	/* No output produced - return an empty matrix of the requested class */
+		return (mxCreateNumericMatrix (0, 0, GMTMEX_matrix_type[gmtmex_matrix_output].class_id, mxREAL));
+	for (k = 0; GMTMEX_matrix_type[k].name && GMTMEX_matrix_type[k].type != (int)M->type; k++);
+	if (GMTMEX_matrix_type[k].name == NULL)
+		mexErrMsgTxt ("gmtmex_get_matrix: Unsupported data type in GMT matrix output\n");
+	P = mxCreateNumericMatrix ((mwSize)M->n_rows, (mwSize)M->n_columns, GMTMEX_matrix_type[k].class_id, mxREAL);
+	if (M->n_rows == 0 || M->n_columns == 0) return (P);
+	size = mxGetElementSize (P);
+	in = (char *)M->data.f8;	out = mxGetData (P);
+	if (M->shape == GMT_IS_COL_FORMAT) {	/* Columns are contiguous, but may be padded to M->dim rows */
+		if (M->dim == M->n_rows)
+			memcpy (out, in, M->n_rows * M->n_columns * size);
+		else
+			for (col = 0; col < M->n_columns; col++)
+				memcpy (&out[col * M->n_rows * size], &in[col * M->dim * size], M->n_rows * size);
+	}
+	else {	/* Row-major matrix; transpose item by item */
+		for (row = 0; row < M->n_rows; row++)
+			for (col = 0; col < M->n_columns; col++)
+				memcpy (&out[(col * M->n_rows + row) * size], &in[(row * M->dim + col) * size], size);
+	}
+	GMT_Report (API, GMT_MSG_DEBUG, "gmtmex_get_matrix: Returned %" PRIu64 " x %" PRIu64 " %s matrix\n",
+	            M->n_rows, M->n_columns, GMTMEX_matrix_type[k].name);
+	return (P);
+}
+
 static void *gmtmex_get_postscript (void *API, struct GMT_POSTSCRIPT *P) {
 	/* Given a GMT GMT_POSTSCRIPT P, build a MATLAB array of segment structure and assign values.
 	 * Each segment will have 4 items:
@@ -305,7 +686,7 @@ static void *gmtmex_get_postscript (void *API, struct GMT_POSTSCRIPT *P) {
 	
 	for (k = 0; k < P->n_headers; k++) {
 		mxstring = mxCreateString (P->header[k]);
-		mxSetCell (mxptr[3], (int)k, mxstring);
+		mxSetCell (mxptr[3], (mwIndex)k, mxstring);
 	}
 	
 	for (k = 0; k < N_MEX_FIELDNAMES_PS; k++)
@@ -394,7 +775,7 @@ static void *gmtmex_get_palette (void *API, struct GMT_PALETTE *C) {
 	if (C->n_headers) {
 		for (k = 0; k < C->n_headers; k++) {
 			mxstring = mxCreateString (C->header[k]);
-			mxSetCell (mxptr[10], (int)k, mxstring);
+			mxSetCell (mxptr[10], (mwIndex)k, mxstring);
 		}
 	}
 	if (C->model & GMT_HSV)
@@ -409,9 +790,33 @@ static void *gmtmex_get_palette (void *API, struct GMT_PALETTE *C) {
 	return (C_struct);
 }
 
+static int gmtmex_image_type (int type) {
+	/* Return the GMTMEX_matrix_type entry for the data type of an image, which is uint8 unless set otherwise */
+	int k;
+	for (k = 0; GMTMEX_matrix_type[k].name && GMTMEX_matrix_type[k].type != type; k++);
+	if (GMTMEX_matrix_type[k].name == NULL)
+		for (k = 0; GMTMEX_matrix_type[k].type != GMT_UCHAR; k++);
+	return (k);
+}
+
+static void gmtmex_pixel_to_band (char *out, const char *in, uint64_t n_rows, uint64_t n_columns, uint64_t n_bands, size_t size) {
+	/* Reorder a row-major, pixel-interleaved (TRP) image with size-byte values into column-major bands (TCB) */
+	uint64_t row, col, band, ij, pix, nm = n_rows * n_columns;
+	for (row = 0; row < n_rows; row++) {
+		for (col = 0; col < n_columns; col++) {
+			ij = col * n_rows + row;	pix = (row * n_columns + col) * n_bands;
+			for (band = 0; band < n_bands; band++)
+				memcpy (&out[(band * nm + ij) * size], &in[(pix + band) * size], size);
+		}
+	}
+}
+
 static void *gmtmex_get_image (void *API, struct GMT_IMAGE *I) {
-	unsigned int k;
+	int type;
+	uint64_t k, n_bands;
+	size_t size;
 	mwSize   dim[3];
+	mxClassID class_id;
 	uint8_t *u = NULL, *alpha = NULL;
 	double  *d = NULL, *I_x = NULL, *I_y = NULL, *x = NULL, *y = NULL, *color = NULL;
 	mxArray *I_struct = NULL, *mxptr[N_MEX_FIELDNAMES_IMAGE];
@@ -419,7 +824,9 @@ static void *gmtmex_get_image (void *API, struct GMT_IMAGE *I) {
 	if (I == NULL || !I->data)	/* Safety valve */
 		mexErrMsgTxt ("gmtmex_get_image: programming error, output image I is empty\n");
 
-	/* Return image via a uint8_t (mxUINT8_CLASS) matrix in a struct */
+	/* Return image via a matrix of its own type (normally uint8, but also uint16, int16, single, ...) in a struct */
+	type = gmtmex_image_type (I->type);
+	class_id = GMTMEX_matrix_type[type].class_id;
 	/* Create a MATLAB struct for this image */
 	I_struct = mxCreateStructMatrix (1, 1, N_MEX_FIELDNAMES_IMAGE, GMTMEX_fieldname_image);
 	/* Create the various fields with information from I */
@@ -433,7 +840,7 @@ static void *gmtmex_get_image (void *API, struct GMT_IMAGE *I) {
 	mxptr[7]  = mxCreateString (I->header->title);
 	mxptr[8]  = mxCreateString (I->header->remark);
 	mxptr[9]  = mxCreateString (I->header->command);
-	mxptr[10] = mxCreateString ("uint8");
+	mxptr[10] = mxCreateString (GMTMEX_matrix_type[type].name);
 	mxptr[11] = mxCreateString (I->header->x_units);
 	mxptr[12] = mxCreateString (I->header->y_units);
 	mxptr[13] = mxCreateString (I->header->z_units);
@@ -455,36 +862,12 @@ static void *gmtmex_get_image (void *API, struct GMT_IMAGE *I) {
 		mxptr[0]  = mxCreateNumericMatrix (I->header->n_rows, I->header->n_columns, mxUINT8_CLASS, mxREAL);
 		u     = mxGetData (mxptr[0]);
 		color = mxGetPr (mxptr[14]);
-		for (k = 0; k < 4 * (unsigned int)I->n_indexed_colors && I->colormap[k] >= 0; k++)
+		for (k = 0; k < 4 * (uint64_t)I->n_indexed_colors && I->colormap[k] >= 0; k++)
 			color[k] = (uint8_t)I->colormap[k];
 		k /= 4;
 		memcpy (u, I->data, I->header->nm * sizeof (uint8_t));
 	}	
-	else if (I->header->n_bands == 1) {	/* gray image */
-		mxptr[0] = mxCreateNumericMatrix (I->header->n_rows, I->header->n_columns, mxUINT8_CLASS, mxREAL);
-		u = mxGetData (mxptr[0]);
-		memcpy (u, I->data, I->header->nm * sizeof (uint8_t));
-	}
-	else if (I->header->n_bands == 3) {	/* RGB image */
-		dim[0] = I->header->n_rows;	dim[1] = I->header->n_columns; dim[2] = 3;
-		mxptr[0] = mxCreateNumericArray (3, dim, mxUINT8_CLASS, mxREAL);
-		u = mxGetData (mxptr[0]);
-		if (!strncmp(I->header->mem_layout, "TCBa", 4))
-			memcpy (u, I->data, 3 * I->header->nm * sizeof (uint8_t));
-		else if (!strncmp(I->header->mem_layout, "TRPa", 4)) {
-			GMT_Change_Layout (API, GMT_IS_IMAGE, "TCB", 0, I, u, alpha);		/* Convert from TRP to TCB */
-			mxptr[16] = mxCreateString ("TCBa");	/* Because we just converted to it above */
-		}
-		else {
-			mexPrintf("WarnError: this image's' memory layout, %s, is not implemented. Expect random art.\n");
-		}
-		if (I->alpha) {
-			mxptr[15] = mxCreateNumericMatrix (I->header->n_rows, I->header->n_columns, mxUINT8_CLASS, mxREAL);
-			alpha = mxGetData (mxptr[15]);
-			memcpy (alpha, I->alpha, I->header->nm * sizeof (uint8_t)); 
-		}
-	}
-	else if (I->header->n_bands == 4) {	/* RGBA image, with a color map */
+	else if (I->header->n_bands == 4 && class_id == mxUINT8_CLASS) {	/* RGBA image, with a color map */
 		dim[0] = I->header->n_rows;	dim[1] = I->header->n_columns; dim[2] = 3;
 		mxptr[0] = mxCreateNumericArray (3, dim, mxUINT8_CLASS, mxREAL);
 		u = mxGetData (mxptr[0]);
@@ -500,6 +883,30 @@ static void *gmtmex_get_image (void *API, struct GMT_IMAGE *I) {
 		}
 		*/
 	}
+	else {	/* Gray, RGB or (if not uint8) multi-band image */
+		n_bands = I->header->n_bands;
+		dim[0] = I->header->n_rows;	dim[1] = I->header->n_columns; dim[2] = (mwSize)n_bands;
+		mxptr[0] = mxCreateNumericArray ((n_bands == 1) ? 2 : 3, dim, class_id, mxREAL);
+		u = mxGetData (mxptr[0]);
+		size = mxGetElementSize (mxptr[0]);
+		if (n_bands == 1 || !strncmp(I->header->mem_layout, "TCB", 3))
+			memcpy (u, I->data, n_bands * I->header->nm * size);
+		else if (!strncmp(I->header->mem_layout, "TRP", 3)) {
+			if (class_id == mxUINT8_CLASS)
+				GMT_Change_Layout (API, GMT_IS_IMAGE, "TCB", 0, I, u, alpha);		/* Convert from TRP to TCB */
+			else	/* Typed images we reorder ourselves */
+				gmtmex_pixel_to_band ((char *)u, (char *)I->data, I->header->n_rows, I->header->n_columns, n_bands, size);
+			mxptr[16] = mxCreateString ("TCBa");	/* Because we just converted to it above */
+		}
+		else {
+			mexPrintf("WarnError: this image's' memory layout, %s, is not implemented. Expect random art.\n", I->header->mem_layout);
+		}
+		if (I->alpha) {
+			mxptr[15] = mxCreateNumericMatrix (I->header->n_rows, I->header->n_columns, mxUINT8_CLASS, mxREAL);
+			alpha = mxGetData (mxptr[15]);
+			memcpy (alpha, I->alpha, I->header->nm * sizeof (uint8_t)); 
+		}
+	}
 
 	/* Also return the convenient x and y arrays */
 	I_x = GMT_Get_Coord (API, GMT_IS_IMAGE, GMT_X, I);	/* Get array of x coordinates */
@@ -519,16 +926,118 @@ static void *gmtmex_get_image (void *API, struct GMT_IMAGE *I) {
 	return (I_struct);
 }
 
+static double gmtmex_get_value (const mxArray *p, uint64_t k) {
+	/* Return the k'th element of the numeric array p as a double, whatever its class */
+	void *data = mxGetData (p);
+	switch (mxGetClassID (p)) {
+		case mxDOUBLE_CLASS: return (((double   *)data)[k]);
+		case mxSINGLE_CLASS: return ((double)((float    *)data)[k]);
+		case mxUINT64_CLASS: return ((double)((uint64_t *)data)[k]);
+		case mxINT64_CLASS:  return ((double)((int64_t  *)data)[k]);
+		case mxUINT32_CLASS: return ((double)((uint32_t *)data)[k]);
+		case mxINT32_CLASS:  return ((double)((int32_t  *)data)[k]);
+		case mxUINT16_CLASS: return ((double)((uint16_t *)data)[k]);
+		case mxINT16_CLASS:  return ((double)((int16_t  *)data)[k]);
+		case mxUINT8_CLASS:  return ((double)((uint8_t  *)data)[k]);
+		case mxINT8_CLASS:   return ((double)((int8_t   *)data)[k]);
+		default:
+			mexErrMsgTxt ("gmtmex_get_value: Unsupported MATLAB data type.\n");
+			break;
+	}
+	return (0.0);
+}
+
+#define gmtmex_widen(type) { const type *in = (const type *)data + start; for (k = 0; k < n; k++) out[k] = (double)in[k]; }
+
+static void gmtmex_copy_column (double *out, const mxArray *p, uint64_t start, uint64_t n) {
+	/* Copy n elements of the numeric array p, starting at element start, to out as doubles.  We switch on
+	 * the class once so each case is a plain loop the compiler can vectorize */
+	uint64_t k;
+	void *data = mxGetData (p);
+	switch (mxGetClassID (p)) {
+		case mxDOUBLE_CLASS: memcpy (out, (double *)data + start, n * sizeof (double)); break;
+		case mxSINGLE_CLASS: gmtmex_widen (float);    break;
+		case mxUINT64_CLASS: gmtmex_widen (uint64_t); break;
+		case mxINT64_CLASS:  gmtmex_widen (int64_t);  break;
+		case mxUINT32_CLASS: gmtmex_widen (uint32_t); break;
+		case mxINT32_CLASS:  gmtmex_widen (int32_t);  break;
+		case mxUINT16_CLASS: gmtmex_widen (uint16_t); break;
+		case mxINT16_CLASS:  gmtmex_widen (int16_t);  break;
+		case mxUINT8_CLASS:  gmtmex_widen (uint8_t);  break;
+		case mxINT8_CLASS:   gmtmex_widen (int8_t);   break;
+		default:
+			mexErrMsgTxt ("gmtmex_copy_column: Unsupported MATLAB data type.\n");
+			break;
+	}
+}
+
+#undef gmtmex_widen
+
+static double gmtmex_get_nodata (const mxArray *ptr) {
+	/* Return the no-data sentinel in the nodata field of the MEX structure ptr, or NaN if there is none */
+	mxArray *mx_ptr = mxGetField (ptr, 0, "nodata");
+	if (mx_ptr == NULL || mxIsEmpty (mx_ptr) || !mxIsNumeric (mx_ptr)) return (mxGetNaN ());
+	return (gmtmex_get_value (mx_ptr, 0));
+}
+
+void GMTMEX_Copy_Grid_In (struct GMT_GRID *G, const void *data, bool is_single, bool row_major, double sentinel, struct GMTMEX_ZSTATS *Z) {
+	/* Copy an unpadded MATLAB array into the padded GMT grid G in a single pass.  On the way, nodes equal to
+	 * the no-data sentinel (unless it is NaN) become NaN and we gather the z statistics, which also go into
+	 * the header instead of the possibly stale range(5:6).  If row_major the array is in TRF layout (each
+	 * column is a grid row, top row first), otherwise in the default MATLAB layout.  Plain C only, so grid
+	 * stack workers can use it. */
+	bool remap = !isnan (sentinel);
+	uint64_t row, col, gmt_ij, k, n_nan = 0;
+	float sentinel_f = (float)sentinel;
+	double z, z_min = DBL_MAX, z_max = -DBL_MAX, sum = 0.0;
+	const float *f4 = data;
+	const double *f8 = data;
+
+	for (row = 0; row < G->header->n_rows; row++) {
+		gmt_ij = GMT_IJP (G->header, row, 0);
+		for (col = 0; col < G->header->n_columns; col++, gmt_ij++) {
+			k = (row_major) ? row * G->header->n_columns + col : MEXG_IJ(G,row,col);
+			if (is_single) {
+				z = f4[k];
+				if (remap && f4[k] == sentinel_f) z = NAN;
+			}
+			else {
+				z = f8[k];
+				if (remap && z == sentinel) z = NAN;
+			}
+			G->data[gmt_ij] = (gmt_grdfloat)z;
+			if (isnan (z)) {
+				n_nan++;
+				continue;
+			}
+			if (z < z_min) z_min = z;
+			if (z > z_max) z_max = z;
+			sum += z;
+		}
+	}
+	if (n_nan == G->header->nm)	/* All NaN */
+		z_min = z_max = NAN;
+	G->header->z_min = z_min;	G->header->z_max = z_max;
+	G->header->nan_value = (gmt_grdfloat)sentinel;
+	if (Z) {
+		Z->z_min = z_min;	Z->z_max = z_max;	Z->n_nan = n_nan;
+		Z->mean = (n_nan < G->header->nm) ? sum / (G->header->nm - n_nan) : NAN;
+	}
+}
+
+static struct GMT_GRID *gmtmex_new_grid (void *API, unsigned int flag, double *range, double *inc, unsigned int registration, int pad);
+
 static struct GMT_GRID *gmtmex_grid_init (void *API, unsigned int direction, unsigned int module_input, const mxArray *ptr) {
 	/* Used to Create an empty Grid container to hold a GMT grid.
  	 * If direction is GMT_IN then we are given a MATLAB grid and can determine its size, etc.
 	 * If direction is GMT_OUT then we allocate an empty GMT grid as a destination. */
-	unsigned int row, col;
-	uint64_t gmt_ij;
 	struct GMT_GRID *G = NULL;
 
 	if (direction == GMT_IN) {	/* Dimensions are known from the input pointer */
 		unsigned int registration, flag = (module_input) ? GMT_VIA_MODULE_INPUT : 0;
+		bool row_major = false;		/* true if the MATLAB array is in TRF layout */
+		double sentinel = mxGetNaN ();	/* No-data value to replace by NaN */
+		struct GMTMEX_ZSTATS Z;
 		mxArray *mx_ptr = NULL, *mxGrid = NULL, *mxHdr = NULL;
 
 		if (mxIsEmpty (ptr))
@@ -556,7 +1065,7 @@ static struct GMT_GRID *gmtmex_grid_init (void *API, unsigned int direction, uns
 			double *inc = NULL, *range = NULL, *reg = NULL;
 			unsigned int pad = (unsigned int)GMT_NOTSET;
 			char x_unit[GMT_GRID_VARNAME_LEN80] = { "" }, y_unit[GMT_GRID_VARNAME_LEN80] = { "" },
-			     z_unit[GMT_GRID_VARNAME_LEN80] = { "" }, layout[3];
+			     z_unit[GMT_GRID_VARNAME_LEN80] = { "" }, layout[4] = { "" };
 			mx_ptr = mxGetField (ptr, 0, "inc");
 			if (mx_ptr == NULL)
 				mexErrMsgTxt ("gmtmex_grid_init: Could not find inc array with Grid increments\n");
@@ -588,18 +1097,12 @@ static struct GMT_GRID *gmtmex_grid_init (void *API, unsigned int direction, uns
 					mexPrintf("gmtmex_grid_init:  This pad value (%d) is very probably wrong.\n");
 			}
 
-			if ((G = GMT_Create_Data (API, GMT_IS_GRID|flag, GMT_IS_SURFACE, GMT_GRID_ALL,
-			                          NULL, range, inc, registration, pad, NULL)) == NULL)
+			if ((G = gmtmex_new_grid (API, flag, range, inc, registration, (int)pad)) == NULL)
 				mexErrMsgTxt ("gmtmex_grid_init: Failure to alloc GMT source matrix for input\n");
-
-			G->header->z_min = range[4];
-			G->header->z_max = range[5];
+			gmtmex_track (API, G);
 
 			G->header->registration = registration;
-
-			mx_ptr = mxGetField (ptr, 0, "nodata");
-			if (mx_ptr != NULL)
-				G->header->nan_value = *(float *)mxGetData (mx_ptr);
+			sentinel = gmtmex_get_nodata (ptr);	/* The z range is found while copying the grid below */
 
 			mx_ptr = mxGetField (ptr, 0, "proj4");
 			if (mx_ptr != NULL && mxGetN(mx_ptr) > 6) {		/* A true proj4 string will have at least this lenght */
@@ -653,8 +1156,9 @@ static struct GMT_GRID *gmtmex_grid_init (void *API, unsigned int direction, uns
 			}
 			mx_ptr = mxGetField (ptr, 0, "layout");
 			if (mx_ptr != NULL) {
-				mxGetString(mx_ptr, layout, (mwSize)mxGetN(mx_ptr) + 1);
+				mxGetString(mx_ptr, layout, 4);
 				strncpy(G->header->mem_layout, layout, 3);
+				row_major = !strcmp (layout, "TRF");
 			}
 			else
 				strncpy(G->header->mem_layout, "TRS", 3);
@@ -662,35 +1166,19 @@ static struct GMT_GRID *gmtmex_grid_init (void *API, unsigned int direction, uns
 		else {	/* Passed header and grid separately */
 			double *h = mxGetData(mxHdr);
 			registration = (unsigned int)lrint(h[6]);
-			if ((G = GMT_Create_Data (API, GMT_IS_GRID|flag, GMT_IS_SURFACE, GMT_GRID_ALL,
-			                          NULL, h, &h[7], registration, GMT_NOTSET, NULL)) == NULL)
+			if ((G = gmtmex_new_grid (API, flag, h, &h[7], registration, GMT_NOTSET)) == NULL)
 				mexErrMsgTxt ("gmtmex_grid_init: Failure to alloc GMT source matrix for input\n");
-			G->header->z_min = h[4];
-			G->header->z_max = h[5];
-		}
-
-		if (mxIsSingle(mxGrid)) {
-			float *f4 = mxGetData(mxGrid);
-			if (f4 == NULL)
-				mexErrMsgTxt("gmtmex_grid_init: Grid pointer is NULL where it absolutely could not be.");
-			for (row = 0; row < G->header->n_rows; row++) {
-				for (col = 0; col < G->header->n_columns; col++) {
-					gmt_ij = GMT_IJP (G->header, row, col);
-					G->data[gmt_ij] = f4[MEXG_IJ(G,row,col)];
-				}
-			}
-		}
-		else {
-			double *f8 = mxGetData(mxGrid);
-			if (f8 == NULL)
-				mexErrMsgTxt("gmtmex_grid_init: Grid pointer is NULL where it absolutely could not be.");
-			for (row = 0; row < G->header->n_rows; row++) {
-				for (col = 0; col < G->header->n_columns; col++) {
-					gmt_ij = GMT_IJP (G->header, row, col);
-					G->data[gmt_ij] = (float)f8[MEXG_IJ(G,row,col)];
-				}
-			}
+			gmtmex_track (API, G);
 		}
+
+		if (mxGetData (mxGrid) == NULL)
+			mexErrMsgTxt("gmtmex_grid_init: Grid pointer is NULL where it absolutely could not be.");
+		if (mxGetDimensions (mxGrid)[0] != ((row_major) ? G->header->n_columns : G->header->n_rows) ||
+		    mxGetDimensions (mxGrid)[1] != ((row_major) ? G->header->n_rows : G->header->n_columns))
+			mexErrMsgTxt("gmtmex_grid_init: Size of the grid array does not agree with its range, increments and layout.\n");
+		GMTMEX_Copy_Grid_In (G, mxGetData (mxGrid), mxIsSingle (mxGrid), row_major, sentinel, &Z);
+		GMT_Report (API, GMT_MSG_DEBUG, "gmtmex_grid_init: z range %g/%g, mean %g, %" PRIu64 " NaN nodes\n",
+		            Z.z_min, Z.z_max, Z.mean, Z.n_nan);
 		GMT_Report (API, GMT_MSG_DEBUG, "gmtmex_grid_init: Allocated GMT Grid %lx\n", (long)G);
 		GMT_Report (API, GMT_MSG_DEBUG,
 		            "gmtmex_grid_init: Registered GMT Grid array %lx via memory reference from MATLAB\n",
@@ -700,6 +1188,7 @@ static struct GMT_GRID *gmtmex_grid_init (void *API, unsigned int direction, uns
 		if ((G = GMT_Create_Data (API, GMT_IS_GRID, GMT_IS_SURFACE, GMT_IS_OUTPUT,
 		                          NULL, NULL, NULL, 0, 0, NULL)) == NULL)
 			mexErrMsgTxt ("gmtmex_grid_init: Failure to alloc GMT blank grid container for holding output grid\n");
+		gmtmex_track (API, G);
 	}
 	return (G);
 }
@@ -711,6 +1200,7 @@ static struct GMT_IMAGE *gmtmex_image_init (void *API, unsigned int direction, u
 	struct GMT_IMAGE *I = NULL;
 	if (direction == GMT_IN) {	/* Dimensions are known from the input pointer */
 		uint64_t dim[3];
+		int type = GMT_UCHAR;
 		unsigned int flag = (module_input) ? GMT_VIA_MODULE_INPUT : 0, pad = 0;
 		char x_unit[GMT_GRID_VARNAME_LEN80] = { "" }, y_unit[GMT_GRID_VARNAME_LEN80] = { "" },
 		     z_unit[GMT_GRID_VARNAME_LEN80] = { "" }, layout[4];
@@ -750,14 +1240,23 @@ static struct GMT_IMAGE *gmtmex_image_init (void *API, unsigned int direction, u
 		if (mx_ptr == NULL)
 			mexErrMsgTxt ("gmtmex_image_init: Could not find data array for Image\n");
 
-		if (!mxIsUint8(mx_ptr))
-			mexErrMsgTxt("gmtmex_image_init: The only data type supported by now is UInt8, and this image is not.\n");
+		switch (mxGetClassID (mx_ptr)) {	/* Passed by reference, so GMT must know the type */
+			case mxUINT8_CLASS:  type = GMT_UCHAR;  break;
+			case mxUINT16_CLASS: type = GMT_USHORT; break;
+			case mxINT16_CLASS:  type = GMT_SHORT;  break;
+			case mxSINGLE_CLASS: type = GMT_FLOAT;  break;
+			default:
+				mexErrMsgTxt("gmtmex_image_init: Image data must be uint8, uint16, int16 or single.\n");
+				break;
+		}
 
 		dim[0] = gmtmex_getMNK (mx_ptr, 1);	dim[1] = gmtmex_getMNK (mx_ptr, 0);	dim[2] = gmtmex_getMNK (mx_ptr, 2);
 		if ((I = GMT_Create_Data (API, GMT_IS_IMAGE|flag, GMT_IS_SURFACE, GMT_GRID_HEADER_ONLY, dim,
 			                      range, inc, (unsigned int)reg[0], pad, NULL)) == NULL)
 			mexErrMsgTxt ("gmtmex_image_init: Failure to alloc GMT source image for input\n");
+		gmtmex_track (API, I);
 
+		I->type = type;
 		I->data = (unsigned char *)mxGetData (mx_ptr);				/* Send in the Matlab owned memory. */
 		GMT_Set_AllocMode (API, GMT_IS_IMAGE, I);
 		//I->alloc_mode = GMT_ALLOC_EXTERNALLY;
@@ -791,9 +1290,7 @@ static struct GMT_IMAGE *gmtmex_image_init (void *API, unsigned int direction, u
 			mexErrMsgTxt("gmtmex_image_init: Could not find y-coords vector for Image\n");
 		I->y = mxGetData(mx_ptr);
 
-		mx_ptr = mxGetField (ptr, 0, "nodata");
-		if (mx_ptr != NULL)
-			I->header->nan_value = *(float *)mxGetData (mx_ptr);
+		I->header->nan_value = (gmt_grdfloat)gmtmex_get_nodata (ptr);
 
 		mx_ptr = mxGetField (ptr, 0, "proj4");
 		if (mx_ptr != NULL && mxGetN(mx_ptr) > 6) {		/* A true proj4 string will have at least this length */
@@ -868,12 +1365,174 @@ static struct GMT_IMAGE *gmtmex_image_init (void *API, unsigned int direction, u
 	else {	/* Just allocate an empty container to hold an output image (signal this by passing 0s and NULLs [mode == GMT_IS_OUTPUT from 5.4]) */
 		if ((I = GMT_Create_Data (API, GMT_IS_IMAGE, GMT_IS_SURFACE, GMT_IS_OUTPUT, NULL, NULL, NULL, 0, 0, NULL)) == NULL)
 			mexErrMsgTxt ("gmtmex_image_init: Failure to alloc GMT blank image container for holding output image\n");
+		gmtmex_track (API, I);
 
 		GMT_Set_Default (API, "API_IMAGE_LAYOUT", "TCBa");	/* State how we wish to receive images from GDAL */
 	}
 	return (I);
 }
 
+static int gmtmex_gmt_type (mxClassID type) {
+	/* Return the GMT data type that corresponds to a MATLAB numeric class, or GMT_NOTSET */
+	switch (type) {
+		case mxDOUBLE_CLASS: return (GMT_DOUBLE);
+		case mxSINGLE_CLASS: return (GMT_FLOAT);
+		case mxUINT64_CLASS: return (GMT_ULONG);
+		case mxINT64_CLASS:  return (GMT_LONG);
+		case mxUINT32_CLASS: return (GMT_UINT);
+		case mxINT32_CLASS:  return (GMT_INT);
+		case mxUINT16_CLASS: return (GMT_USHORT);
+		case mxINT16_CLASS:  return (GMT_SHORT);
+		case mxUINT8_CLASS:  return (GMT_UCHAR);
+		case mxINT8_CLASS:   return (GMT_CHAR);
+		default: break;
+	}
+	return (GMT_NOTSET);
+}
+
+static bool gmtmex_is_column_struct (const mxArray *ptr) {
+	/* True if ptr is a scalar structure whose fields are all numeric vectors of the same length,
+	 * as when a MATLAB table is converted with table2struct (T, 'ToScalar', true) in gmt.m.
+	 * A dataset structure (which has data and/or text fields) is never a column structure. */
+	int k, n_fields;
+	size_t n_rows = 0;
+	mxArray *mx_ptr = NULL;
+	if (!mxIsStruct (ptr) || mxGetNumberOfElements (ptr) != 1) return (false);
+	if (mxGetField (ptr, 0, "data") || mxGetField (ptr, 0, "text")) return (false);
+	if ((n_fields = mxGetNumberOfFields (ptr)) == 0) return (false);
+	for (k = 0; k < n_fields; k++) {
+		mx_ptr = mxGetFieldByNumber (ptr, 0, k);
+		if (mx_ptr == NULL || !mxIsNumeric (mx_ptr) || mxGetNumberOfDimensions (mx_ptr) != 2) return (false);
+		if (mxGetM (mx_ptr) != 1 && mxGetN (mx_ptr) != 1) return (false);
+		if (k == 0) n_rows = mxGetNumberOfElements (mx_ptr);
+		else if (mxGetNumberOfElements (mx_ptr) != n_rows) return (false);
+	}
+	return (n_rows > 0);
+}
+
+static struct GMT_VECTOR *gmtmex_vector_init (void *API, unsigned int module_input, const mxArray *ptr) {
+	/* Pass a structure of column vectors (see gmtmex_is_column_struct) to GMT via a GMT_VECTOR.
+	 * Each column keeps its own data type and is passed by reference, so nothing is copied. */
+	int k, type;
+	uint64_t dim[3] = {0, 0, 0};
+	unsigned int flag = GMT_VIA_VECTOR | ((module_input) ? GMT_VIA_MODULE_INPUT : 0);
+	mxArray *mx_ptr = NULL;
+	struct GMT_VECTOR *V = NULL;
+
+	dim[0] = (uint64_t)mxGetNumberOfFields (ptr);	/* Number of columns */
+	dim[1] = (uint64_t)mxGetNumberOfElements (mxGetFieldByNumber (ptr, 0, 0));	/* Number of rows */
+	if ((V = GMT_Create_Data (API, GMT_IS_DATASET|flag, GMT_IS_PLP, GMT_CONTAINER_ONLY, dim, NULL, NULL, 0, 0, NULL)) == NULL)
+		mexErrMsgTxt ("gmtmex_vector_init: Failure to alloc GMT source vector\n");
+	gmtmex_track (API, V);
+	GMT_Report (API, GMT_MSG_DEBUG, "gmtmex_vector_init: Allocated GMT Vector %lx\n", (long)V);
+	for (k = 0; k < (int)dim[0]; k++) {
+		mx_ptr = mxGetFieldByNumber (ptr, 0, k);
+		if ((type = gmtmex_gmt_type (mxGetClassID (mx_ptr))) == GMT_NOTSET) {
+			char buffer[BUFSIZ] = {""};
+			snprintf (buffer, BUFSIZ, "gmtmex_vector_init: Unsupported MATLAB data type in column %s.\n", mxGetFieldNameByNumber (ptr, k));
+			mexErrMsgTxt (buffer);
+		}
+		if (GMT_Put_Vector (API, V, (unsigned int)k, (unsigned int)type, mxGetData (mx_ptr)) != GMT_NOERROR)
+			mexErrMsgTxt ("gmtmex_vector_init: Failure to hook up a column vector\n");
+	}
+	return (V);
+}
+
+static struct GMT_DATASET *gmtmex_dataset_columnar (void *API, const mxArray *ptr) {
+	/* Build a multi-segment dataset from a cell array {M} or {M, idx}, where M is a N x k numeric matrix.
+	 * {M}:      Rows whose first two columns (or only column) are NaN separate the segments (MATLAB plot style).
+	 * {M, idx}: idx is either a N-vector of segment ids, where a new segment starts whenever the id changes,
+	 *           or a shorter vector with the 1-based first row of each segment.
+	 * Double matrices are not copied; the segment columns point straight into the MATLAB array.
+	 * Other numeric types are converted to double in a single pass. */
+	bool by_reference;
+	uint64_t n_rows, n_cols, n_seg = 0, n_idx, seg, row, col, k, first, dim[4] = {1, 0, 0, 0}, *start = NULL, *len = NULL;
+	double *data = NULL;
+	mxArray *mxM = NULL, *mxIdx = NULL;
+	struct GMT_DATASET *D = NULL;
+	struct GMT_DATASEGMENT *S = NULL;
+
+	mxM = mxGetCell (ptr, 0);
+	if (mxGetNumberOfDimensions (mxM) != 2 || mxIsEmpty (mxM))
+		mexErrMsgTxt ("gmtmex_dataset_columnar: First element of the cell array must be a non-empty 2-D matrix\n");
+	if (mxGetNumberOfElements (ptr) > 2)
+		mexErrMsgTxt ("gmtmex_dataset_columnar: Cell array must be {matrix} or {matrix, segment_index}\n");
+	n_rows = mxGetM (mxM);	n_cols = mxGetN (mxM);
+	by_reference = mxIsDouble (mxM);
+	start = mxMalloc ((n_rows + 1) * sizeof (uint64_t));	/* Freed by MATLAB if we bail out below */
+	len   = mxMalloc ((n_rows + 1) * sizeof (uint64_t));
+
+	if (mxGetNumberOfElements (ptr) == 2 && !mxIsEmpty (mxIdx = mxGetCell (ptr, 1))) {	/* Got segment ids or offsets */
+		if (!mxIsNumeric (mxIdx))
+			mexErrMsgTxt ("gmtmex_dataset_columnar: Second element of the cell array must be a numeric vector\n");
+		n_idx = mxGetNumberOfElements (mxIdx);
+		if (n_idx == n_rows) {	/* One segment id per row */
+			for (row = 0; row < n_rows; row++) {
+				if (row == 0 || gmtmex_get_value (mxIdx, row) != gmtmex_get_value (mxIdx, row-1))
+					start[n_seg++] = row;
+			}
+		}
+		else if (n_idx < n_rows) {	/* 1-based start row of each segment */
+			for (k = 0; k < n_idx; k++) {
+				first = (uint64_t)lrint (gmtmex_get_value (mxIdx, k)) - 1;
+				if (first >= n_rows || (n_seg && first <= start[n_seg-1]))
+					mexErrMsgTxt ("gmtmex_dataset_columnar: Segment offsets must be increasing and within the matrix\n");
+				start[n_seg++] = first;
+			}
+		}
+		else
+			mexErrMsgTxt ("gmtmex_dataset_columnar: Segment index vector is longer than the number of rows\n");
+		for (seg = 0; seg < n_seg; seg++)
+			len[seg] = ((seg + 1 < n_seg) ? start[seg+1] : n_rows) - start[seg];
+	}
+	else if (mxIsDouble (mxM) || mxIsSingle (mxM)) {	/* Look for NaN separator rows */
+		uint64_t n_break = (n_cols > 1) ? 2 : 1;
+		bool is_break;
+		const double *f8 = (by_reference) ? mxGetData (mxM) : NULL;
+		const float  *f4 = (by_reference) ? NULL : mxGetData (mxM);
+		for (row = 0, first = 0; row <= n_rows; row++) {
+			is_break = (row == n_rows);
+			if (!is_break) {
+				for (col = 0, is_break = true; is_break && col < n_break; col++)
+					if (!isnan ((f8) ? f8[col * n_rows + row] : f4[col * n_rows + row])) is_break = false;
+			}
+			if (is_break) {
+				if (row > first) start[n_seg] = first, len[n_seg++] = row - first;	/* Skip empty segments */
+				first = row + 1;
+			}
+		}
+	}
+	else	/* Integer matrix without index: a single segment */
+		start[0] = 0, len[0] = n_rows, n_seg = 1;
+	if (n_seg == 0)
+		mexErrMsgTxt ("gmtmex_dataset_columnar: Input has zero segments where it can't be.\n");
+
+	dim[GMT_SEG] = n_seg;	dim[GMT_COL] = n_cols;	/* dim[GMT_ROW] = 0 so no rows are allocated yet */
+	if ((D = GMT_Create_Data (API, GMT_IS_DATASET, GMT_IS_PLP, GMT_NO_STRINGS, dim, NULL, NULL, 0, 0, NULL)) == NULL)
+		mexErrMsgTxt ("gmtmex_dataset_columnar: Failure to alloc GMT destination dataset\n");
+	gmtmex_track (API, D);
+	GMT_Report (API, GMT_MSG_DEBUG, "gmtmex_dataset_columnar: Allocated GMT dataset %lx with %" PRIu64 " segments\n", (long)D, n_seg);
+	data = (by_reference) ? mxGetData (mxM) : NULL;
+	for (seg = 0; seg < n_seg; seg++) {
+		if (by_reference) {	/* Segment columns are views into the MATLAB matrix */
+			S = D->table[0]->segment[seg];
+			for (col = 0; col < n_cols; col++)
+				S->data[col] = &data[col * n_rows + start[seg]];
+			S->n_rows = len[seg];
+		}
+		else {	/* Must allocate and convert */
+			S = GMT_Alloc_Segment (API, GMT_NO_STRINGS, len[seg], n_cols, NULL, D->table[0]->segment[seg]);
+			for (col = 0; col < n_cols; col++)
+				gmtmex_copy_column (S->data[col], mxM, col * n_rows + start[seg], len[seg]);
+		}
+		D->table[0]->n_records += len[seg];
+	}
+	if (by_reference) GMT_Set_AllocMode (API, GMT_IS_DATASET, D);	/* Since MATLAB owns the columns */
+	D->type = GMT_READ_DATA;
+	mxFree (start);	mxFree (len);
+	return (D);
+}
+
 static void *gmtmex_dataset_init (void *API, unsigned int direction, unsigned int module_input, const mxArray *ptr, unsigned int *actual_family) {
 	/* Create containers to hold or receive data tables:
 	 * direction == GMT_IN:  Create empty GMT_DATASET container, fill from Mex, and use as GMT input.
@@ -891,7 +1550,6 @@ static void *gmtmex_dataset_init (void *API, unsigned int direction, unsigned in
 		unsigned int mode;
 		char buffer[BUFSIZ] = {""},  *txt = NULL;
 		mxArray *mx_ptr = NULL, *mx_ptr_d = NULL, *mx_ptr_t = NULL;
-		double *data = NULL;
 		struct GMT_DATASEGMENT *S = NULL;
 
 		if (!ptr) mexErrMsgTxt ("gmtmex_dataset_init: Input is empty where it can't be.\n");
@@ -906,6 +1564,7 @@ static void *gmtmex_dataset_init (void *API, unsigned int direction, unsigned in
 			/* Create matrix container but do not allocate any matrix memory */
 			if ((M = GMT_Create_Data (API, GMT_IS_DATASET|flag, GMT_IS_PLP, GMT_CONTAINER_ONLY, dim, NULL, NULL, 0, 0, NULL)) == NULL)
 				mexErrMsgTxt ("gmtmex_dataset_init: Failure to alloc GMT source matrix\n");
+			gmtmex_track (API, M);
 			GMT_Report (API, GMT_MSG_DEBUG, "gmtmex_dataset_init: Allocated GMT Matrix %lx\n", (long)M);
 			switch (type) {	/* Assign ML type pointer to the corresponding GMT matrix union pointer */
 				case mxDOUBLE_CLASS: M->type = GMT_DOUBLE; M->data.f8  =             mxGetData (ptr); break;
@@ -933,12 +1592,19 @@ static void *gmtmex_dataset_init (void *API, unsigned int direction, unsigned in
 			M->shape = MEX_COL_ORDER;		/* Either col or row order, depending on MATLAB/Octave setting in gmtmex.h */
 			return (M);
 		}
-		/* We come here if we did not receive a matrix,  There are three options: */
+		if (gmtmex_is_column_struct (ptr)) {	/* Got a structure of typed column vectors - pass them via VECTOR */
+			*actual_family |= GMT_VIA_VECTOR;
+			return (gmtmex_vector_init (API, module_input, ptr));
+		}
+		/* We come here if we did not receive a matrix,  There are four options: */
 		/* 1. A dataset MATLAB structure or array of structures.
-		 * 2. A Cell array of plain text strings for a text-only file.
-		 * 3. A single text string instead of a one-item cell array of strings. */
+		 * 2. A cell array {M} or {M, idx} with a matrix holding many segments (see gmtmex_dataset_columnar).
+		 * 3. A Cell array of plain text strings for a text-only file.
+		 * 4. A single text string instead of a one-item cell array of strings. */
 		
-		if (mxIsStruct (ptr)) {	/* Got the dataset structure */
+		if (mxIsCell (ptr) && mxGetNumberOfElements (ptr) > 0 && mxGetCell (ptr, 0) && mxIsNumeric (mxGetCell (ptr, 0)))	/* Columnar multi-segment data */
+			D = gmtmex_dataset_columnar (API, ptr);
+		else if (mxIsStruct (ptr)) {	/* Got the dataset structure */
 			dim[GMT_SEG] = mxGetM (ptr);	/* Number of segments */
 			if (dim[GMT_SEG] == 0) mexErrMsgTxt ("gmtmex_dataset_init: Input has zero segments where it can't be.\n");
 			mx_ptr_d = mxGetField (ptr, 0, "data");	/* Get first segment's data matrix [if available] */
@@ -960,16 +1626,21 @@ static void *gmtmex_dataset_init (void *API, unsigned int direction, unsigned in
 
 			if ((D = GMT_Create_Data (API, GMT_IS_DATASET, GMT_IS_PLP, mode, dim, NULL, NULL, 0, 0, NULL)) == NULL)
 				mexErrMsgTxt ("gmtmex_dataset_init: Failure to alloc GMT destination dataset\n");
+			gmtmex_track (API, D);
 			GMT_Report (API, GMT_MSG_DEBUG, "gmtmex_dataset_init: Allocated GMT dataset %lx\n", (long)D);
 
 			for (seg = 0; seg < dim[GMT_SEG]; seg++) {	/* Each incoming structure is a new data segment */
-				mx_ptr = mxGetField (ptr, (mwSize)seg, "header");		/* Get pointer to MEX segment header */
+				mx_ptr = mxGetField (ptr, (mwIndex)seg, "header");		/* Get pointer to MEX segment header */
 				buffer[0] = 0;							/* Reset our temporary text buffer */
 				if (mx_ptr && (length = mxGetN (mx_ptr)) != 0)			/* These is a non-empty segment header to keep */
 					mxGetString (mx_ptr, buffer, (mwSize)(length+1));
-				mx_ptr_d = mxGetField (ptr, (mwSize)seg, "data");		/* Data matrix for this segment */
+				mx_ptr_d = mxGetField (ptr, (mwIndex)seg, "data");		/* Data matrix for this segment */
 				if (mx_ptr_d && mxIsEmpty(mx_ptr_d)) mx_ptr_d = NULL;		/* Got one but was empty */
-				mx_ptr_t = mxGetField (ptr, (mwSize)seg, "text");		/* text cell array for this segment */
+				if (mx_ptr_d && (!mxIsNumeric (mx_ptr_d) || mxIsComplex (mx_ptr_d))) {
+					snprintf (buffer, BUFSIZ, "gmtmex_dataset_init: Segment %" PRIu64 " data must be a real numeric matrix\n", seg + 1);
+					mexErrMsgTxt (buffer);
+				}
+				mx_ptr_t = mxGetField (ptr, (mwIndex)seg, "text");		/* text cell array for this segment */
 				if (mx_ptr_t && mxIsEmpty(mx_ptr_t)) mx_ptr_t = NULL;		/* Got one but was empty */
 
 				if (mx_ptr_t) {	/* This segment also has a cell array of strings or possibly a single string (if n_rows == 1) */
@@ -983,15 +1654,19 @@ static void *gmtmex_dataset_init (void *API, unsigned int direction, unsigned in
 				else	/* No trailing text */
 					m = n = 0;
 				dim[GMT_ROW] = (mx_ptr_d == NULL) ? m : mxGetM (mx_ptr_d);	/* Number of rows in matrix (or strings if no data) */
+				if (dim[GMT_COL] && dim[GMT_ROW] && (mx_ptr_d == NULL || mxGetN (mx_ptr_d) != dim[GMT_COL])) {	/* Every segment needs the same columns */
+					snprintf (buffer, BUFSIZ, "gmtmex_dataset_init: Segment %" PRIu64 " has %d data columns but the first segment has %d\n",
+					          seg + 1, (mx_ptr_d) ? (int)mxGetN (mx_ptr_d) : 0, (int)dim[GMT_COL]);
+					mexErrMsgTxt (buffer);
+				}
 				if ((m == dim[GMT_ROW] && n == 1) || (n == dim[GMT_ROW] && m == 1))
 					mode = GMT_WITH_STRINGS;
 				else
 					mode = GMT_NO_STRINGS;
 				/* Allocate a new data segment and hook up to to our single table */
 				S = GMT_Alloc_Segment (API, mode, dim[GMT_ROW], dim[GMT_COL], buffer, D->table[0]->segment[seg]);
-				if (mx_ptr_d != NULL) data = mxGetData (mx_ptr_d);
-				for (col = start = 0; col < S->n_columns; col++, start += S->n_rows) /* Copy the data columns */
-					memcpy (S->data[col], &data[start], S->n_rows * sizeof (double));
+				for (col = start = 0; mx_ptr_d && col < S->n_columns; col++, start += S->n_rows) /* Copy the data columns, whatever their class */
+					gmtmex_copy_column (S->data[col], mx_ptr_d, start, S->n_rows);
 				if (mode == GMT_WITH_STRINGS) {	/* Add in the trailing strings */
 					if (got_single_record) {	/* Only true when we got a single row with a single string instead of a cell array */
 						txt = mxArrayToString (mx_ptr_t);
@@ -999,7 +1674,7 @@ static void *gmtmex_dataset_init (void *API, unsigned int direction, unsigned in
 					}
 					else {	/* Must extract text from the cell array */
 						for (row = 0; row < S->n_rows; row++) {
-							mx_ptr = mxGetCell (mx_ptr_t, (mwSize)row);
+							mx_ptr = mxGetCell (mx_ptr_t, (mwIndex)row);
 							txt = mxArrayToString (mx_ptr);
 							S->text[row] = GMT_Duplicate_String (API, txt);
 						}
@@ -1007,10 +1682,10 @@ static void *gmtmex_dataset_init (void *API, unsigned int direction, unsigned in
 				}
 				D->table[0]->n_records += S->n_rows;	/* Must manually keep track of totals */
 				if (seg == 0) {	/* First segment may have table information */
-					mx_ptr_t = mxGetField (ptr, (mwSize)seg, "comment");	/* Table headers */
+					mx_ptr_t = mxGetField (ptr, (mwIndex)seg, "comment");	/* Table headers */
 					if (mx_ptr_t && (n_headers = mxGetM (mx_ptr_t)) != 0) {	/* Number of headers found */
 						for (k = 0; k < n_headers; k++) {	/* Extract the headers and insert into dataset */
-							mx_ptr = mxGetCell (mx_ptr_t, (mwSize)k);
+							mx_ptr = mxGetCell (mx_ptr_t, (mwIndex)k);
 							txt = mxArrayToString (mx_ptr);
 							if (GMT_Set_Comment (API, GMT_IS_DATASET, GMT_COMMENT_IS_TEXT, txt, D))
 								mexErrMsgTxt("gmtmex_dataset_init: Failed to set a dataset header\n");
@@ -1028,17 +1703,18 @@ static void *gmtmex_dataset_init (void *API, unsigned int direction, unsigned in
 			mode = GMT_WITH_STRINGS;	/* Since that is all we have */
 			/* Determine number of segments up front since user may use '>' to indicate segment header */
 			for (k = 0; k < n_rows; k++) {
-				mx_ptr = mxGetCell (ptr, (mwSize)k);
+				mx_ptr = mxGetCell (ptr, (mwIndex)k);
 				txt = mxArrayToString (mx_ptr);
 				if (txt[0] == '>') dim[GMT_SEG]++;	/* Found start of a new segment */
 			}
 			if (dim[GMT_SEG] == 0) dim[GMT_SEG] = 1;	/* No segment headers given a single segment */
 			if ((D = GMT_Create_Data (API, GMT_IS_DATASET, GMT_IS_TEXT, GMT_WITH_STRINGS, dim, NULL, NULL, 0, 0, NULL)) == NULL)
 				mexErrMsgTxt ("gmtmex_dataset_init: Failure to alloc GMT destination dataset\n");
+			gmtmex_track (API, D);
 			GMT_Report (API, GMT_MSG_DEBUG, "gmtmex_dataset_init: Allocated GMT dataset %lx\n", (long)D);
 			k = seg = 0;
 			while (k < n_rows) {	/* Examine the input records and look for segment breaks */
-				mx_ptr = mxGetCell (ptr, (mwSize)k);
+				mx_ptr = mxGetCell (ptr, (mwIndex)k);
 				txt = mxArrayToString (mx_ptr);
 				buffer[0] = '\0';
 				if (txt[0] == '>' || (k == 0 && txt[0] != '>')) {	/* Found start of a new (or first and only) segment */
@@ -1046,7 +1722,7 @@ static void *gmtmex_dataset_init (void *API, unsigned int direction, unsigned in
 					k2 = k;	/* k and k2 initially point to the first row of the current segment */
 					dim[GMT_ROW] = 0;	/* Have no rows so far */
 					while (k2 < n_rows && dim[GMT_ROW] == 0) {	/* While not reached end of current segment */
-						mx_ptr = mxGetCell (ptr, (mwSize)k2);
+						mx_ptr = mxGetCell (ptr, (mwIndex)k2);
 						txt = mxArrayToString (mx_ptr);
 						if (txt[0] == '>')	/* Got next segment header, must end current segment */
 							dim[GMT_ROW] = k2 - k;
@@ -1058,7 +1734,7 @@ static void *gmtmex_dataset_init (void *API, unsigned int direction, unsigned in
 				/* Now we have the length of this segment */
 				S = GMT_Alloc_Segment (API, GMT_WITH_STRINGS, dim[GMT_ROW], 0, buffer, D->table[0]->segment[seg]);
 				for (row = 0; row < S->n_rows; row++) {	/* Hook up the string records */
-					mx_ptr = mxGetCell (ptr, (mwSize)(k+row));	/* k is the offset to 1st record of current segment in input cell array */
+					mx_ptr = mxGetCell (ptr, (mwIndex)(k+row));	/* k is the offset to 1st record of current segment in input cell array */
 					txt = mxArrayToString (mx_ptr);
 					S->text[row] = GMT_Duplicate_String (API, txt);
 				}
@@ -1074,6 +1750,7 @@ static void *gmtmex_dataset_init (void *API, unsigned int direction, unsigned in
 			mode = GMT_WITH_STRINGS;		/* Since that is all we have */
 			if ((D = GMT_Create_Data (API, GMT_IS_DATASET, GMT_IS_TEXT, mode, dim, NULL, NULL, 0, 0, NULL)) == NULL)
 				mexErrMsgTxt ("gmtmex_dataset_init: Failure to alloc GMT destination dataset\n");
+			gmtmex_track (API, D);
 			GMT_Report (API, GMT_MSG_DEBUG, "gmtmex_dataset_init: Allocated GMT dataset %lx\n", (long)D);
 			S = D->table[0]->segment[0];	/* The lone segment */
 			txt = mxArrayToString (ptr);	/* The lone string */
@@ -1084,9 +1761,19 @@ static void *gmtmex_dataset_init (void *API, unsigned int direction, unsigned in
 			mexErrMsgTxt ("gmtmex_dataset_init: Expected a data structure, cell array with strings, or a single string for input\n");
 		D->n_records = D->table[0]->n_records;
 	}
+	else if (gmtmex_matrix_output != GMT_NOTSET) {	/* Receive the table as a GMT_MATRIX of type GMT_EXPORT_TYPE instead */
+		struct GMT_MATRIX *M = NULL;
+		if ((M = GMT_Create_Data (API, GMT_IS_DATASET|GMT_VIA_MATRIX, GMT_IS_PLP, GMT_IS_OUTPUT, NULL, NULL, NULL, 0, 0, NULL)) == NULL)
+			mexErrMsgTxt ("gmtmex_dataset_init: Failure to alloc GMT destination matrix\n");
+		gmtmex_track (API, M);
+		*actual_family |= GMT_VIA_MATRIX;
+		GMT_Report (API, GMT_MSG_DEBUG, "gmtmex_dataset_init: Allocated GMT Matrix %lx\n", (long)M);
+		return (M);
+	}
 	else {	/* Here we set up an empty container to receive data from GMT (signal this by passing 0s and NULLs) */
 		if ((D = GMT_Create_Data (API, GMT_IS_DATASET, GMT_IS_PLP, GMT_IS_OUTPUT, NULL, NULL, NULL, 0, 0, NULL)) == NULL)
 			mexErrMsgTxt ("gmtmex_dataset_init: Failure to alloc GMT source dataset\n");
+		gmtmex_track (API, D);
 		GMT_Report (API, GMT_MSG_DEBUG, "gmtmex_dataset_init: Allocated GMT Dataset %lx\n", (long)D);
 	}
 	return (D);
@@ -1137,12 +1824,13 @@ static struct GMT_PALETTE *gmtmex_palette_init (void *API, unsigned int directio
 
 		if ((P = GMT_Create_Data (API, GMT_IS_PALETTE|flag, GMT_IS_NONE, 0, dim, NULL, NULL, 0, 0, NULL)) == NULL)
 			mexErrMsgTxt ("gmtmex_palette_init: Failure to alloc GMT source CPT for input\n");
+		gmtmex_track (API, P);
 
 		if ((n_headers = (unsigned int)mxGetM (mx_ptr[10])) != 0) {	/* Number of headers found */
 			char *txt = NULL;
 			mxArray *ptr = NULL;
 			for (k = 0; k < n_headers; k++) {
-				ptr = mxGetCell (mx_ptr[10], (mwSize)k);
+				ptr = mxGetCell (mx_ptr[10], (mwIndex)k);
 				txt = mxArrayToString (ptr);
 				if (GMT_Set_Comment (API, GMT_IS_PALETTE, GMT_COMMENT_IS_TEXT, txt, P))
 					mexErrMsgTxt("gmtmex_palette_init: Failed to set a CPT header\n");
@@ -1187,6 +1875,7 @@ static struct GMT_PALETTE *gmtmex_palette_init (void *API, unsigned int directio
 	else {	/* Just allocate an empty container to hold an output grid (signal this by passing 0s and NULLs [mode == GMT_IS_OUTPUT from 5.4]) */
 		if ((P = GMT_Create_Data (API, GMT_IS_PALETTE, GMT_IS_NONE, GMT_IS_OUTPUT, NULL, NULL, NULL, 0, 0, NULL)) == NULL)
 			mexErrMsgTxt ("gmtmex_palette_init: Failure to alloc GMT blank CPT container for holding output CPT\n");
+		gmtmex_track (API, P);
 	}
 	return (P);
 }
@@ -1220,6 +1909,7 @@ static struct GMT_POSTSCRIPT *gmtmex_ps_init (void *API, unsigned int direction,
 		/* Passing dim[0] = 0 since we dont want any allocation of a PS string */
 		if ((P = GMT_Create_Data (API, GMT_IS_POSTSCRIPT|flag, GMT_IS_NONE, 0, dim, NULL, NULL, 0, 0, NULL)) == NULL)
 			mexErrMsgTxt ("gmtmex_ps_init: Failure to alloc GMT POSTSCRIPT source for input\n");
+		gmtmex_track (API, P);
 		P->data = PS;	/* PostScript string instead is coming from MATLAB */
 		GMT_Set_AllocMode (API, GMT_IS_POSTSCRIPT, P);
 		//P->alloc_mode = GMT_ALLOC_EXTERNALLY;	/* Hence we are not allowed to free it */
@@ -1230,7 +1920,7 @@ static struct GMT_POSTSCRIPT *gmtmex_ps_init (void *API, unsigned int direction,
 			char *txt = NULL;
 			mxArray *ptr = NULL;
 			for (k = 0; k < n_headers; k++) {
-				ptr = mxGetCell (mx_ptr[3], (mwSize)k);
+				ptr = mxGetCell (mx_ptr[3], (mwIndex)k);
 				txt = mxArrayToString (ptr);
 				if (GMT_Set_Comment (API, GMT_IS_POSTSCRIPT, GMT_COMMENT_IS_TEXT, txt, P))
 					mexErrMsgTxt("gmtmex_ps_init: Failed to set a PostScript header\n");
@@ -1241,83 +1931,1416 @@ static struct GMT_POSTSCRIPT *gmtmex_ps_init (void *API, unsigned int direction,
 	else {	/* Just allocate an empty container to hold an output PS object (signal this by passing 0s and NULLs [mode == GMT_IS_OUTPUT from 5.4]) */
 		if ((P = GMT_Create_Data (API, GMT_IS_POSTSCRIPT, GMT_IS_NONE, GMT_IS_OUTPUT, NULL, NULL, NULL, 0, 0, NULL)) == NULL)
 			mexErrMsgTxt ("gmtmex_ps_init: Failure to alloc GMT POSTSCRIPT container for holding output PostScript\n");
+		gmtmex_track (API, P);
 	}
 	return (P);
 }
 
-char GMTMEX_objecttype (const mxArray *ptr) {
-	/* Determine what we are returning so gmt write can pass the correct -T? flag */
-	mxArray *mx_ptr = NULL;
-	if (mxIsEmpty (ptr))
-		mexErrMsgTxt ("GMTMEX_objecttype: Pointer is empty\n");
-	if (mxIsStruct (ptr)) {	/* This means either a dataset, grid, image, cpt, or PS, so must check for fields */
-		mx_ptr = mxGetField (ptr, 0, "data");
-		if (mx_ptr) return 'd';
-		mx_ptr = mxGetField (ptr, 0, "postscript");
-		if (mx_ptr) return 'p';
-		mx_ptr = mxGetField (ptr, 0, "hinge");
-		if (mx_ptr) return 'c';
-		mx_ptr = mxGetField (ptr, 0, "image");
-		if (mx_ptr) return 'i';
-		mx_ptr = mxGetField (ptr, 0, "z");
-		if (mx_ptr) return 'g';
-		mexErrMsgTxt ("GMTMEX_objecttype: Could not recognize the structure\n");
+/* Resident objects: gmt ('register', obj) converts obj once and keeps the GMT container in the
+ * session, so that many later module calls can use it as input without any conversion.  The handle
+ * returned to MATLAB is a small structure with the fields listed below. */
+
+#define N_MEX_FIELDNAMES_RESIDENT	2
+static const char *GMTMEX_fieldname_resident[N_MEX_FIELDNAMES_RESIDENT] = {"resident", "family"};
+
+struct GMTMEX_RESIDENT {
+	uint64_t id;                    /* Handle id returned to MATLAB */
+	void *API;                      /* Session that owns the object */
+	unsigned int family;            /* GMT_IS_GRID, GMT_IS_DATASET, etc. */
+	unsigned int actual_family;     /* May include GMT_VIA_MATRIX or GMT_VIA_VECTOR */
+	void *object;                   /* The GMT container */
+	mxArray *source;                /* Persistent copy of the input when GMT references MATLAB memory */
+	void *mapping;                  /* Shared memory segment holding the data, from gmt ('attach', ...) */
+	size_t bytes;                   /* Memory held by the object (or mapped, if mapping is set) */
+};
+
+/* The list holds the objects of the sessions of all threads, so it is only used under resident_lock.
+ * An entry is only changed by the thread that owns its session, and is copied out of the list to be used */
+static struct GMTMEX_RESIDENT *Resident = NULL;
+static unsigned int n_resident = 0, n_resident_alloc = 0;
+static uint64_t last_resident_id = 0;
+static gmtmex_mutex_t resident_lock = GMTMEX_MUTEX_INITIALIZER;
+
+static const char *gmtmex_family_name (unsigned int family) {
+	switch (family) {
+		case GMT_IS_GRID:       return ("grid");
+		case GMT_IS_IMAGE:      return ("image");
+		case GMT_IS_DATASET:    return ("dataset");
+		case GMT_IS_PALETTE:    return ("palette");
+		case GMT_IS_POSTSCRIPT: return ("postscript");
+		default: break;
 	}
-	else if (mxIsCell (ptr))	/* This is a dataset with text only */
-		return 'd';
-	else	/* We have to assume it is a numerical matrix */
-		return 'd';
-	return '-';	/* Can never get here you would think */
+	return ("unknown");
 }
 
-void GMTMEX_Set_Object (void *API, struct GMT_RESOURCE *X, const mxArray *ptr) {
-	/* Create the GMT container and hook onto resource array as X->object */
-	unsigned int module_input = (X->option->option == GMT_OPT_INFILE), actual_family = X->family;
+static size_t gmtmex_type_size (unsigned int type) {
+	/* Bytes per item for the GMT data types */
+	switch (type) {
+		case GMT_CHAR:  case GMT_UCHAR:  return (1);
+		case GMT_SHORT: case GMT_USHORT: return (2);
+		case GMT_INT:   case GMT_UINT:   case GMT_FLOAT: return (4);
+		default: break;
+	}
+	return (8);
+}
 
-	switch (X->family) {
-		case GMT_IS_GRID:	/* Get a grid from Matlab or a dummy one to hold GMT output */
-			X->object = gmtmex_grid_init (API, X->direction, module_input, ptr);
-			GMT_Report (API, GMT_MSG_DEBUG, "GMTMEX_Set_Object: Got Grid\n");
-			break;
-		case GMT_IS_IMAGE:	/* Get an image from Matlab or a dummy one to hold GMT output */
-			X->object = gmtmex_image_init (API, X->direction, module_input, ptr);
-			GMT_Report (API, GMT_MSG_DEBUG, "GMTMEX_Set_Object: Got Image\n");
+static size_t gmtmex_object_bytes (unsigned int family, void *object) {
+	/* Return the number of bytes of data held by a GMT container */
+	uint64_t tbl, seg, col;
+	size_t bytes = 0;
+	switch (family & 0xFF) {	/* Strip any GMT_VIA_* modifiers */
+		case GMT_IS_GRID:
+			bytes = ((struct GMT_GRID *)object)->header->size * sizeof (gmt_grdfloat);
 			break;
-		case GMT_IS_DATASET:	/* Get a dataset from Matlab or a dummy one to hold GMT output */
-			/* Because a GMT_DATASET may appears as a GMT_MATRIX or GMT_VECTOR we need the actual_family to open the virtual file later */
-			X->object = gmtmex_dataset_init (API, X->direction, module_input, ptr, &actual_family);
+		case GMT_IS_IMAGE: {
+			struct GMT_IMAGE *I = object;
+			bytes = I->header->size * I->header->n_bands * gmtmex_type_size (I->type);
 			break;
-		case GMT_IS_PALETTE:	/* Get a palette from Matlab or a dummy one to hold GMT output */
-			X->object = gmtmex_palette_init (API, X->direction, module_input, ptr);
-			GMT_Report (API, GMT_MSG_DEBUG, "GMTMEX_Set_Object: Got CPT\n");
+		}
+		case GMT_IS_DATASET:
+			if (family & GMT_VIA_MATRIX) {
+				struct GMT_MATRIX *M = object;
+				bytes = M->n_rows * M->n_columns * gmtmex_type_size (M->type);
+			}
+			else if (family & GMT_VIA_VECTOR) {
+				struct GMT_VECTOR *V = object;
+				for (col = 0; col < V->n_columns; col++) bytes += V->n_rows * gmtmex_type_size (V->type[col]);
+			}
+			else {
+				struct GMT_DATASET *D = object;
+				for (tbl = 0; tbl < D->n_tables; tbl++)
+					for (seg = 0; seg < D->table[tbl]->n_segments; seg++)
+						bytes += D->table[tbl]->segment[seg]->n_rows * D->table[tbl]->segment[seg]->n_columns * sizeof (double);
+			}
 			break;
-		case GMT_IS_POSTSCRIPT:	/* Get a PostScript struct from Matlab or a dummy one to hold GMT output */
-			X->object = gmtmex_ps_init (API, X->direction, module_input, ptr);
-			GMT_Report (API, GMT_MSG_DEBUG, "GMTMEX_Set_Object: Got POSTSCRIPT\n");
+		case GMT_IS_PALETTE:
+			bytes = ((struct GMT_PALETTE *)object)->n_colors * sizeof (struct GMT_LUT);
 			break;
-		default:
-			GMT_Report (API, GMT_MSG_NORMAL, "GMTMEX_Set_Object: Bad data type (%d)\n", X->family);
+		case GMT_IS_POSTSCRIPT:
+			bytes = ((struct GMT_POSTSCRIPT *)object)->n_bytes;
 			break;
+		default: break;
 	}
-	if (X->object == NULL)
-		mexErrMsgTxt("GMT: Failure to register the resource\n");
-	if (GMT_Open_VirtualFile (API, actual_family, X->geometry, X->direction|GMT_IS_REFERENCE, X->object, X->name) != GMT_NOERROR) 	/* Make filename with embedded object ID */
-		mexErrMsgTxt ("GMT: Failure to open virtual file\n");
-	if (GMT_Expand_Option (API, X->option, X->name) != GMT_NOERROR)	/* Replace ? in argument with name */
-		mexErrMsgTxt ("GMT: Failure to expand filename marker (?)\n");
+	return (bytes);
 }
 
-void *GMTMEX_Get_Object (void *API, struct GMT_RESOURCE *X) {
-	mxArray *ptr = NULL;
-	/* In line-by-line modules it is possible no output is produced, hence we make an exception for DATASET: */
-	if ((X->object = GMT_Read_VirtualFile (API, X->name)) == NULL && X->family != GMT_IS_DATASET)
+static bool gmtmex_find_resident (const mxArray *ptr, struct GMTMEX_RESIDENT *R) {
+	/* If ptr is a handle from gmt ('register', ...) copy its resident object to R and return true, else return false */
+	unsigned int k;
+	uint64_t id;
+	bool found = false;
+	mxArray *mx_ptr = NULL;
+	if (ptr == NULL || !mxIsStruct (ptr) || (mx_ptr = mxGetField (ptr, 0, "resident")) == NULL) return (false);
+	if (!mxIsUint64 (mx_ptr) || mxGetNumberOfElements (mx_ptr) != 1)
+		mexErrMsgTxt ("gmtmex_find_resident: Bad resident object handle\n");
+	id = *(uint64_t *)mxGetData (mx_ptr);
+	gmtmex_mutex_lock (&resident_lock);
+	for (k = 0; !found && k < n_resident; k++)
+		if (Resident[k].id == id) *R = Resident[k], found = true;
+	gmtmex_mutex_unlock (&resident_lock);
+	if (!found) mexErrMsgTxt ("gmtmex_find_resident: This resident object was already unregistered\n");
+	return (true);
+}
+
+/* A module reads a resident input by reference, and some modules change their inputs in place: grdmath
+ * computes on its stack, grdedit and grdfill edit the grid, and so on.  That would change the resident
+ * object for every later call, so a call gets its own duplicate of a resident input unless the module
+ * is known to only read its inputs. */
+static const char *gmtmex_read_only_modules[] = {"gmtinfo", "grd2cpt", "grd2xyz", "grdcontour", "grdimage", "grdinfo",
+	"grdtrack", "grdview", "plot", "plot3d", "psxy", "psxyz", NULL};
+static GMTMEX_TLS bool gmtmex_copy_residents = true;	/* Set for each call by GMTMEX_Set_Resident_Use */
+
+void GMTMEX_Set_Resident_Use (const char *module) {
+	/* Decide whether the resident inputs of this call of module must be duplicated */
+	unsigned int k;
+	gmtmex_copy_residents = true;
+	for (k = 0; gmtmex_read_only_modules[k]; k++)
+		if (!strcmp (module, gmtmex_read_only_modules[k])) gmtmex_copy_residents = false;
+}
+
+static bool gmtmex_input_is_aliased (unsigned int family, const mxArray *ptr) {
+	/* True if the GMT container made from ptr references the MATLAB memory instead of a copy */
+	if (family == GMT_IS_IMAGE) return (true);
+	if (family != GMT_IS_DATASET) return (false);
+	if (mxIsNumeric (ptr) || gmtmex_is_column_struct (ptr)) return (true);	/* Via GMT_MATRIX or GMT_VECTOR */
+	return (mxIsCell (ptr) && mxGetNumberOfElements (ptr) > 0 && mxGetCell (ptr, 0) && mxIsDouble (mxGetCell (ptr, 0)));	/* Columnar */
+}
+
+static bool gmtmex_remove_resident (uint64_t id, void *API, struct GMTMEX_RESIDENT *R) {
+	/* Take resident object id (or if id is 0 the first one of session API) out of the list and copy it to R.
+	 * Returns false if there is no such object */
+	unsigned int k;
+	bool found = false;
+	gmtmex_mutex_lock (&resident_lock);
+	for (k = 0; k < n_resident && !((id && Resident[k].id == id) || (!id && Resident[k].API == API)); k++);
+	if (k < n_resident) {
+		*R = Resident[k];
+		if (k < n_resident - 1) memmove (&Resident[k], &Resident[k+1], (n_resident - k - 1) * sizeof (struct GMTMEX_RESIDENT));
+		n_resident--;
+		found = true;
+	}
+	gmtmex_mutex_unlock (&resident_lock);
+	return (found);
+}
+
+static void gmtmex_shm_unmap (void *addr, size_t size);
+
+static void gmtmex_free_resident (struct GMTMEX_RESIDENT *R) {
+	/* Destroy a resident object that was taken out of the list */
+	if (GMT_Destroy_Data (R->API, &R->object) != GMT_NOERROR)
+		mexPrintf ("Warning: Failure to destroy resident object %" PRIu64 "\n", R->id);
+	if (R->source) mxDestroyArray (R->source);
+	if (R->mapping) gmtmex_shm_unmap (R->mapping, R->bytes);
+}
+
+static void gmtmex_add_resident (struct GMTMEX_RESIDENT *R) {
+	/* Give R an id and append it to the list; on failure R is freed and an error raised */
+	bool full = false;
+	gmtmex_mutex_lock (&resident_lock);
+	if (n_resident == n_resident_alloc) {
+		struct GMTMEX_RESIDENT *tmp = NULL;
+		unsigned int n_alloc = (n_resident_alloc) ? 2 * n_resident_alloc : 16;
+		if ((tmp = realloc (Resident, n_alloc * sizeof (struct GMTMEX_RESIDENT))) != NULL)
+			Resident = tmp, n_resident_alloc = n_alloc;
+	}
+	if ((full = (n_resident == n_resident_alloc)) == false) {
+		R->id = ++last_resident_id;
+		Resident[n_resident++] = *R;
+	}
+	gmtmex_mutex_unlock (&resident_lock);
+	if (full) {
+		R->id = 0;
+		gmtmex_free_resident (R);
+		mexErrMsgTxt ("GMTMEX_Register: Failure to grow the list of resident objects\n");
+	}
+}
+
+static mxArray *gmtmex_resident_handle (struct GMTMEX_RESIDENT *R) {
+	/* The structure returned to MATLAB for a resident object */
+	mxArray *handle = mxCreateStructMatrix (1, 1, N_MEX_FIELDNAMES_RESIDENT, GMTMEX_fieldname_resident);
+	mxSetField (handle, 0, "resident", mxCreateNumericMatrix (1, 1, mxUINT64_CLASS, mxREAL));
+	*(uint64_t *)mxGetData (mxGetField (handle, 0, "resident")) = R->id;
+	mxSetField (handle, 0, "family", mxCreateString (gmtmex_family_name (R->family)));
+	return (handle);
+}
+
+mxArray *GMTMEX_Register (void *API, const mxArray *ptr) {
+	/* Convert a MATLAB object once and keep the GMT container in this session.  Returns the handle */
+	unsigned int family, actual_family;
+	mxArray *source = NULL;
+	void *object = NULL;
+	struct GMTMEX_RESIDENT R;
+
+	if (gmtmex_find_resident (ptr, &R))
+		mexErrMsgTxt ("GMTMEX_Register: This object is already resident\n");
+	switch (GMTMEX_objecttype (ptr)) {
+		case 'g': family = GMT_IS_GRID;       break;
+		case 'i': family = GMT_IS_IMAGE;      break;
+		case 'c': family = GMT_IS_PALETTE;    break;
+		case 'p': family = GMT_IS_POSTSCRIPT; break;
+		default:  family = GMT_IS_DATASET;    break;
+	}
+	actual_family = family;
+	if (gmtmex_input_is_aliased (family, ptr)) {	/* GMT will point into MATLAB memory, so keep our own copy alive */
+		source = mxDuplicateArray (ptr);
+		mexMakeArrayPersistent (source);
+		ptr = source;
+	}
+	switch (family) {
+		case GMT_IS_GRID:       object = gmtmex_grid_init (API, GMT_IN, 0, ptr);    break;
+		case GMT_IS_IMAGE:      object = gmtmex_image_init (API, GMT_IN, 0, ptr);   break;
+		case GMT_IS_PALETTE:    object = gmtmex_palette_init (API, GMT_IN, 0, ptr); break;
+		case GMT_IS_POSTSCRIPT: object = gmtmex_ps_init (API, GMT_IN, 0, ptr);      break;
+		default: object = gmtmex_dataset_init (API, GMT_IN, 0, ptr, &actual_family); break;
+	}
+	memset (&R, 0, sizeof (struct GMTMEX_RESIDENT));
+	R.API = API;
+	R.family = family;
+	R.actual_family = actual_family;
+	R.object = object;
+	R.source = source;
+	R.bytes = gmtmex_object_bytes (actual_family, object);
+	gmtmex_add_resident (&R);
+	GMT_Report (API, GMT_MSG_DEBUG, "GMTMEX_Register: Resident %s %" PRIu64 " holds %" PRIu64 " bytes\n",
+	            gmtmex_family_name (family), R.id, (uint64_t)R.bytes);
+	return (gmtmex_resident_handle (&R));
+}
+
+void GMTMEX_Unregister (void *API, const mxArray *ptr) {
+	/* Release a resident object */
+	struct GMTMEX_RESIDENT R;
+	if (!gmtmex_find_resident (ptr, &R))
+		mexErrMsgTxt ("GMTMEX_Unregister: Argument is not a resident object handle\n");
+	if (R.API != API)
+		mexErrMsgTxt ("GMTMEX_Unregister: Resident object belongs to another GMT session\n");
+	if (gmtmex_remove_resident (R.id, API, &R)) gmtmex_free_resident (&R);
+}
+
+void GMTMEX_Free_Residents (void *API) {
+	/* Release all resident objects owned by this session; called before the session is destroyed */
+	struct GMTMEX_RESIDENT R;
+	while (gmtmex_remove_resident (0, API, &R))
+		gmtmex_free_resident (&R);
+}
+
+bool GMTMEX_Is_Resident (void *object) {
+	/* True if object is a resident container that must outlive the module call */
+	unsigned int k;
+	bool found = false;
+	if (object == NULL) return (false);
+	gmtmex_mutex_lock (&resident_lock);
+	for (k = 0; !found && k < n_resident; k++)
+		if (Resident[k].object == object) found = true;
+	gmtmex_mutex_unlock (&resident_lock);
+	return (found);
+}
+
+mxArray *GMTMEX_List_Residents (void *API, bool print) {
+	/* Return a structure array with the handle, family and bytes of every resident object of this session */
+	unsigned int k, n = 0;
+	uint64_t total = 0;
+	const char *fields[3] = {"resident", "family", "bytes"};
+	struct GMTMEX_RESIDENT *Mine = NULL;
+	mxArray *L = NULL, *mx_ptr = NULL;
+
+	gmtmex_mutex_lock (&resident_lock);	/* Copy our entries, since other threads may change the list */
+	if (n_resident && (Mine = malloc (n_resident * sizeof (struct GMTMEX_RESIDENT))) != NULL)
+		for (k = 0; k < n_resident; k++) if (Resident[k].API == API) Mine[n++] = Resident[k];
+	gmtmex_mutex_unlock (&resident_lock);
+	L = mxCreateStructMatrix (n, (n) ? 1 : 0, 3, fields);
+	for (k = 0; k < n; k++) {
+		mx_ptr = mxCreateNumericMatrix (1, 1, mxUINT64_CLASS, mxREAL);
+		*(uint64_t *)mxGetData (mx_ptr) = Mine[k].id;
+		mxSetField (L, k, "resident", mx_ptr);
+		mxSetField (L, k, "family", mxCreateString (gmtmex_family_name (Mine[k].family)));
+		mxSetField (L, k, "bytes", mxCreateDoubleScalar ((double)Mine[k].bytes));
+		if (print) mexPrintf ("%8" PRIu64 "  %-10s  %16" PRIu64 " bytes\n", Mine[k].id,
+		                      gmtmex_family_name (Mine[k].family), (uint64_t)Mine[k].bytes);
+		total += Mine[k].bytes;
+	}
+	free (Mine);
+	if (print) mexPrintf ("%u resident objects holding %" PRIu64 " bytes\n", n, total);
+	return (L);
+}
+
+/* Shared objects: gmt ('share', obj, name) converts obj once and places the GMT container's data in a
+ * named shared memory segment, and h = gmt ('attach', name) maps that segment in any process on the same
+ * host and keeps the container as a resident object, so process-based parallel workers all use one copy.
+ * Grids are stored in GMT layout (padded, rows from the top), images and numeric matrices as they are in
+ * MATLAB.  Workers map the segment copy-on-write, so a module that changes its input (e.g. the pad of a
+ * grid) only gets a private copy of the pages it touches.  A segment exists until gmt ('unshare', name) or
+ * until the MEX file that shared it is cleared; workers keep their mapping until they unregister it. */
+
+#define GMTMEX_SHM_MAGIC	"GMTMEX01"
+#define GMTMEX_SHM_ALIGN	4096	/* Blocks start on page boundaries */
+#define GMTMEX_MAX_SHARED	64	/* Segments shared by one process at a time */
+
+enum GMTMEX_shm_blocks {GMTMEX_SHM_DATA = 0, GMTMEX_SHM_ALPHA, GMTMEX_SHM_X, GMTMEX_SHM_Y, GMTMEX_SHM_N_BLOCKS};
+
+struct GMTMEX_SHM_HEADER {
+	char magic[8];                  /* GMTMEX_SHM_MAGIC */
+	uint32_t family;                /* GMT_IS_GRID, GMT_IS_IMAGE or GMT_IS_DATASET */
+	uint32_t type;                  /* GMT data type of a matrix */
+	uint32_t registration, pad;
+	uint64_t dim[3];                /* n_columns, n_rows, n_bands (matrix: n_rows, n_columns) */
+	double range[6], inc[2];        /* range[4:5] is the z range of grids and images */
+	double nan_value;
+	char mem_layout[4];
+	uint64_t size;                  /* Bytes in the whole segment */
+	uint64_t offset[GMTMEX_SHM_N_BLOCKS], bytes[GMTMEX_SHM_N_BLOCKS];	/* Data, alpha, x, y */
+};
+
+static struct GMTMEX_SHARED {
+	char name[GMT_LEN64];           /* Empty if the slot is free */
+	void *handle;                   /* Keeps the segment alive on Windows */
+} Shared[GMTMEX_MAX_SHARED];	/* Segments created by this process; guarded by resident_lock */
+
+static bool gmtmex_shm_path (const char *name, char *path) {
+	/* Build the system name of segment name; false if name is unsuitable */
+	size_t k, len = strlen (name);
+	if (len == 0 || len >= GMT_LEN64 - 16) return (false);
+	for (k = 0; k < len; k++)
+		if (!(isalnum ((unsigned char)name[k]) || name[k] == '_' || name[k] == '-' || name[k] == '.')) return (false);
+#if defined(WIN32)
+	sprintf (path, "Local\\gmtmex.%s", name);
+#else
+	sprintf (path, "/gmtmex.%s", name);
+#endif
+	return (true);
+}
+
+static void *gmtmex_shm_create (const char *path, size_t size, void **handle) {
+	/* Create a new segment and map it for writing; NULL if it exists already or cannot be made */
+	void *addr = NULL;
+#if defined(WIN32)
+	HANDLE h = CreateFileMappingA (INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)(size & 0xFFFFFFFF), path);
+	if (h == NULL) return (NULL);
+	if (GetLastError () == ERROR_ALREADY_EXISTS || (addr = MapViewOfFile (h, FILE_MAP_WRITE, 0, 0, size)) == NULL) {
+		CloseHandle (h);
+		return (NULL);
+	}
+	*handle = h;
+#else
+	int fd;
+	if ((fd = shm_open (path, O_CREAT | O_EXCL | O_RDWR, 0600)) < 0) return (NULL);
+	if (ftruncate (fd, (off_t)size) || (addr = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		close (fd);
+		shm_unlink (path);
+		return (NULL);
+	}
+	close (fd);	/* The mapping and the name keep the segment */
+	*handle = NULL;
+#endif
+	return (addr);
+}
+
+static void *gmtmex_shm_attach (const char *path, size_t *size) {
+	/* Map an existing segment copy-on-write and return its address and size; NULL if there is none */
+	void *addr = NULL;
+#if defined(WIN32)
+	MEMORY_BASIC_INFORMATION info;
+	HANDLE h = OpenFileMappingA (FILE_MAP_COPY, FALSE, path);
+	if (h == NULL) return (NULL);
+	addr = MapViewOfFile (h, FILE_MAP_COPY, 0, 0, 0);
+	CloseHandle (h);	/* The view keeps the segment */
+	if (addr == NULL || VirtualQuery (addr, &info, sizeof (info)) == 0) return (NULL);
+	*size = info.RegionSize;
+#else
+	int fd;
+	struct stat st;
+	if ((fd = shm_open (path, O_RDONLY, 0)) < 0) return (NULL);
+	if (fstat (fd, &st) || st.st_size < (off_t)sizeof (struct GMTMEX_SHM_HEADER) ||
+	    (addr = mmap (NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		close (fd);
+		return (NULL);
+	}
+	close (fd);
+	*size = (size_t)st.st_size;
+#endif
+	return (addr);
+}
+
+static void gmtmex_shm_unmap (void *addr, size_t size) {
+#if defined(WIN32)
+	UnmapViewOfFile (addr);
+#else
+	munmap (addr, size);
+#endif
+}
+
+static bool gmtmex_shm_remove (const char *path, void *handle) {
+	/* Remove the name of a segment; processes that mapped it keep their mapping */
+#if defined(WIN32)
+	return (handle && CloseHandle (handle));
+#else
+	return (shm_unlink (path) == 0);
+#endif
+}
+
+void GMTMEX_Share (void *API, const mxArray *ptr, const char *name) {
+	/* Convert ptr and place it in the new shared memory segment name */
+	unsigned int family = GMT_IS_DATASET, actual_family, k, slot;
+	uint64_t offset;
+	char path[GMT_LEN64] = {""}, message[BUFSIZ] = {""};
+	const void *src[GMTMEX_SHM_N_BLOCKS] = {NULL, NULL, NULL, NULL};
+	void *object = NULL, *handle = NULL;
+	char *seg = NULL;
+	struct GMTMEX_SHM_HEADER H;
+
+	if (!gmtmex_shm_path (name, path))
+		mexErrMsgTxt ("GMTMEX_Share: Shared object names are 1-47 letters, digits, '_', '-' or '.'\n");
+	switch (GMTMEX_objecttype (ptr)) {
+		case 'g': family = GMT_IS_GRID;  break;
+		case 'i': family = GMT_IS_IMAGE; break;
+		case 'd':
+			if (mxIsNumeric (ptr) && !mxIsComplex (ptr)) break;
+			/* Fall through: dataset structures are not one block of memory */
+		default:
+			mexErrMsgTxt ("GMTMEX_Share: Can only share grids, images and numeric matrices; merge datasets with gmt ('catseg', D, 1) first\n");
+	}
+	memset (&H, 0, sizeof (struct GMTMEX_SHM_HEADER));
+	memcpy (H.magic, GMTMEX_SHM_MAGIC, 8);
+	H.family = family;
+	if (family == GMT_IS_DATASET) {	/* The MATLAB matrix as is */
+		for (k = 0; GMTMEX_matrix_type[k].name && GMTMEX_matrix_type[k].class_id != mxGetClassID (ptr); k++);
+		if (GMTMEX_matrix_type[k].name == NULL)
+			mexErrMsgTxt ("GMTMEX_Share: Unsupported matrix class\n");
+		H.type = GMTMEX_matrix_type[k].type;
+		H.dim[0] = mxGetM (ptr);	H.dim[1] = mxGetN (ptr);
+		src[GMTMEX_SHM_DATA] = mxGetData (ptr);
+		H.bytes[GMTMEX_SHM_DATA] = mxGetNumberOfElements (ptr) * mxGetElementSize (ptr);
+	}
+	else {	/* Let the usual conversion sort out the header */
+		struct GMT_GRID_HEADER *h = NULL;
+		object = GMTMEX_Convert_Input (API, family, 0, ptr, &actual_family);
+		if (family == GMT_IS_GRID) {
+			struct GMT_GRID *G = object;
+			h = G->header;
+			src[GMTMEX_SHM_DATA] = G->data;
+			H.bytes[GMTMEX_SHM_DATA] = h->size * sizeof (gmt_grdfloat);
+		}
+		else {	/* Images reference the MATLAB arrays, whose sizes we take from there */
+			struct GMT_IMAGE *I = object;
+			h = I->header;
+			H.type = I->type;
+			src[GMTMEX_SHM_DATA] = I->data;	H.bytes[GMTMEX_SHM_DATA] = mxGetNumberOfElements (mxGetField (ptr, 0, "image")) * mxGetElementSize (mxGetField (ptr, 0, "image"));
+			if (I->alpha) src[GMTMEX_SHM_ALPHA] = I->alpha, H.bytes[GMTMEX_SHM_ALPHA] = mxGetNumberOfElements (mxGetField (ptr, 0, "alpha"));
+			src[GMTMEX_SHM_X] = I->x;	H.bytes[GMTMEX_SHM_X] = mxGetNumberOfElements (mxGetField (ptr, 0, "x")) * sizeof (double);
+			src[GMTMEX_SHM_Y] = I->y;	H.bytes[GMTMEX_SHM_Y] = mxGetNumberOfElements (mxGetField (ptr, 0, "y")) * sizeof (double);
+		}
+		H.dim[0] = h->n_columns;	H.dim[1] = h->n_rows;	H.dim[2] = h->n_bands;
+		memcpy (H.range, h->wesn, 4 * sizeof (double));
+		H.range[4] = h->z_min;	H.range[5] = h->z_max;
+		memcpy (H.inc, h->inc, 2 * sizeof (double));
+		H.registration = h->registration;
+		H.pad = h->pad[GMT_XLO];
+		H.nan_value = h->nan_value;
+		memcpy (H.mem_layout, h->mem_layout, 4);
+	}
+	for (k = 0, offset = GMTMEX_SHM_ALIGN; k < GMTMEX_SHM_N_BLOCKS; k++) {	/* Lay out the blocks after the header */
+		if (H.bytes[k] == 0) continue;
+		H.offset[k] = offset;
+		offset += ((H.bytes[k] + GMTMEX_SHM_ALIGN - 1) / GMTMEX_SHM_ALIGN) * GMTMEX_SHM_ALIGN;
+	}
+	H.size = offset;
+
+	gmtmex_mutex_lock (&resident_lock);
+	for (slot = 0; slot < GMTMEX_MAX_SHARED && Shared[slot].name[0]; slot++);
+	if (slot < GMTMEX_MAX_SHARED) strcpy (Shared[slot].name, name);	/* Reserve it */
+	gmtmex_mutex_unlock (&resident_lock);
+	if (slot == GMTMEX_MAX_SHARED)
+		snprintf (message, BUFSIZ, "GMTMEX_Share: Too many shared objects; remove some with gmt ('unshare', name)\n");
+	else if ((seg = gmtmex_shm_create (path, (size_t)H.size, &handle)) == NULL)
+		snprintf (message, BUFSIZ, "GMTMEX_Share: Could not create shared object %s of %" PRIu64 " bytes (does it exist already?)\n", name, H.size);
+	else {
+		memcpy (seg, &H, sizeof (struct GMTMEX_SHM_HEADER));
+		for (k = 0; k < GMTMEX_SHM_N_BLOCKS; k++)
+			if (H.bytes[k]) memcpy (&seg[H.offset[k]], src[k], H.bytes[k]);
+		gmtmex_shm_unmap (seg, (size_t)H.size);	/* The workers map it themselves */
+		GMT_Report (API, GMT_MSG_DEBUG, "GMTMEX_Share: Shared %s %s in %" PRIu64 " bytes\n", gmtmex_family_name (family), name, H.size);
+	}
+	gmtmex_mutex_lock (&resident_lock);
+	if (slot < GMTMEX_MAX_SHARED) {
+		if (seg) Shared[slot].handle = handle;
+		else Shared[slot].name[0] = '\0';
+	}
+	gmtmex_mutex_unlock (&resident_lock);
+	if (object) {	/* The temporary conversion */
+		gmtmex_untrack (object);
+		GMT_Destroy_Data (API, &object);
+	}
+	if (message[0]) mexErrMsgTxt (message);
+}
+
+void GMTMEX_Unshare (const char *name) {
+	/* Remove a shared object name.  Any process may remove it on POSIX systems, but on Windows only the one that made it */
+	unsigned int slot;
+	char path[GMT_LEN64] = {""};
+	void *handle = NULL;
+	if (!gmtmex_shm_path (name, path))
+		mexErrMsgTxt ("GMTMEX_Unshare: Not a shared object name\n");
+	gmtmex_mutex_lock (&resident_lock);
+	for (slot = 0; slot < GMTMEX_MAX_SHARED && strcmp (Shared[slot].name, name); slot++);
+	if (slot < GMTMEX_MAX_SHARED) handle = Shared[slot].handle, memset (&Shared[slot], 0, sizeof (struct GMTMEX_SHARED));
+	gmtmex_mutex_unlock (&resident_lock);
+	if (!gmtmex_shm_remove (path, handle))
+		mexErrMsgTxt ("GMTMEX_Unshare: No such shared object, or it was shared by another process\n");
+}
+
+void GMTMEX_Unshare_All (void) {
+	/* Exit function: remove all segments made by this process */
+	unsigned int slot;
+	char path[GMT_LEN64] = {""};
+	for (slot = 0; slot < GMTMEX_MAX_SHARED; slot++) {
+		if (Shared[slot].name[0] == '\0') continue;
+		if (gmtmex_shm_path (Shared[slot].name, path)) gmtmex_shm_remove (path, Shared[slot].handle);
+		memset (&Shared[slot], 0, sizeof (struct GMTMEX_SHARED));
+	}
+}
+
+mxArray *GMTMEX_Attach (void *API, const char *name) {
+	/* Map shared object name and keep a GMT container that uses it in place as a resident object */
+	size_t size = 0;
+	uint64_t k;
+	char path[GMT_LEN64] = {""}, *seg = NULL;
+	struct GMTMEX_SHM_HEADER *H = NULL;
+	struct GMTMEX_RESIDENT R;
+
+	if (!gmtmex_shm_path (name, path))
+		mexErrMsgTxt ("GMTMEX_Attach: Not a shared object name\n");
+	if ((seg = gmtmex_shm_attach (path, &size)) == NULL)
+		mexErrMsgTxt ("GMTMEX_Attach: No such shared object on this host\n");
+	H = (struct GMTMEX_SHM_HEADER *)seg;
+	for (k = 0; k < GMTMEX_SHM_N_BLOCKS && H->offset[k] + H->bytes[k] <= H->size; k++);
+	if (memcmp (H->magic, GMTMEX_SHM_MAGIC, 8) || H->size > size || k < GMTMEX_SHM_N_BLOCKS) {
+		gmtmex_shm_unmap (seg, size);
+		mexErrMsgTxt ("GMTMEX_Attach: Shared object is corrupt or from another GMTMEX version\n");
+	}
+
+	memset (&R, 0, sizeof (struct GMTMEX_RESIDENT));
+	R.API = API;
+	R.family = R.actual_family = H->family;
+	R.mapping = seg;
+	R.bytes = size;
+	switch (H->family) {
+		case GMT_IS_GRID: {
+			struct GMT_GRID *G = NULL;
+			if ((G = GMT_Create_Data (API, GMT_IS_GRID, GMT_IS_SURFACE, GMT_GRID_HEADER_ONLY, NULL, H->range, H->inc,
+			                          H->registration, (int)H->pad, NULL)) != NULL) {
+				if (G->header->n_columns != H->dim[0] || G->header->n_rows != H->dim[1] ||
+				    G->header->size * sizeof (gmt_grdfloat) != H->bytes[GMTMEX_SHM_DATA])
+					GMT_Destroy_Data (API, &G);	/* Made with another pad or increment rounding */
+				else {
+					G->data = (gmt_grdfloat *)&seg[H->offset[GMTMEX_SHM_DATA]];
+					GMT_Set_AllocMode (API, GMT_IS_GRID, G);
+					G->header->z_min = H->range[4];	G->header->z_max = H->range[5];
+					G->header->nan_value = (gmt_grdfloat)H->nan_value;
+					memcpy (G->header->mem_layout, H->mem_layout, 4);
+				}
+			}
+			R.object = G;
+			break;
+		}
+		case GMT_IS_IMAGE: {
+			struct GMT_IMAGE *I = NULL;
+			if ((I = GMT_Create_Data (API, GMT_IS_IMAGE, GMT_IS_SURFACE, GMT_GRID_HEADER_ONLY, H->dim, H->range, H->inc,
+			                          H->registration, (int)H->pad, NULL)) != NULL) {
+				I->type = H->type;
+				I->data = (unsigned char *)&seg[H->offset[GMTMEX_SHM_DATA]];
+				if (H->bytes[GMTMEX_SHM_ALPHA]) I->alpha = (unsigned char *)&seg[H->offset[GMTMEX_SHM_ALPHA]];
+				I->x = (double *)&seg[H->offset[GMTMEX_SHM_X]];
+				I->y = (double *)&seg[H->offset[GMTMEX_SHM_Y]];
+				GMT_Set_AllocMode (API, GMT_IS_IMAGE, I);
+				I->header->z_min = H->range[4];	I->header->z_max = H->range[5];
+				I->header->nan_value = (gmt_grdfloat)H->nan_value;
+				memcpy (I->header->mem_layout, H->mem_layout, 4);
+			}
+			R.object = I;
+			break;
+		}
+		case GMT_IS_DATASET: {
+			struct GMT_MATRIX *M = NULL;
+			uint64_t dim[4] = {0, 0, 0, 0};
+			dim[DIM_ROW] = H->dim[0];	dim[DIM_COL] = H->dim[1];
+			R.actual_family |= GMT_VIA_MATRIX;
+			if ((M = GMT_Create_Data (API, GMT_IS_DATASET|GMT_VIA_MATRIX, GMT_IS_PLP, GMT_CONTAINER_ONLY, dim, NULL, NULL, 0, 0, NULL)) != NULL &&
+			    GMT_Put_Matrix (API, M, H->type, 0, &seg[H->offset[GMTMEX_SHM_DATA]]) != GMT_NOERROR)
+				GMT_Destroy_Data (API, &M);
+			if (M) {
+				M->dim = M->n_rows;	/* Shared in column order */
+				M->shape = MEX_COL_ORDER;
+			}
+			R.object = M;
+			break;
+		}
+		default: break;
+	}
+	if (R.object == NULL) {
+		gmtmex_shm_unmap (seg, size);
+		mexErrMsgTxt ("GMTMEX_Attach: Failure to make a GMT container for the shared object\n");
+	}
+	gmtmex_add_resident (&R);
+	GMT_Report (API, GMT_MSG_DEBUG, "GMTMEX_Attach: Resident %s %" PRIu64 " maps shared object %s\n",
+	            gmtmex_family_name (R.family), R.id, name);
+	return (gmtmex_resident_handle (&R));
+}
+
+/* Native files: gmt ('save', obj, file) writes a grid, image, dataset, palette or PostScript structure, or a
+ * plain matrix, to a simple self-describing binary file, and gmt ('load', file) maps the file and rebuilds the
+ * object with one copy per array, without parsing or decompression.  The file is a header followed by one
+ * item per MATLAB array in depth-first order: numeric, logical and char arrays are stored raw in MATLAB order,
+ * which for matrices and images is also the layout GMT uses when we pass them by reference, and cells and
+ * structures are followed by their items.  Items start on 8-byte boundaries and array data on 64-byte ones.
+ * h = gmt ('load', file, 'resident') keeps the object in the session as gmt ('register', ...) does; numeric
+ * matrices and images then use the mapped file in place, while other objects are converted once. */
+
+#define GMTMEX_FILE_MAGIC	"GMTMEXF1"
+#define GMTMEX_FILE_ENDIAN	0x01020304	/* As written by this host */
+#define GMTMEX_FILE_ALIGN	64	/* Array data starts on cache line boundaries */
+#define GMTMEX_FILE_MAX_DIMS	4
+#define GMTMEX_FILE_NAME_LEN	64	/* Bytes per field name */
+#define GMTMEX_FILE_MAX_FIELDS	64
+#define GMTMEX_FILE_MAX_DEPTH	16
+#define GMTMEX_FILE_MAX_TOP	32	/* Fields of the top structure whose data offsets we note */
+
+enum GMTMEX_file_kinds {GMTMEX_FILE_EMPTY = 0, GMTMEX_FILE_NUMERIC, GMTMEX_FILE_LOGICAL, GMTMEX_FILE_CHAR, GMTMEX_FILE_CELL, GMTMEX_FILE_STRUCT};
+
+struct GMTMEX_FILE_HEADER {
+	char magic[8];                  /* GMTMEX_FILE_MAGIC */
+	uint32_t family;                /* GMT family of the object */
+	uint32_t endian;                /* GMTMEX_FILE_ENDIAN, to reject files from hosts of the other byte order */
+	uint64_t size;                  /* Bytes in the whole file */
+};
+
+struct GMTMEX_FILE_ITEM {
+	uint32_t kind;                  /* One of GMTMEX_file_kinds */
+	uint32_t type;                  /* Entry in GMTMEX_matrix_type of a numeric array */
+	uint32_t n_dims, n_fields;      /* Dimensions and, for structures, number of fields */
+	uint64_t dim[GMTMEX_FILE_MAX_DIMS];
+	uint64_t bytes;                 /* Bytes of array data, or of the field names of a structure */
+	uint64_t offset;                /* Where the array data starts in the file */
+};
+
+struct GMTMEX_FILE_WRITER {
+	FILE *fp;
+	uint64_t pos;                   /* Bytes written so far */
+	char message[GMT_LEN256];       /* Set on the first failure */
+};
+
+struct GMTMEX_FILE_READER {
+	const char *base;               /* The mapped file */
+	uint64_t size, pos;             /* Its size and where the next item starts */
+	uint64_t last_offset;           /* Data offset of the last array read */
+	uint64_t top[GMTMEX_FILE_MAX_TOP];	/* Data offsets of the arrays in the fields of the top structure (first element) */
+	bool bad;                       /* The file is corrupt */
+};
+
+static void gmtmex_file_write (struct GMTMEX_FILE_WRITER *W, const void *data, uint64_t bytes) {
+	if (bytes && !W->message[0] && fwrite (data, 1, bytes, W->fp) != bytes)
+		snprintf (W->message, GMT_LEN256, "GMTMEX_Save: Failure writing the file\n");
+	W->pos += bytes;
+}
+
+static void gmtmex_file_pad (struct GMTMEX_FILE_WRITER *W, uint64_t align) {
+	/* Write zeros up to the next multiple of align */
+	static const char zero[GMTMEX_FILE_ALIGN] = {0};
+	gmtmex_file_write (W, zero, (align - W->pos % align) % align);
+}
+
+static void gmtmex_file_put (struct GMTMEX_FILE_WRITER *W, const mxArray *ptr, unsigned int depth) {
+	/* Write one MATLAB array and, for cells and structures, everything in it */
+	unsigned int k;
+	uint64_t n, e;
+	char name[GMTMEX_FILE_NAME_LEN];
+	struct GMTMEX_FILE_ITEM item;
+
+	if (W->message[0]) return;	/* Already failed */
+	memset (&item, 0, sizeof (struct GMTMEX_FILE_ITEM));
+	if (ptr == NULL) {	/* An empty structure field */
+		gmtmex_file_write (W, &item, sizeof (struct GMTMEX_FILE_ITEM));
+		return;
+	}
+	if (depth > GMTMEX_FILE_MAX_DEPTH || mxGetNumberOfDimensions (ptr) > GMTMEX_FILE_MAX_DIMS) {
+		snprintf (W->message, GMT_LEN256, "GMTMEX_Save: Object is nested too deeply or has more than %d dimensions\n", GMTMEX_FILE_MAX_DIMS);
+		return;
+	}
+	item.n_dims = (uint32_t)mxGetNumberOfDimensions (ptr);
+	for (k = 0; k < item.n_dims; k++) item.dim[k] = mxGetDimensions (ptr)[k];
+	n = mxGetNumberOfElements (ptr);
+	if (mxIsStruct (ptr)) {
+		item.kind = GMTMEX_FILE_STRUCT;
+		if ((item.n_fields = mxGetNumberOfFields (ptr)) > GMTMEX_FILE_MAX_FIELDS) {
+			snprintf (W->message, GMT_LEN256, "GMTMEX_Save: Structures may have at most %d fields\n", GMTMEX_FILE_MAX_FIELDS);
+			return;
+		}
+		item.bytes = (uint64_t)item.n_fields * GMTMEX_FILE_NAME_LEN;
+		gmtmex_file_write (W, &item, sizeof (struct GMTMEX_FILE_ITEM));
+		for (k = 0; k < item.n_fields; k++) {
+			memset (name, 0, GMTMEX_FILE_NAME_LEN);
+			strncpy (name, mxGetFieldNameByNumber (ptr, k), GMTMEX_FILE_NAME_LEN - 1);
+			gmtmex_file_write (W, name, GMTMEX_FILE_NAME_LEN);
+		}
+		for (e = 0; e < n; e++)
+			for (k = 0; k < item.n_fields; k++) gmtmex_file_put (W, mxGetFieldByNumber (ptr, (mwIndex)e, k), depth + 1);
+	}
+	else if (mxIsCell (ptr)) {
+		item.kind = GMTMEX_FILE_CELL;
+		gmtmex_file_write (W, &item, sizeof (struct GMTMEX_FILE_ITEM));
+		for (e = 0; e < n; e++) gmtmex_file_put (W, mxGetCell (ptr, (mwIndex)e), depth + 1);
+	}
+	else if (mxIsChar (ptr) || mxIsLogical (ptr) || (mxIsNumeric (ptr) && !mxIsComplex (ptr) && !mxIsSparse (ptr))) {
+		if (mxIsChar (ptr))
+			item.kind = GMTMEX_FILE_CHAR;
+		else if (mxIsLogical (ptr))
+			item.kind = GMTMEX_FILE_LOGICAL;
+		else {
+			item.kind = GMTMEX_FILE_NUMERIC;
+			for (k = 0; GMTMEX_matrix_type[k].name && GMTMEX_matrix_type[k].class_id != mxGetClassID (ptr); k++);
+			item.type = k;
+		}
+		item.bytes = n * mxGetElementSize (ptr);
+		item.offset = W->pos + sizeof (struct GMTMEX_FILE_ITEM);
+		item.offset = ((item.offset + GMTMEX_FILE_ALIGN - 1) / GMTMEX_FILE_ALIGN) * GMTMEX_FILE_ALIGN;
+		gmtmex_file_write (W, &item, sizeof (struct GMTMEX_FILE_ITEM));
+		gmtmex_file_pad (W, GMTMEX_FILE_ALIGN);
+		gmtmex_file_write (W, mxGetData (ptr), item.bytes);
+		gmtmex_file_pad (W, 8);
+	}
+	else
+		snprintf (W->message, GMT_LEN256, "GMTMEX_Save: Cannot save %s arrays (complex, sparse, objects, ...)\n", mxGetClassName (ptr));
+}
+
+void GMTMEX_Save (const mxArray *ptr, const char *file) {
+	/* Write ptr to the native file file */
+	struct GMTMEX_FILE_HEADER H;
+	struct GMTMEX_FILE_WRITER W;
+
+	memset (&H, 0, sizeof (struct GMTMEX_FILE_HEADER));
+	memcpy (H.magic, GMTMEX_FILE_MAGIC, 8);
+	H.endian = GMTMEX_FILE_ENDIAN;
+	switch (GMTMEX_objecttype (ptr)) {	/* Also rejects structures that are not gmtmex objects */
+		case 'g': H.family = GMT_IS_GRID;       break;
+		case 'i': H.family = GMT_IS_IMAGE;      break;
+		case 'c': H.family = GMT_IS_PALETTE;    break;
+		case 'p': H.family = GMT_IS_POSTSCRIPT; break;
+		default:  H.family = GMT_IS_DATASET;    break;
+	}
+	memset (&W, 0, sizeof (struct GMTMEX_FILE_WRITER));
+	if ((W.fp = fopen (file, "wb")) == NULL)
+		mexErrMsgTxt ("GMTMEX_Save: Cannot create the file\n");
+	gmtmex_file_write (&W, &H, sizeof (struct GMTMEX_FILE_HEADER));
+	gmtmex_file_put (&W, ptr, 0);
+	H.size = W.pos;	/* Now we know it */
+	if (!W.message[0] && (fseek (W.fp, 0, SEEK_SET) || fwrite (&H, sizeof (struct GMTMEX_FILE_HEADER), 1, W.fp) != 1))
+		snprintf (W.message, GMT_LEN256, "GMTMEX_Save: Failure writing the file\n");
+	if (fclose (W.fp) && !W.message[0])
+		snprintf (W.message, GMT_LEN256, "GMTMEX_Save: Failure writing the file\n");
+	if (W.message[0]) {	/* Leave no partial file behind */
+		remove (file);
+		mexErrMsgTxt (W.message);
+	}
+}
+
+static void *gmtmex_map_file (const char *file, size_t *size) {
+	/* Map a whole file copy-on-write and return its address and size; NULL if it cannot be read */
+	void *addr = NULL;
+#if defined(WIN32)
+	LARGE_INTEGER len;
+	HANDLE fh, h = NULL;
+	len.QuadPart = 0;
+	if ((fh = CreateFileA (file, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL)) == INVALID_HANDLE_VALUE)
+		return (NULL);
+	if (GetFileSizeEx (fh, &len) && len.QuadPart >= (LONGLONG)sizeof (struct GMTMEX_FILE_HEADER) &&
+	    (h = CreateFileMappingA (fh, NULL, PAGE_WRITECOPY, 0, 0, NULL)) != NULL &&
+	    (addr = MapViewOfFile (h, FILE_MAP_COPY, 0, 0, 0)) != NULL)
+		*size = (size_t)len.QuadPart;
+	if (h) CloseHandle (h);	/* The view keeps the file mapped */
+	CloseHandle (fh);
+#else
+	int fd;
+	struct stat st;
+	if ((fd = open (file, O_RDONLY)) < 0) return (NULL);
+	if (fstat (fd, &st) || st.st_size < (off_t)sizeof (struct GMTMEX_FILE_HEADER) ||
+	    (addr = mmap (NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+		addr = NULL;
+	else
+		*size = (size_t)st.st_size;
+	close (fd);
+#endif
+	return (addr);
+}
+
+static mxArray *gmtmex_file_get (struct GMTMEX_FILE_READER *F, unsigned int depth) {
+	/* Rebuild the MATLAB array at the current position.  Empty fields give NULL; a corrupt file sets F->bad */
+	unsigned int k;
+	uint64_t n = 1, e;
+	mwSize dim[GMTMEX_FILE_MAX_DIMS];
+	const char *names[GMTMEX_FILE_MAX_FIELDS];
+	mxArray *out = NULL, *child = NULL;
+	struct GMTMEX_FILE_ITEM item;
+
+	if (F->bad || depth > GMTMEX_FILE_MAX_DEPTH || F->pos + sizeof (struct GMTMEX_FILE_ITEM) > F->size) {
+		F->bad = true;
+		return (NULL);
+	}
+	memcpy (&item, F->base + F->pos, sizeof (struct GMTMEX_FILE_ITEM));
+	F->pos += sizeof (struct GMTMEX_FILE_ITEM);
+	if (item.kind == GMTMEX_FILE_EMPTY) return (NULL);
+	if (item.n_dims < 2 || item.n_dims > GMTMEX_FILE_MAX_DIMS) {
+		F->bad = true;
+		return (NULL);
+	}
+	for (k = 0; k < item.n_dims; k++) {
+		dim[k] = (mwSize)item.dim[k];
+		if (item.dim[k] && n > F->size / item.dim[k]) F->bad = true;	/* No array has more elements than the file has bytes */
+		else n *= item.dim[k];
+	}
+	if (F->bad) return (NULL);
+	switch (item.kind) {
+		case GMTMEX_FILE_NUMERIC: case GMTMEX_FILE_LOGICAL: case GMTMEX_FILE_CHAR:
+			if (item.kind == GMTMEX_FILE_NUMERIC && item.type >= sizeof (GMTMEX_matrix_type) / sizeof (GMTMEX_matrix_type[0]) - 1) break;
+			if (item.offset % GMTMEX_FILE_ALIGN || item.offset < F->pos || item.offset > F->size || item.bytes > F->size - item.offset) break;
+			if (item.kind == GMTMEX_FILE_NUMERIC)
+				out = mxCreateNumericArray ((mwSize)item.n_dims, dim, GMTMEX_matrix_type[item.type].class_id, mxREAL);
+			else if (item.kind == GMTMEX_FILE_LOGICAL)
+				out = mxCreateLogicalArray ((mwSize)item.n_dims, dim);
+			else
+				out = mxCreateCharArray ((mwSize)item.n_dims, dim);
+			if (item.bytes != n * mxGetElementSize (out)) {
+				mxDestroyArray (out);
+				out = NULL;
+				break;
+			}
+			memcpy (mxGetData (out), F->base + item.offset, item.bytes);
+			F->last_offset = item.offset;
+			F->pos = ((item.offset + item.bytes + 7) / 8) * 8;
+			return (out);
+		case GMTMEX_FILE_CELL:
+			out = mxCreateCellArray ((mwSize)item.n_dims, dim);
+			for (e = 0; e < n && !F->bad; e++)
+				if ((child = gmtmex_file_get (F, depth + 1)) != NULL) mxSetCell (out, (mwIndex)e, child);
+			if (!F->bad) return (out);
+			break;
+		case GMTMEX_FILE_STRUCT:
+			if (item.n_fields > GMTMEX_FILE_MAX_FIELDS || item.bytes != (uint64_t)item.n_fields * GMTMEX_FILE_NAME_LEN ||
+			    item.bytes > F->size - F->pos) break;
+			for (k = 0; k < item.n_fields; k++) {
+				names[k] = F->base + F->pos + k * GMTMEX_FILE_NAME_LEN;
+				if (names[k][GMTMEX_FILE_NAME_LEN-1]) break;	/* Not NUL-terminated */
+			}
+			if (k < item.n_fields) break;
+			F->pos += item.bytes;
+			out = mxCreateStructArray ((mwSize)item.n_dims, dim, (int)item.n_fields, names);
+			for (e = 0; e < n && !F->bad; e++) {
+				for (k = 0; k < item.n_fields && !F->bad; k++) {
+					F->last_offset = 0;
+					if ((child = gmtmex_file_get (F, depth + 1)) != NULL) mxSetFieldByNumber (out, (mwIndex)e, (int)k, child);
+					if (depth == 0 && e == 0 && k < GMTMEX_FILE_MAX_TOP) F->top[k] = F->last_offset;
+				}
+			}
+			if (!F->bad) return (out);
+			break;
+		default: break;
+	}
+	if (out) mxDestroyArray (out);
+	F->bad = true;
+	return (NULL);
+}
+
+mxArray *GMTMEX_Load (void *API, const char *file, bool resident) {
+	/* Read the native file file and return its object, or a handle to it as a resident object */
+	size_t size = 0;
+	char *base = NULL;
+	mxArray *out = NULL, *handle = NULL;
+	struct GMTMEX_FILE_HEADER H;
+	struct GMTMEX_FILE_ITEM item;
+	struct GMTMEX_FILE_READER F;
+	struct GMTMEX_RESIDENT R;
+
+	if ((base = gmtmex_map_file (file, &size)) == NULL)
+		mexErrMsgTxt ("GMTMEX_Load: Cannot open or map the file\n");
+	memcpy (&H, base, sizeof (struct GMTMEX_FILE_HEADER));
+	if (memcmp (H.magic, GMTMEX_FILE_MAGIC, 8) || H.endian != GMTMEX_FILE_ENDIAN || H.size > size) {
+		gmtmex_shm_unmap (base, size);
+		mexErrMsgTxt ("GMTMEX_Load: Not a gmtmex native file, or one from another GMTMEX version or byte order\n");
+	}
+	memset (&F, 0, sizeof (struct GMTMEX_FILE_READER));
+	F.base = base;	F.size = H.size;	F.pos = sizeof (struct GMTMEX_FILE_HEADER);
+	memset (&R, 0, sizeof (struct GMTMEX_RESIDENT));
+	R.API = API;	R.family = R.actual_family = H.family;
+	memset (&item, 0, sizeof (struct GMTMEX_FILE_ITEM));	/* The first item, to see if it is a plain matrix */
+	if (F.pos + sizeof (struct GMTMEX_FILE_ITEM) <= F.size) memcpy (&item, base + F.pos, sizeof (struct GMTMEX_FILE_ITEM));
+
+	if (resident && H.family == GMT_IS_DATASET && item.kind == GMTMEX_FILE_NUMERIC && item.n_dims == 2 &&
+	    item.dim[0] <= F.size && item.dim[1] <= F.size && item.offset % GMTMEX_FILE_ALIGN == 0 &&
+	    item.type < sizeof (GMTMEX_matrix_type) / sizeof (GMTMEX_matrix_type[0]) - 1 && item.offset <= F.size &&
+	    item.bytes <= F.size - item.offset && item.bytes == item.dim[0] * item.dim[1] * gmtmex_type_size (GMTMEX_matrix_type[item.type].type)) {
+		/* A plain matrix: GMT uses the mapped file in place, as for a shared matrix */
+		struct GMT_MATRIX *M = NULL;
+		uint64_t dim[4] = {0, 0, 0, 0};
+		dim[DIM_ROW] = item.dim[0];	dim[DIM_COL] = item.dim[1];
+		R.actual_family |= GMT_VIA_MATRIX;
+		if ((M = GMT_Create_Data (API, GMT_IS_DATASET|GMT_VIA_MATRIX, GMT_IS_PLP, GMT_CONTAINER_ONLY, dim, NULL, NULL, 0, 0, NULL)) != NULL &&
+		    GMT_Put_Matrix (API, M, GMTMEX_matrix_type[item.type].type, 0, base + item.offset) != GMT_NOERROR)
+			GMT_Destroy_Data (API, &M);
+		if (M == NULL) {
+			gmtmex_shm_unmap (base, size);
+			mexErrMsgTxt ("GMTMEX_Load: Failure to make a GMT container for the file\n");
+		}
+		M->dim = M->n_rows;	/* Saved in column order */
+		M->shape = MEX_COL_ORDER;
+		R.object = M;	R.mapping = base;	R.bytes = size;
+		gmtmex_add_resident (&R);
+		return (gmtmex_resident_handle (&R));
+	}
+
+	out = gmtmex_file_get (&F, 0);
+	if (F.bad || out == NULL) {
+		if (out) mxDestroyArray (out);
+		gmtmex_shm_unmap (base, size);
+		mexErrMsgTxt ("GMTMEX_Load: The file is corrupt\n");
+	}
+	if (resident && H.family == GMT_IS_IMAGE && mxIsStruct (out)) {	/* Let GMT use the mapped image data in place */
+		int f_image = mxGetFieldNumber (out, "image"), f_alpha = mxGetFieldNumber (out, "alpha");
+		int f_x = mxGetFieldNumber (out, "x"), f_y = mxGetFieldNumber (out, "y");
+		struct GMT_IMAGE *I = NULL;
+		if (f_image >= 0 && f_image < GMTMEX_FILE_MAX_TOP && F.top[f_image] && f_x >= 0 && f_x < GMTMEX_FILE_MAX_TOP && F.top[f_x] &&
+		    f_y >= 0 && f_y < GMTMEX_FILE_MAX_TOP && F.top[f_y] && (I = gmtmex_image_init (API, GMT_IN, 0, out)) != NULL) {
+			I->data = (unsigned char *)base + F.top[f_image];
+			if (I->alpha) I->alpha = (f_alpha >= 0 && f_alpha < GMTMEX_FILE_MAX_TOP && F.top[f_alpha]) ? (unsigned char *)base + F.top[f_alpha] : NULL;
+			I->x = (double *)(base + F.top[f_x]);
+			I->y = (double *)(base + F.top[f_y]);
+			mxDestroyArray (out);
+			R.object = I;	R.mapping = base;	R.bytes = size;
+			gmtmex_add_resident (&R);
+			return (gmtmex_resident_handle (&R));
+		}
+	}
+	gmtmex_shm_unmap (base, size);	/* We have our own copy now */
+	if (!resident) return (out);
+	handle = GMTMEX_Register (API, out);	/* Other objects are converted once */
+	mxDestroyArray (out);
+	return (handle);
+}
+
+/* Staging buffers: after gmt ('staging', 'on') the padded float arrays of input grids are taken from a pool of
+ * anonymous mappings instead of being allocated by GMT on every call.  The mappings are rounded up to whole
+ * huge pages and marked for transparent huge pages, are touched once when made with 'prefault', and are kept
+ * for later calls up to the keep size.  Only synchronous module calls stage their grids, since the grids of
+ * jobs, workers and resident objects outlive the call. */
+
+#define GMTMEX_MAX_STAGES	16
+#define GMTMEX_STAGE_PAGE	(2 * 1024 * 1024)	/* Size of a transparent huge page on x86-64 and arm64 */
+
+enum GMTMEX_Stage_Mode {
+	GMTMEX_STAGE_OFF = 0,
+	GMTMEX_STAGE_ON,
+	GMTMEX_STAGE_PREFAULT};
+
+static const char *GMTMEX_stage_mode_name[3] = {"off", "on", "prefault"};
+
+static struct GMTMEX_STAGE {
+	char *addr;                     /* Start of the mapping, or NULL if the slot is free */
+	size_t bytes;                   /* Size of the mapping */
+	bool busy;                      /* Lent to a grid of the current call */
+	uint64_t last_use;              /* For dropping the least recently used idle mapping */
+} Stage[GMTMEX_MAX_STAGES];	/* Guarded by stage_lock */
+static unsigned int stage_mode = GMTMEX_STAGE_OFF;
+static size_t stage_keep = 1024 * 1024 * 1024;	/* Bytes of idle mappings kept between calls */
+static uint64_t stage_clock = 0, stage_maps = 0, stage_reuses = 0;
+static gmtmex_mutex_t stage_lock = GMTMEX_MUTEX_INITIALIZER;
+static GMTMEX_TLS bool gmtmex_staging = false;	/* true while this thread runs a call that may stage its grids */
+static GMTMEX_TLS unsigned int stage_lent[GMTMEX_MAX_STAGES], n_lent = 0;	/* Slots lent to the call of this thread */
+
+static char *gmtmex_stage_map (size_t bytes, bool prefault) {
+	/* Make an anonymous mapping of bytes; NULL on failure */
+	char *addr = NULL;
+	size_t k;
+#if defined(WIN32)
+	if ((addr = VirtualAlloc (NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE)) == NULL) return (NULL);
+#else
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_POPULATE
+	if (prefault) flags |= MAP_POPULATE;
+#endif
+	if ((addr = mmap (NULL, bytes, PROT_READ | PROT_WRITE, flags, -1, 0)) == MAP_FAILED) return (NULL);
+#ifdef MADV_HUGEPAGE
+	madvise (addr, bytes, MADV_HUGEPAGE);	/* Only advice; the kernel may ignore it */
+#endif
+#endif
+	if (prefault)	/* Fault in every page now rather than during the conversion (a no-op after MAP_POPULATE) */
+		for (k = 0; k < bytes; k += 4096) addr[k] = 0;
+	return (addr);
+}
+
+static void gmtmex_stage_unmap (struct GMTMEX_STAGE *S) {
+#if defined(WIN32)
+	VirtualFree (S->addr, 0, MEM_RELEASE);
+#else
+	munmap (S->addr, S->bytes);
+#endif
+	memset (S, 0, sizeof (struct GMTMEX_STAGE));
+}
+
+static void gmtmex_stage_trim (size_t keep) {
+	/* Drop the least recently used idle mappings until at most keep bytes are idle.  Caller holds stage_lock */
+	unsigned int k, lru;
+	size_t idle;
+	while (1) {
+		for (k = 0, idle = 0, lru = GMTMEX_MAX_STAGES; k < GMTMEX_MAX_STAGES; k++) {
+			if (Stage[k].addr == NULL || Stage[k].busy) continue;
+			idle += Stage[k].bytes;
+			if (lru == GMTMEX_MAX_STAGES || Stage[k].last_use < Stage[lru].last_use) lru = k;
+		}
+		if (idle <= keep || lru == GMTMEX_MAX_STAGES) return;
+		gmtmex_stage_unmap (&Stage[lru]);
+	}
+}
+
+static void *gmtmex_stage_get (size_t size) {
+	/* Lend a buffer of at least size bytes to the current call; NULL if staging is off or none can be had */
+	unsigned int k, best = GMTMEX_MAX_STAGES, empty = GMTMEX_MAX_STAGES;
+	size_t bytes = (size + GMTMEX_STAGE_PAGE - 1) / GMTMEX_STAGE_PAGE * GMTMEX_STAGE_PAGE;
+	char *addr = NULL;
+	if (!gmtmex_staging || size == 0) return (NULL);
+	gmtmex_mutex_lock (&stage_lock);
+	for (k = 0; k < GMTMEX_MAX_STAGES; k++) {	/* The smallest idle mapping that is large enough */
+		if (Stage[k].addr == NULL) {
+			if (empty == GMTMEX_MAX_STAGES) empty = k;
+		}
+		else if (!Stage[k].busy && Stage[k].bytes >= bytes && (best == GMTMEX_MAX_STAGES || Stage[k].bytes < Stage[best].bytes))
+			best = k;
+	}
+	if (best == GMTMEX_MAX_STAGES) {	/* Make a new one, after dropping idle ones that are too small to reuse */
+		gmtmex_stage_trim ((stage_keep > bytes) ? stage_keep - bytes : 0);
+		for (k = 0; empty == GMTMEX_MAX_STAGES && k < GMTMEX_MAX_STAGES; k++)
+			if (Stage[k].addr == NULL) empty = k;
+		if (empty < GMTMEX_MAX_STAGES && (addr = gmtmex_stage_map (bytes, stage_mode == GMTMEX_STAGE_PREFAULT)) != NULL) {
+			Stage[empty].addr = addr;	Stage[empty].bytes = bytes;
+			best = empty;
+			stage_maps++;
+		}
+	}
+	else
+		stage_reuses++;
+	if (best < GMTMEX_MAX_STAGES) {
+		stage_lent[n_lent++] = best;	/* At most GMTMEX_MAX_STAGES since busy slots are never lent twice */
+		Stage[best].busy = true;
+		Stage[best].last_use = ++stage_clock;
+		addr = Stage[best].addr;
+	}
+	gmtmex_mutex_unlock (&stage_lock);
+	return (addr);
+}
+
+void GMTMEX_Stage_Begin (bool synchronous) {
+	/* A module call starts converting its inputs; only synchronous calls may stage them */
+	gmtmex_mutex_lock (&stage_lock);
+	gmtmex_staging = synchronous && stage_mode != GMTMEX_STAGE_OFF;
+	gmtmex_mutex_unlock (&stage_lock);
+}
+
+void GMTMEX_Stage_End (void) {
+	/* The grids of the call have been destroyed, so its buffers go back to the pool */
+	unsigned int k;
+	if (!gmtmex_staging) return;
+	gmtmex_staging = false;
+	gmtmex_mutex_lock (&stage_lock);
+	for (k = 0; k < n_lent; k++) Stage[stage_lent[k]].busy = false;
+	n_lent = 0;
+	gmtmex_stage_trim (stage_keep);
+	gmtmex_mutex_unlock (&stage_lock);
+}
+
+void GMTMEX_Stage_Flush (void) {
+	/* Drop every idle mapping */
+	gmtmex_mutex_lock (&stage_lock);
+	gmtmex_stage_trim (0);
+	gmtmex_mutex_unlock (&stage_lock);
+}
+
+static struct GMT_GRID *gmtmex_new_grid (void *API, unsigned int flag, double *range, double *inc, unsigned int registration, int pad) {
+	/* Create an input grid whose padded array is a staging buffer when the call may stage, else allocated by GMT */
+	uint64_t row;
+	void *data = NULL;
+	struct GMT_GRID *G = NULL;
+	struct GMT_GRID_HEADER *h = NULL;
+	if (!gmtmex_staging)
+		return (GMT_Create_Data (API, GMT_IS_GRID|flag, GMT_IS_SURFACE, GMT_GRID_ALL, NULL, range, inc, registration, pad, NULL));
+	if ((G = GMT_Create_Data (API, GMT_IS_GRID|flag, GMT_IS_SURFACE, GMT_GRID_HEADER_ONLY, NULL, range, inc, registration, pad, NULL)) == NULL)
+		return (NULL);
+	h = G->header;
+	if ((data = gmtmex_stage_get (h->size * sizeof (gmt_grdfloat))) == NULL)	/* Fall back to a GMT array */
+		return (GMT_Create_Data (API, GMT_IS_GRID|flag, GMT_IS_SURFACE, GMT_GRID_DATA_ONLY, NULL, NULL, NULL, 0, 0, G));
+	G->data = data;
+	GMT_Set_AllocMode (API, GMT_IS_GRID, G);	/* The pool owns the array */
+	/* A reused buffer holds the last call's grid, so clear the pad as GMT would; the interior is copied in full */
+	memset (G->data, 0, (size_t)h->pad[GMT_YHI] * h->mx * sizeof (gmt_grdfloat));
+	memset (&G->data[(uint64_t)(h->pad[GMT_YHI] + h->n_rows) * h->mx], 0, (size_t)h->pad[GMT_YLO] * h->mx * sizeof (gmt_grdfloat));
+	for (row = 0; row < h->n_rows; row++) {
+		memset (&G->data[(row + h->pad[GMT_YHI]) * h->mx], 0, h->pad[GMT_XLO] * sizeof (gmt_grdfloat));
+		memset (&G->data[(row + h->pad[GMT_YHI]) * h->mx + h->pad[GMT_XLO] + h->n_columns], 0, h->pad[GMT_XHI] * sizeof (gmt_grdfloat));
+	}
+	return (G);
+}
+
+mxArray *GMTMEX_Staging (int nrhs, const mxArray *prhs[]) {
+	/* gmt ('staging', 'off' | 'on' | 'prefault'[, keep]) selects how input grids are allocated and how many bytes of
+	 * idle buffers are kept; both, and S = gmt ('staging'), return the settings, the pool and the minor page faults
+	 * of the process so far */
+	unsigned int k, mode;
+	char what[GMT_LEN16] = {""};
+	const char *fields[7] = {"mode", "keep", "bytes", "buffers", "maps", "reuses", "minor_faults"};
+	double v[7], faults = 0.0;
+	mxArray *S = NULL;
+#if !defined(WIN32)
+	struct rusage usage;
+	if (getrusage (RUSAGE_SELF, &usage) == 0) faults = (double)usage.ru_minflt;
+#endif
+	if (nrhs >= 1) {
+		if (!mxIsChar (prhs[0]) || mxGetString (prhs[0], what, GMT_LEN16))
+			mexErrMsgTxt ("GMTMEX_Staging: Usage is gmt ('staging', 'off' | 'on' | 'prefault'[, keep])\n");
+		for (mode = 0; mode < 3 && strcmp (what, GMTMEX_stage_mode_name[mode]); mode++);
+		if (mode == 3)
+			mexErrMsgTxt ("GMTMEX_Staging: Unknown staging mode; use off, on or prefault\n");
+		if (nrhs == 2 && (!mxIsNumeric (prhs[1]) || mxGetNumberOfElements (prhs[1]) != 1 || mxGetScalar (prhs[1]) < 0.0))
+			mexErrMsgTxt ("GMTMEX_Staging: The keep size must be a number of bytes\n");
+		gmtmex_mutex_lock (&stage_lock);
+		stage_mode = mode;
+		if (nrhs == 2) stage_keep = (size_t)mxGetScalar (prhs[1]);
+		gmtmex_stage_trim ((mode == GMTMEX_STAGE_OFF) ? 0 : stage_keep);
+		gmtmex_mutex_unlock (&stage_lock);
+	}
+	gmtmex_mutex_lock (&stage_lock);
+	mode = stage_mode;
+	v[1] = (double)stage_keep;	v[2] = v[3] = 0.0;
+	for (k = 0; k < GMTMEX_MAX_STAGES; k++)
+		if (Stage[k].addr) v[2] += (double)Stage[k].bytes, v[3] += 1.0;
+	v[4] = (double)stage_maps;	v[5] = (double)stage_reuses;	v[6] = faults;
+	gmtmex_mutex_unlock (&stage_lock);
+	S = mxCreateStructMatrix (1, 1, 7, fields);
+	mxSetField (S, 0, fields[0], mxCreateString (GMTMEX_stage_mode_name[mode]));
+	for (k = 1; k < 7; k++) mxSetField (S, 0, fields[k], mxCreateDoubleScalar (v[k]));
+	return (S);
+}
+
+/* Memory accounting: every conversion between MATLAB and GMT adds to a per-call and a cumulative
+ * tally of bytes copied, bytes passed by reference (aliased), containers or arrays allocated, and
+ * the peak of the memory held at once by the conversions of a single call.  gmt ('memstats')
+ * returns the tallies, while -V reports every input that had to be copied and why. */
+
+enum GMTMEX_conversions {	/* One counter per conversion function */
+	GMTMEX_GRID_INIT = 0, GMTMEX_IMAGE_INIT, GMTMEX_DATASET_INIT, GMTMEX_PALETTE_INIT, GMTMEX_PS_INIT,
+	GMTMEX_GET_GRID, GMTMEX_GET_IMAGE, GMTMEX_GET_DATASET, GMTMEX_GET_PALETTE, GMTMEX_GET_PS,
+	GMTMEX_N_CONVERSIONS};
+
+static const char *GMTMEX_conversion_name[GMTMEX_N_CONVERSIONS] = {
+	"gmtmex_grid_init", "gmtmex_image_init", "gmtmex_dataset_init", "gmtmex_palette_init", "gmtmex_ps_init",
+	"gmtmex_get_grid", "gmtmex_get_image", "gmtmex_get_dataset", "gmtmex_get_palette", "gmtmex_get_postscript"};
+
+struct GMTMEX_MEMSTATS {
+	uint64_t calls;         /* Number of conversions */
+	uint64_t copied;        /* Bytes copied between MATLAB and GMT */
+	uint64_t aliased;       /* Bytes passed by reference */
+	uint64_t allocations;   /* Containers and MATLAB arrays allocated */
+	uint64_t peak;          /* Largest number of bytes held at once by the conversions of one call */
+};
+
+/* The call tallies belong to the calling thread; the totals are shared by all threads under stats_lock */
+static GMTMEX_TLS struct GMTMEX_MEMSTATS Stats_call[GMTMEX_N_CONVERSIONS];
+static GMTMEX_TLS uint64_t live_call = 0, peak_call = 0, live_conv[GMTMEX_N_CONVERSIONS];
+static struct GMTMEX_MEMSTATS Stats_total[GMTMEX_N_CONVERSIONS];
+static uint64_t peak_total = 0;
+static gmtmex_mutex_t stats_lock = GMTMEX_MUTEX_INITIALIZER;
+
+void GMTMEX_Stats_Begin (void) {
+	/* Start the tallies of a new module call */
+	memset (Stats_call, 0, GMTMEX_N_CONVERSIONS * sizeof (struct GMTMEX_MEMSTATS));
+	memset (live_conv, 0, GMTMEX_N_CONVERSIONS * sizeof (uint64_t));
+	live_call = peak_call = 0;
+}
+
+static void gmtmex_account (unsigned int conv, uint64_t copied, uint64_t aliased, unsigned int allocations, uint64_t held) {
+	/* Add one conversion to the tallies.  The held bytes stay allocated until the end of the call */
+	struct GMTMEX_MEMSTATS *C = &Stats_call[conv], *T = &Stats_total[conv];
+	C->calls++;
+	C->copied += copied;
+	C->aliased += aliased;
+	C->allocations += allocations;
+	live_conv[conv] += held;
+	if (live_conv[conv] > C->peak) C->peak = live_conv[conv];
+	live_call += held;
+	if (live_call > peak_call) peak_call = live_call;
+	gmtmex_mutex_lock (&stats_lock);
+	T->calls++;
+	T->copied += copied;
+	T->aliased += aliased;
+	T->allocations += allocations;
+	if (C->peak > T->peak) T->peak = C->peak;
+	if (peak_call > peak_total) peak_total = peak_call;
+	gmtmex_mutex_unlock (&stats_lock);
+}
+
+static const char *gmtmex_copy_reason (unsigned int family, const mxArray *ptr) {
+	/* Explain why an input could not be passed by reference */
+	switch (family) {
+		case GMT_IS_GRID:       return ("grids are copied into a padded GMT grid with the rows flipped");
+		case GMT_IS_PALETTE:    return ("color palette structures are converted to GMT color tables");
+		case GMT_IS_POSTSCRIPT: return ("the PostScript string is copied out of the MATLAB char array");
+		default: break;
+	}
+	if (mxIsCell (ptr) && mxGetNumberOfElements (ptr) > 0 && mxGetCell (ptr, 0) && mxIsNumeric (mxGetCell (ptr, 0)))
+		return ("columnar segments are only passed by reference when the matrix is double");
+	if (mxIsStruct (ptr))
+		return ("dataset structures are copied segment by segment; pass a matrix or a structure of columns instead");
+	return ("text is copied into GMT records");
+}
+
+static void gmtmex_account_input (void *API, struct GMT_RESOURCE *X, const mxArray *ptr, unsigned int actual_family, bool resident, bool duplicated) {
+	/* Tally an input conversion and report copies when verbose */
+	unsigned int conv = GMTMEX_DATASET_INIT;
+	uint64_t bytes = gmtmex_object_bytes (actual_family, X->object);
+	switch (X->family) {
+		case GMT_IS_GRID:       conv = GMTMEX_GRID_INIT;    break;
+		case GMT_IS_IMAGE:      conv = GMTMEX_IMAGE_INIT;   break;
+		case GMT_IS_PALETTE:    conv = GMTMEX_PALETTE_INIT; break;
+		case GMT_IS_POSTSCRIPT: conv = GMTMEX_PS_INIT;      break;
+		default: break;
+	}
+	if (resident && duplicated) {	/* A copy of a resident object, since the module may change it */
+		gmtmex_account (conv, bytes, 0, 1, bytes);
+		GMT_Report (API, GMT_MSG_VERBOSE, "GMTMEX: Resident input %u (%s, %" PRIu64 " bytes) was duplicated since the module may change its inputs\n",
+		            X->pos + 1, gmtmex_family_name (X->family), bytes);
+	}
+	else if (resident)	/* Converted once by gmt ('register', ...); nothing new allocated */
+		gmtmex_account (conv, 0, bytes, 0, 0);
+	else if (gmtmex_input_is_aliased (X->family, ptr))
+		gmtmex_account (conv, 0, bytes, 1, 0);
+	else {
+		gmtmex_account (conv, bytes, 0, 1, bytes);
+		GMT_Report (API, GMT_MSG_VERBOSE, "GMTMEX: Input %u (%s, %" PRIu64 " bytes) was copied: %s\n",
+		            X->pos + 1, gmtmex_family_name (X->family), bytes, gmtmex_copy_reason (X->family, ptr));
+	}
+}
+
+mxArray *GMTMEX_Stats (bool print) {
+	/* Return the tallies of the last module call and of the whole session as a structure with
+	 * fields call and total, each a structure array with one element per conversion function and
+	 * a final element "all" holding the sums and the peak memory of a single call */
+	unsigned int k, j, s;
+	uint64_t *v = NULL, total_peak;
+	const char *fields[6] = {"function", "calls", "copied", "aliased", "allocations", "peak"};
+	const char *scopes[2] = {"call", "total"};
+	struct GMTMEX_MEMSTATS *S = NULL, all, total[GMTMEX_N_CONVERSIONS];
+	mxArray *out = NULL, *L = NULL;
+
+	gmtmex_mutex_lock (&stats_lock);	/* Take a consistent copy of the totals */
+	memcpy (total, Stats_total, GMTMEX_N_CONVERSIONS * sizeof (struct GMTMEX_MEMSTATS));
+	total_peak = peak_total;
+	gmtmex_mutex_unlock (&stats_lock);
+	out = mxCreateStructMatrix (1, 1, 2, scopes);
+	for (s = 0; s < 2; s++) {
+		S = (s == 0) ? Stats_call : total;
+		memset (&all, 0, sizeof (struct GMTMEX_MEMSTATS));
+		L = mxCreateStructMatrix (GMTMEX_N_CONVERSIONS + 1, 1, 6, fields);
+		if (print) mexPrintf ("%s:\n%-22s %8s %16s %16s %12s %16s\n", (s == 0) ? "Last module call" : "Session total",
+		                      "function", "calls", "copied", "aliased", "allocations", "peak");
+		for (k = 0; k <= GMTMEX_N_CONVERSIONS; k++) {
+			struct GMTMEX_MEMSTATS *C = (k < GMTMEX_N_CONVERSIONS) ? &S[k] : &all;
+			if (k < GMTMEX_N_CONVERSIONS) {
+				all.calls += C->calls;	all.copied += C->copied;	all.aliased += C->aliased;
+				all.allocations += C->allocations;
+			}
+			else
+				all.peak = (s == 0) ? peak_call : total_peak;
+			mxSetField (L, k, "function", mxCreateString ((k < GMTMEX_N_CONVERSIONS) ? GMTMEX_conversion_name[k] : "all"));
+			for (j = 1; j < 6; j++) {
+				mxArray *mx_ptr = mxCreateNumericMatrix (1, 1, mxUINT64_CLASS, mxREAL);
+				v = mxGetData (mx_ptr);
+				v[0] = (j == 1) ? C->calls : (j == 2) ? C->copied : (j == 3) ? C->aliased : (j == 4) ? C->allocations : C->peak;
+				mxSetField (L, k, fields[j], mx_ptr);
+			}
+			if (print && C->calls)
+				mexPrintf ("%-22s %8" PRIu64 " %16" PRIu64 " %16" PRIu64 " %12" PRIu64 " %16" PRIu64 "\n",
+				           (k < GMTMEX_N_CONVERSIONS) ? GMTMEX_conversion_name[k] : "all", C->calls, C->copied, C->aliased, C->allocations, C->peak);
+		}
+		mxSetField (out, 0, scopes[s], L);
+	}
+	return (out);
+}
+
+char GMTMEX_objecttype (const mxArray *ptr) {
+	/* Determine what we are returning so gmt write can pass the correct -T? flag */
+	mxArray *mx_ptr = NULL;
+	if (mxIsEmpty (ptr))
+		mexErrMsgTxt ("GMTMEX_objecttype: Pointer is empty\n");
+	if (mxIsStruct (ptr)) {	/* This means either a dataset, grid, image, cpt, or PS, so must check for fields */
+		struct GMTMEX_RESIDENT R;
+		if (gmtmex_find_resident (ptr, &R)) {	/* A resident object handle */
+			switch (R.family) {
+				case GMT_IS_GRID:       return 'g';
+				case GMT_IS_IMAGE:      return 'i';
+				case GMT_IS_PALETTE:    return 'c';
+				case GMT_IS_POSTSCRIPT: return 'p';
+				default:                return 'd';
+			}
+		}
+		if (gmtmex_is_column_struct (ptr)) return 'd';
+		mx_ptr = mxGetField (ptr, 0, "data");
+		if (mx_ptr) return 'd';
+		mx_ptr = mxGetField (ptr, 0, "postscript");
+		if (mx_ptr) return 'p';
+		mx_ptr = mxGetField (ptr, 0, "hinge");
+		if (mx_ptr) return 'c';
+		mx_ptr = mxGetField (ptr, 0, "image");
+		if (mx_ptr) return 'i';
+		mx_ptr = mxGetField (ptr, 0, "z");
+		if (mx_ptr) return 'g';
+		mexErrMsgTxt ("GMTMEX_objecttype: Could not recognize the structure\n");
+	}
+	else if (mxIsCell (ptr))	/* This is a dataset with text only */
+		return 'd';
+	else	/* We have to assume it is a numerical matrix */
+		return 'd';
+	return '-';	/* Can never get here you would think */
+}
+
+void GMTMEX_Set_Object (void *API, struct GMT_RESOURCE *X, const mxArray *ptr) {
+	/* Create the GMT container and hook onto resource array as X->object */
+	unsigned int module_input = (X->option->option == GMT_OPT_INFILE), actual_family = X->family;
+	struct GMTMEX_RESIDENT R;
+	bool resident = false, duplicated = false;
+
+	if (X->direction == GMT_IN && gmtmex_find_resident (ptr, &R)) {	/* Already converted by gmt ('register', ...) */
+		if (R.API != API)
+			mexErrMsgTxt ("GMT: Resident object belongs to another GMT session\n");
+		if (R.family != X->family) {
+			char buffer[BUFSIZ] = {""};
+			snprintf (buffer, BUFSIZ, "GMT: Resident object is a %s but the module expects a %s here\n",
+			          gmtmex_family_name (R.family), gmtmex_family_name (X->family));
+			mexErrMsgTxt (buffer);
+		}
+		X->object = R.object;
+		actual_family = R.actual_family;
+		resident = true;
+		if (gmtmex_copy_residents) {	/* The module may write to it, so give it a copy that is freed with the call */
+			unsigned int family = (actual_family & GMT_VIA_MATRIX) ? GMT_IS_MATRIX : ((actual_family & GMT_VIA_VECTOR) ? GMT_IS_VECTOR : R.family);
+			if ((X->object = GMT_Duplicate_Data (API, family, GMT_DUPLICATE_DATA, R.object)) == NULL)
+				mexErrMsgTxt ("GMT: Failure to duplicate resident object\n");
+			gmtmex_track (API, X->object);
+			duplicated = true;
+		}
+		GMT_Report (API, GMT_MSG_DEBUG, "GMTMEX_Set_Object: Using resident %s %" PRIu64 "\n", gmtmex_family_name (R.family), R.id);
+	}
+	else switch (X->family) {
+		case GMT_IS_GRID:	/* Get a grid from Matlab or a dummy one to hold GMT output */
+			X->object = gmtmex_grid_init (API, X->direction, module_input, ptr);
+			GMT_Report (API, GMT_MSG_DEBUG, "GMTMEX_Set_Object: Got Grid\n");
+			break;
+		case GMT_IS_IMAGE:	/* Get an image from Matlab or a dummy one to hold GMT output */
+			X->object = gmtmex_image_init (API, X->direction, module_input, ptr);
+			GMT_Report (API, GMT_MSG_DEBUG, "GMTMEX_Set_Object: Got Image\n");
+			break;
+		case GMT_IS_DATASET:	/* Get a dataset from Matlab or a dummy one to hold GMT output */
+			/* Because a GMT_DATASET may appears as a GMT_MATRIX or GMT_VECTOR we need the actual_family to open the virtual file later */
+			X->object = gmtmex_dataset_init (API, X->direction, module_input, ptr, &actual_family);
+			break;
+		case GMT_IS_PALETTE:	/* Get a palette from Matlab or a dummy one to hold GMT output */
+			X->object = gmtmex_palette_init (API, X->direction, module_input, ptr);
+			GMT_Report (API, GMT_MSG_DEBUG, "GMTMEX_Set_Object: Got CPT\n");
+			break;
+		case GMT_IS_POSTSCRIPT:	/* Get a PostScript struct from Matlab or a dummy one to hold GMT output */
+			X->object = gmtmex_ps_init (API, X->direction, module_input, ptr);
+			GMT_Report (API, GMT_MSG_DEBUG, "GMTMEX_Set_Object: Got POSTSCRIPT\n");
+			break;
+		default:
+			GMT_Report (API, GMT_MSG_NORMAL, "GMTMEX_Set_Object: Bad data type (%d)\n", X->family);
+			break;
+	}
+	if (X->object == NULL)
+		mexErrMsgTxt("GMT: Failure to register the resource\n");
+	if (X->direction == GMT_IN) gmtmex_account_input (API, X, ptr, actual_family, resident, duplicated);
+	if (GMT_Open_VirtualFile (API, actual_family, X->geometry, X->direction|GMT_IS_REFERENCE, X->object, X->name) != GMT_NOERROR) 	/* Make filename with embedded object ID */
+		mexErrMsgTxt ("GMT: Failure to open virtual file\n");
+	if (GMT_Expand_Option (API, X->option, X->name) != GMT_NOERROR)	/* Replace ? in argument with name */
+		mexErrMsgTxt ("GMT: Failure to expand filename marker (?)\n");
+}
+
+void *GMTMEX_Get_Object (void *API, struct GMT_RESOURCE *X) {
+	mxArray *ptr = NULL;
+	/* In line-by-line modules it is possible no output is produced, hence we make an exception for DATASET: */
+	if ((X->object = GMT_Read_VirtualFile (API, X->name)) == NULL && X->family != GMT_IS_DATASET)
 		mexErrMsgTxt ("GMT: Error reading virtual file from GMT\n");
+	if (X->object) gmtmex_track (API, X->object);
 	switch (X->family) {	/* Determine what container we got */
 		case GMT_IS_GRID:	/* A GMT grid; make it the pos'th output item */
 			ptr = gmtmex_get_grid (API, X->object);
 			break;
-		case GMT_IS_DATASET:	/* A GMT table; make it a data structure and the pos'th output item */
-			ptr = gmtmex_get_dataset (API, X->object);
+		case GMT_IS_DATASET:	/* A GMT table; make it a data structure (or a bare matrix) and the pos'th output item */
+			if (gmtmex_matrix_output != GMT_NOTSET)
+				ptr = gmtmex_get_matrix (API, X->object);
+			else
+				ptr = gmtmex_get_dataset (API, X->object);
 			break;
 		case GMT_IS_PALETTE:	/* A GMT CPT; make it a colormap and the pos'th output item  */
 			ptr = gmtmex_get_palette (API, X->object);
@@ -1339,5 +3362,513 @@ void *GMTMEX_Get_Object (void *API, struct GMT_RESOURCE *X) {
 			mexErrMsgTxt ("GMT: Internal Error - unsupported data type\n");
 			break;
 	}
+	if (X->object) {	/* The GMT container and its MATLAB copy both live until the end of the call */
+		unsigned int family = (X->family == GMT_IS_DATASET && gmtmex_matrix_output != GMT_NOTSET) ? X->family|GMT_VIA_MATRIX : X->family;
+		uint64_t bytes = gmtmex_object_bytes (family, X->object);
+		unsigned int conv = GMTMEX_GET_DATASET;
+		switch (X->family) {
+			case GMT_IS_GRID:       conv = GMTMEX_GET_GRID;    break;
+			case GMT_IS_IMAGE:      conv = GMTMEX_GET_IMAGE;   break;
+			case GMT_IS_PALETTE:    conv = GMTMEX_GET_PALETTE; break;
+			case GMT_IS_POSTSCRIPT: conv = GMTMEX_GET_PS;      break;
+			default: break;
+		}
+		gmtmex_account (conv, bytes, 0, 2, 2 * bytes);
+	}
 	return ptr;
 }
+
+bool GMTMEX_Get_Stack (const mxArray *ptr, struct GMTMEX_STACK *S) {
+	/* Return true if ptr is a grid structure whose z is a 3-D array of layers, and fill in S */
+	mxArray *mx_ptr = NULL, *mxGrid = NULL;
+	const mwSize *dim = NULL;
+	unsigned int k;
+
+	if (ptr == NULL || !mxIsStruct (ptr) || (mxGrid = mxGetField (ptr, 0, "z")) == NULL) return (false);
+	if (mxGetNumberOfDimensions (mxGrid) != 3) return (false);
+	if (!mxIsSingle (mxGrid) && !mxIsDouble (mxGrid))
+		mexErrMsgTxt ("GMTMEX_Get_Stack: Grid stack must be either single or double.\n");
+	if ((mx_ptr = mxGetField (ptr, 0, "layout")) != NULL && mxIsChar (mx_ptr)) {
+		char layout[4] = {""};
+		mxGetString (mx_ptr, layout, 4);
+		if (!strcmp (layout, "TRF"))
+			mexErrMsgTxt ("GMTMEX_Get_Stack: Grid stacks must be in the default TCF layout.\n");
+	}
+	dim = mxGetDimensions (mxGrid);
+	S->n_rows = dim[0];	S->n_columns = dim[1];	S->n_layers = dim[2];
+	S->is_single = mxIsSingle (mxGrid);
+	S->data = mxGetData (mxGrid);
+	if ((mx_ptr = mxGetField (ptr, 0, "range")) == NULL || mxGetNumberOfElements (mx_ptr) < 4)
+		mexErrMsgTxt ("GMTMEX_Get_Stack: Could not find range array for Grid range\n");
+	for (k = 0; k < 6; k++) S->range[k] = (k < mxGetNumberOfElements (mx_ptr)) ? mxGetPr (mx_ptr)[k] : 0.0;
+	if ((mx_ptr = mxGetField (ptr, 0, "inc")) == NULL || mxGetNumberOfElements (mx_ptr) != 2)
+		mexErrMsgTxt ("GMTMEX_Get_Stack: Could not find inc array with Grid increments\n");
+	S->inc[0] = mxGetPr (mx_ptr)[0];	S->inc[1] = mxGetPr (mx_ptr)[1];
+	if ((mx_ptr = mxGetField (ptr, 0, "registration")) == NULL)
+		mexErrMsgTxt ("GMTMEX_Get_Stack: Could not find registration array for Grid registration\n");
+	S->registration = (unsigned int)lrint (mxGetScalar (mx_ptr));
+	S->nan_value = gmtmex_get_nodata (ptr);
+	return (true);
+}
+
+void *GMTMEX_Convert_Input (void *API, unsigned int family, unsigned int module_input, const mxArray *ptr, unsigned int *actual_family) {
+	/* Convert one MATLAB input to a GMT container without opening a virtual file */
+	void *object = NULL;
+	*actual_family = family;
+	switch (family) {
+		case GMT_IS_GRID:       object = gmtmex_grid_init (API, GMT_IN, module_input, ptr);    break;
+		case GMT_IS_IMAGE:      object = gmtmex_image_init (API, GMT_IN, module_input, ptr);   break;
+		case GMT_IS_DATASET:    object = gmtmex_dataset_init (API, GMT_IN, module_input, ptr, actual_family); break;
+		case GMT_IS_PALETTE:    object = gmtmex_palette_init (API, GMT_IN, module_input, ptr); break;
+		case GMT_IS_POSTSCRIPT: object = gmtmex_ps_init (API, GMT_IN, module_input, ptr);      break;
+		default:
+			mexErrMsgTxt ("GMTMEX_Convert_Input: Internal Error - unsupported data type\n");
+			break;
+	}
+	return (object);
+}
+
+mxArray *GMTMEX_Get_Layers (void *API, unsigned int family, void **objects, uint64_t n_layers, unsigned int stride, bool stack) {
+	/* Return the outputs of a grid stack or map run, where objects[layer*stride] is the output of each
+	 * layer.  If stack is true then grids become a single grid structure with a 3-D z array; anything
+	 * else is a cell array with one item per layer */
+	uint64_t layer;
+	mxArray *out = NULL;
+
+	if (family == GMT_IS_GRID && stack) {
+		struct GMT_GRID **L = NULL;
+		if ((L = malloc (n_layers * sizeof (struct GMT_GRID *))) == NULL)
+			mexErrMsgTxt ("GMTMEX_Get_Layers: Failure to allocate layer pointers\n");
+		for (layer = 0; layer < n_layers; layer++) L[layer] = objects[layer*stride];
+		out = gmtmex_get_grid_stack (API, L, n_layers);
+		free (L);
+		return (out);
+	}
+	out = mxCreateCellMatrix ((mwSize)n_layers, 1);
+	for (layer = 0; layer < n_layers; layer++) {
+		void *object = objects[layer*stride];
+		mxArray *item = NULL;
+		switch (family) {
+			case GMT_IS_GRID:       item = gmtmex_get_grid (API, object);       break;
+			case GMT_IS_IMAGE:      item = gmtmex_get_image (API, object);      break;
+			case GMT_IS_DATASET:    item = gmtmex_get_dataset (API, object);    break;
+			case GMT_IS_PALETTE:    item = gmtmex_get_palette (API, object);    break;
+			case GMT_IS_POSTSCRIPT: item = gmtmex_get_postscript (API, object); break;
+			default:
+				mexErrMsgTxt ("GMTMEX_Get_Layers: Internal Error - unsupported data type\n");
+				break;
+		}
+		mxSetCell (out, (mwIndex)layer, item);
+	}
+	return (out);
+}
+
+static int64_t gmtmex_get_slice (double z, const double *z_low, const double *z_high, int64_t n) {
+	/* Binary search for the CPT slice that holds z.  Returns -1 for background,
+	 * n for foreground and -2 if z falls in a gap between discrete slices */
+	int64_t lo = 0, hi = n - 1, mid;
+	if (z < z_low[0]) return (-1);
+	if (z > z_high[n-1]) return (n);
+	while (lo < hi) {	/* Find the last slice with z_low <= z */
+		mid = (lo + hi + 1) / 2;
+		if (z_low[mid] <= z) lo = mid; else hi = mid - 1;
+	}
+	return ((z <= z_high[lo]) ? lo : -2);
+}
+
+mxArray *GMTMEX_colorize (const mxArray *grid, const mxArray *cpt) {
+	/* Apply the palette in the MEX CPT structure cpt to a grid (a MEX Grid structure or a plain
+	 * single/double matrix) and return a MEX Image structure holding a uint8 RGB image, plus an
+	 * alpha layer if the palette has transparency.  We work directly on the MATLAB arrays, so no
+	 * GMT containers are involved.  Continuous slices are interpolated linearly in rgb, discrete
+	 * slices use their low color, and back/fore/NaN colors come from the bfn field.  Hinged CPTs
+	 * need no special care since the slice boundaries are already in z units. */
+	bool is_single, continuous, has_alpha = false, wrap;
+	unsigned int k, one = 1;
+	int64_t j, n_slices, col;
+	uint64_t n_rows, n_columns, nm;
+	mwSize dim[3];
+	uint8_t *img = NULL, *alpha = NULL;
+	float *f4 = NULL;
+	double *f8 = NULL, *range = NULL, *colors = NULL, *t = NULL, *bfn = NULL, *d = NULL, period = 0.0;
+	double *z_low = NULL, *z_high = NULL, *i_dz = NULL, *rgba_low = NULL, *rgba_diff = NULL, bfn_rgba[3][4];
+	mxArray *mxGrid = NULL, *mx_ptr[N_MEX_FIELDNAMES_CPT], *I_struct = NULL, *mxptr[N_MEX_FIELDNAMES_IMAGE];
+
+	/* 1. Get the grid array and check the palette */
+	if (mxIsStruct (grid)) {
+		if ((mxGrid = mxGetField (grid, 0, "z")) == NULL)
+			gmtmex_quit_if_missing ("GMTMEX_colorize", "z");
+	}
+	else
+		mxGrid = (mxArray *)grid;
+	if (!mxIsSingle (mxGrid) && !mxIsDouble (mxGrid))
+		mexErrMsgTxt ("GMTMEX_colorize: grid array must be either single or double.\n");
+	if (mxGetNumberOfDimensions (mxGrid) != 2)
+		mexErrMsgTxt ("GMTMEX_colorize: grid array must be 2-D.\n");
+	if (!mxIsStruct (cpt))
+		mexErrMsgTxt ("GMTMEX_colorize: Expected a CPT structure for the palette\n");
+	for (k = 0; k < N_MEX_FIELDNAMES_CPT; k++) {
+		if ((mx_ptr[k] = mxGetField (cpt, 0, GMTMEX_fieldname_cpt[k])) == NULL)
+			gmtmex_quit_if_missing ("GMTMEX_colorize", GMTMEX_fieldname_cpt[k]);
+	}
+	if (!mxIsDouble (mx_ptr[1]) || !mxIsDouble (mx_ptr[2]) || !mxIsDouble (mx_ptr[4]) || !mxIsDouble (mx_ptr[7]))
+		mexErrMsgTxt ("GMTMEX_colorize: CPT alpha, range, bfn and cpt arrays must be double\n");
+	n_slices = (int64_t)mxGetM (mx_ptr[2]);	/* Length of range array */
+	if (n_slices < 1 || mxGetN (mx_ptr[2]) != 2 || mxGetM (mx_ptr[7]) != (size_t)n_slices || mxGetN (mx_ptr[7]) != 6)
+		mexErrMsgTxt ("GMTMEX_colorize: CPT structure has no or inconsistent slices\n");
+	continuous = (mxGetM (mx_ptr[0]) > (size_t)n_slices);	/* Same test as in gmtmex_palette_init */
+	if (!continuous) one = 0;
+	if (mxGetNumberOfElements (mx_ptr[1]) != (size_t)(n_slices + one))	/* One more for the top of the last continuous slice */
+		mexErrMsgTxt ("GMTMEX_colorize: CPT alpha array does not have one value per color\n");
+	if (mxGetM (mx_ptr[4]) != 3 || mxGetN (mx_ptr[4]) != 3)
+		mexErrMsgTxt ("GMTMEX_colorize: CPT bfn array must be 3x3\n");
+	t      = mxGetData (mx_ptr[1]);
+	range  = mxGetData (mx_ptr[2]);
+	bfn    = mxGetData (mx_ptr[4]);
+	colors = mxGetData (mx_ptr[7]);
+	wrap   = (mxGetScalar (mx_ptr[9]) != 0.0);
+
+	/* 2. Build the slice lookup tables, with colors already scaled to 0-255.  mxMalloc never returns NULL
+	 * and its memory is freed by MATLAB if we bail out with an error */
+	z_low     = mxMalloc (n_slices * sizeof (double));
+	z_high    = mxMalloc (n_slices * sizeof (double));
+	i_dz      = mxMalloc (n_slices * sizeof (double));
+	rgba_low  = mxMalloc (4 * n_slices * sizeof (double));
+	rgba_diff = mxMalloc (4 * n_slices * sizeof (double));
+	for (j = 0; j < n_slices; j++) {
+		z_low[j]  = range[j];
+		z_high[j] = range[j+n_slices];
+		i_dz[j]   = (continuous && z_high[j] > z_low[j]) ? 1.0 / (z_high[j] - z_low[j]) : 0.0;
+		for (k = 0; k < 3; k++) {
+			rgba_low[4*j+k]  = 255.0 * colors[j+k*n_slices];
+			rgba_diff[4*j+k] = (continuous) ? 255.0 * colors[j+(k+3)*n_slices] - rgba_low[4*j+k] : 0.0;
+		}
+		rgba_low[4*j+3]  = 255.0 * (1.0 - t[j]);	/* Opacity from transparency */
+		rgba_diff[4*j+3] = (continuous) ? 255.0 * (t[j] - t[j+one]) : 0.0;
+		if (t[j] > 0.0 || t[j+one] > 0.0) has_alpha = true;
+	}
+	for (j = 0; j < 3; j++) {	/* Back, fore and NaN colors */
+		for (k = 0; k < 3; k++) bfn_rgba[j][k] = 255.0 * bfn[j+k*3];
+		bfn_rgba[j][3] = 255.0;
+	}
+	if (wrap) period = z_high[n_slices-1] - z_low[0];
+
+	/* 3. Allocate the output image.  Grids are stored bottom-up and images top-down (TCBa) */
+	n_rows = mxGetM (mxGrid);	n_columns = mxGetN (mxGrid);	nm = n_rows * n_columns;
+	dim[0] = n_rows;	dim[1] = n_columns;	dim[2] = 3;
+	mxptr[0] = mxCreateNumericArray (3, dim, mxUINT8_CLASS, mxREAL);
+	img = mxGetData (mxptr[0]);
+	mxptr[15] = (has_alpha) ? mxCreateNumericMatrix (n_rows, n_columns, mxUINT8_CLASS, mxREAL) : mxCreateNumericMatrix (0, 0, mxUINT8_CLASS, mxREAL);
+	if (has_alpha) alpha = mxGetData (mxptr[15]);
+	if ((is_single = mxIsSingle (mxGrid)))
+		f4 = mxGetData (mxGrid);
+	else
+		f8 = mxGetData (mxGrid);
+
+	/* 4. The kernel: each column is independent, so spread columns across threads */
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (col = 0; col < (int64_t)n_columns; col++) {
+		uint64_t row, ij_in, ij_out;
+		unsigned int b;
+		int64_t s;
+		double z, dz, v, rgba[4];
+		for (row = 0; row < n_rows; row++) {
+			ij_in  = col * n_rows + row;
+			ij_out = col * n_rows + n_rows - row - 1;
+			z = (is_single) ? (double)f4[ij_in] : f8[ij_in];
+			if (isnan (z))
+				s = -3;
+			else {
+				if (wrap && period > 0.0) {	/* Cyclic palette: bring z into range first */
+					z = fmod (z - z_low[0], period);
+					if (z < 0.0) z += period;
+					z += z_low[0];
+				}
+				s = gmtmex_get_slice (z, z_low, z_high, n_slices);
+			}
+			if (s >= 0 && s < n_slices) {	/* Inside a slice */
+				dz = (z - z_low[s]) * i_dz[s];
+				for (b = 0; b < 4; b++) rgba[b] = rgba_low[4*s+b] + dz * rgba_diff[4*s+b];
+			}
+			else	/* Background, foreground, or NaN (also used for gaps between discrete slices) */
+				memcpy (rgba, bfn_rgba[(s == -1) ? 0 : ((s == n_slices) ? 1 : 2)], 4 * sizeof (double));
+			for (b = 0; b < 3; b++) {
+				v = rgba[b] + 0.5;
+				img[ij_out + b * nm] = (uint8_t)((v < 0.0) ? 0.0 : ((v > 255.0) ? 255.0 : v));
+			}
+			if (alpha) {
+				v = rgba[3] + 0.5;
+				alpha[ij_out] = (uint8_t)((v < 0.0) ? 0.0 : ((v > 255.0) ? 255.0 : v));
+			}
+		}
+	}
+	mxFree (z_low);	mxFree (z_high);	mxFree (i_dz);	mxFree (rgba_low);	mxFree (rgba_diff);
+
+	/* 5. Fill in the rest of the image structure, inheriting what we can from the grid */
+	for (k = 1; k < N_MEX_FIELDNAMES_IMAGE; k++) {
+		if (k == 15) continue;	/* alpha was set above */
+		mxptr[k] = NULL;
+		if (mxIsStruct (grid) && mxGetField (grid, 0, GMTMEX_fieldname_image[k]))
+			mxptr[k] = mxDuplicateArray (mxGetField (grid, 0, GMTMEX_fieldname_image[k]));
+	}
+	if (mxptr[1] == NULL) {	/* Plain matrix: use row and column numbers as coordinates */
+		mxptr[1] = mxCreateNumericMatrix (1, n_columns, mxDOUBLE_CLASS, mxREAL);
+		d = mxGetPr (mxptr[1]);
+		for (col = 0; col < (int64_t)n_columns; col++) d[col] = (double)(col + 1);
+	}
+	if (mxptr[2] == NULL) {
+		mxptr[2] = mxCreateNumericMatrix (1, n_rows, mxDOUBLE_CLASS, mxREAL);
+		d = mxGetPr (mxptr[2]);
+		for (j = 0; j < (int64_t)n_rows; j++) d[j] = (double)(j + 1);
+	}
+	if (mxptr[3] == NULL) {
+		mxptr[3] = mxCreateNumericMatrix (1, 6, mxDOUBLE_CLASS, mxREAL);
+		d = mxGetPr (mxptr[3]);
+		d[0] = 1.0;	d[1] = (double)n_columns;	d[2] = 1.0;	d[3] = (double)n_rows;
+	}
+	d = mxGetPr (mxptr[3]);	d[4] = 0.0;	d[5] = 255.0;	/* Range is now that of the image values */
+	if (mxptr[4] == NULL) {
+		mxptr[4] = mxCreateNumericMatrix (1, 2, mxDOUBLE_CLASS, mxREAL);
+		d = mxGetPr (mxptr[4]);	d[0] = d[1] = 1.0;
+	}
+	if (mxptr[5] == NULL) mxptr[5] = mxCreateDoubleScalar (0.0);
+	if (mxptr[6]) mxDestroyArray (mxptr[6]);
+	mxptr[6]  = mxCreateDoubleScalar (mxGetNaN ());
+	for (k = 7; k <= 13; k++) if (mxptr[k] == NULL) mxptr[k] = mxCreateString ("");
+	if (mxptr[10]) mxDestroyArray (mxptr[10]);
+	mxptr[10] = mxCreateString ("uint8");
+	mxptr[14] = mxCreateNumericMatrix (0, 0, mxDOUBLE_CLASS, mxREAL);	/* No indexed colormap */
+	if (mxptr[16]) mxDestroyArray (mxptr[16]);
+	mxptr[16] = mxCreateString ("TCBa");
+	for (k = 17; k < N_MEX_FIELDNAMES_IMAGE; k++) if (mxptr[k] == NULL) mxptr[k] = mxCreateString ("");
+
+	I_struct = mxCreateStructMatrix (1, 1, N_MEX_FIELDNAMES_IMAGE, GMTMEX_fieldname_image);
+	for (k = 0; k < N_MEX_FIELDNAMES_IMAGE; k++)
+		mxSetField (I_struct, 0, GMTMEX_fieldname_image[k], mxptr[k]);
+	return (I_struct);
+}
+
+/* Native versions of the helpers that used to be M-code in gmt.m.  They only rearrange MATLAB
+ * arrays, so no GMT session is needed.  Each one sizes its output first and allocates it once. */
+
+#define N_MEX_FIELDNAMES_WRAPGRID	16
+static const char *GMTMEX_fieldname_wrapgrid[N_MEX_FIELDNAMES_WRAPGRID] =
+	{"proj4", "wkt", "range", "inc", "registration", "nodata", "title", "comment", "command", "datatype",
+	 "x", "y", "z", "x_unit", "y_unit", "z_unit"};
+#define N_MEX_FIELDNAMES_WRAPSEG	6
+static const char *GMTMEX_fieldname_wrapseg[N_MEX_FIELDNAMES_WRAPSEG] = {"data", "header", "text", "comment", "proj4", "wkt"};
+#define N_MEX_FIELDNAMES_RECORD	2
+static const char *GMTMEX_fieldname_record[N_MEX_FIELDNAMES_RECORD] = {"data", "text"};
+#define N_MEX_FIELDNAMES_CATCPT	6
+static const char *GMTMEX_fieldname_catcpt[N_MEX_FIELDNAMES_CATCPT] = {"colormap", "alpha", "range", "minmax", "bfn", "depth"};
+
+mxArray *GMTMEX_catseg (int nrhs, const mxArray *prhs[]) {
+	/* all = gmt ('catseg', D[, opt]): stack the data matrices of all segments in the dataset structure
+	 * array D into a single double matrix.  If opt is given each segment starts with a NaN record. */
+	int field;
+	bool nan_record = (nrhs == 2);
+	uint64_t seg, n_segments, n_rows = 0, n_columns, row, col, start, nr;
+	double *out = NULL;
+	mxArray *mx_ptr = NULL, *all = NULL;
+
+	if (!mxIsStruct (prhs[0]) || (field = mxGetFieldNumber (prhs[0], "data")) < 0)
+		mexErrMsgTxt ("catseg: First argument must be a dataset structure array.\n");
+	if ((n_segments = mxGetNumberOfElements (prhs[0])) == 0)
+		return (mxCreateDoubleMatrix (0, 0, mxREAL));
+	mx_ptr = mxGetFieldByNumber (prhs[0], 0, field);
+	n_columns = (mx_ptr) ? mxGetN (mx_ptr) : 0;	/* Get # columns from first segment */
+	for (seg = 0; seg < n_segments; seg++) {	/* Count total rows */
+		if ((mx_ptr = mxGetFieldByNumber (prhs[0], (mwIndex)seg, field)) == NULL || (nr = mxGetM (mx_ptr)) == 0) continue;
+		if (!mxIsNumeric (mx_ptr) || mxGetN (mx_ptr) != n_columns)
+			mexErrMsgTxt ("catseg: All segments must be numeric with the same number of columns.\n");
+		n_rows += nr;
+	}
+	if (nan_record) n_rows += n_segments;	/* Need to add a NaN-record per segment */
+	all = mxCreateDoubleMatrix ((mwSize)n_rows, (mwSize)n_columns, mxREAL);
+	out = mxGetPr (all);
+	for (seg = start = 0; seg < n_segments; seg++) {
+		if (nan_record) {	/* Add NaN-record */
+			for (col = 0; col < n_columns; col++) out[col*n_rows+start] = mxGetNaN ();
+			start++;
+		}
+		if ((mx_ptr = mxGetFieldByNumber (prhs[0], (mwIndex)seg, field)) == NULL || (nr = mxGetM (mx_ptr)) == 0) continue;
+		if (mxIsDouble (mx_ptr)) {	/* Copy whole columns */
+			double *in = mxGetPr (mx_ptr);
+			for (col = 0; col < n_columns; col++)
+				memcpy (&out[col*n_rows+start], &in[col*nr], nr * sizeof (double));
+		}
+		else {
+			for (col = 0; col < n_columns; col++)
+				for (row = 0; row < nr; row++)
+					out[col*n_rows+start+row] = gmtmex_get_value (mx_ptr, col*nr+row);
+		}
+		start += nr;
+	}
+	return (all);
+}
+
+static mxArray *gmtmex_linspace (double d1, double d2, uint64_t n) {
+	/* Same as linspace (d1, d2, n) */
+	uint64_t k;
+	double *x = NULL;
+	mxArray *mx_ptr = mxCreateDoubleMatrix (1, (mwSize)n, mxREAL);
+	x = mxGetPr (mx_ptr);
+	for (k = 0; k < n; k++) x[k] = d1 + k * (d2 - d1) / (n - 1);
+	x[0] = d1;	x[n-1] = d2;
+	return (mx_ptr);
+}
+
+static mxArray *gmtmex_row_vector (const double *v, unsigned int n) {
+	/* Return a 1xn double array with a copy of v */
+	mxArray *mx_ptr = mxCreateDoubleMatrix (1, n, mxREAL);
+	memcpy (mxGetPr (mx_ptr), v, n * sizeof (double));
+	return (mx_ptr);
+}
+
+mxArray *GMTMEX_wrapgrid (int nrhs, const mxArray *prhs[]) {
+	/* G = gmt ('wrapgrid', Z, head): fill the Grid struct used in gmtmex from a 2-D array and the old
+	 * 1x9 header vector [x_min x_max y_min y_max z_min z_max reg x_inc y_inc].  gmt.m passes a third
+	 * argument false to leave z empty and then sets G.z = Z itself, so MATLAB can share Z instead of
+	 * the MEX file copying it. */
+	unsigned int k;
+	double head[9];
+	mxArray *G = NULL;
+
+	if (mxGetNumberOfDimensions (prhs[0]) != 2 || mxGetM (prhs[0]) < 2 || mxGetN (prhs[0]) < 2 || !mxIsNumeric (prhs[0]))
+		mexErrMsgTxt ("wrapgrid: First argument must be a decent 2D array.\n");
+	if (!mxIsNumeric (prhs[1]) || mxGetM (prhs[1]) != 1 || mxGetN (prhs[1]) != 9)
+		mexErrMsgTxt ("wrapgrid: Second argument must be a 1x9 header vector.\n");
+	for (k = 0; k < 9; k++) head[k] = gmtmex_get_value (prhs[1], k);
+	G = mxCreateStructMatrix (1, 1, N_MEX_FIELDNAMES_WRAPGRID, GMTMEX_fieldname_wrapgrid);
+	mxSetField (G, 0, "proj4",        mxCreateString (""));
+	mxSetField (G, 0, "wkt",          mxCreateString (""));
+	mxSetField (G, 0, "range",        gmtmex_row_vector (head, 6));
+	mxSetField (G, 0, "inc",          gmtmex_row_vector (&head[7], 2));
+	mxSetField (G, 0, "registration", mxCreateDoubleScalar (head[6]));
+	mxSetField (G, 0, "nodata",       mxCreateDoubleScalar (mxGetNaN ()));
+	mxSetField (G, 0, "title",        mxCreateString (""));
+	mxSetField (G, 0, "comment",      mxCreateString (""));
+	mxSetField (G, 0, "command",      mxCreateString (""));
+	mxSetField (G, 0, "datatype",     mxCreateString ("float32"));
+	mxSetField (G, 0, "x",            gmtmex_linspace (head[0], head[1], mxGetN (prhs[0])));
+	mxSetField (G, 0, "y",            gmtmex_linspace (head[2], head[3], mxGetM (prhs[0])));
+	if (nrhs == 3 && !mxIsLogicalScalarTrue (prhs[2]))	/* The caller fills in z */
+		mxSetField (G, 0, "z", mxCreateNumericMatrix (0, 0, mxGetClassID (prhs[0]), mxREAL));
+	else
+		mxSetField (G, 0, "z", mxDuplicateArray (prhs[0]));
+	mxSetField (G, 0, "x_unit",       mxCreateString (""));
+	mxSetField (G, 0, "y_unit",       mxCreateString (""));
+	mxSetField (G, 0, "z_unit",       mxCreateString (""));
+	return (G);
+}
+
+static void gmtmex_wrap_field (mxArray *D, const char *name, const mxArray *arg, bool first_only) {
+	/* Set field name of the elements of D from arg, which may be missing or empty, a cell array of the
+	 * same size and shape as D, or a string that goes to every element, or to the first one if first_only */
+	uint64_t k, n = mxGetNumberOfElements (D);
+	if (arg == NULL || mxIsEmpty (arg)) return;
+	if (mxIsChar (arg)) {
+		if (first_only) n = 1;
+		for (k = 0; k < n; k++) mxSetField (D, (mwIndex)k, name, mxDuplicateArray (arg));
+		return;
+	}
+	if (!mxIsCell (arg) || mxGetNumberOfDimensions (arg) != mxGetNumberOfDimensions (D) ||
+	    memcmp (mxGetDimensions (arg), mxGetDimensions (D), mxGetNumberOfDimensions (D) * sizeof (mwSize)))
+		mexErrMsgTxt ("wrapseg: All cell arrays must be of the same size/shape. Can't mix row and column cell vectors.\n");
+	for (k = 0; k < n; k++) {
+		mxArray *mx_ptr = mxGetCell (arg, (mwIndex)k);
+		if (mx_ptr) mxSetField (D, (mwIndex)k, name, mxDuplicateArray (mx_ptr));
+	}
+}
+
+mxArray *GMTMEX_wrapseg (int nrhs, const mxArray *prhs[]) {
+	/* D = gmt ('wrapseg', in[, headers, text, comm, proj_s, wkt_s]): fill the Dataset struct used in gmtmex.
+	 * in is a cell array of matrices where each matrix is a segment.  The optional arguments can be empty,
+	 * cell arrays of the same size and shape as in, or strings.  A header or text string is given to every
+	 * segment, while a comment, proj4 or wkt string only goes to the first one. */
+	unsigned int k;
+	mxArray *D = NULL;
+
+	if (!mxIsCell (prhs[0]))
+		mexErrMsgTxt ("wrapseg: Only cell arrays of matrices are accepted in first argument.\n");
+	D = mxCreateStructArray (mxGetNumberOfDimensions (prhs[0]), mxGetDimensions (prhs[0]), N_MEX_FIELDNAMES_WRAPSEG, GMTMEX_fieldname_wrapseg);
+	for (k = 0; k < (unsigned int)nrhs; k++)	/* The arguments are in the same order as the fields */
+		gmtmex_wrap_field (D, GMTMEX_fieldname_wrapseg[k], prhs[k], k >= 3);
+	return (D);
+}
+
+mxArray *GMTMEX_record (int nrhs, const mxArray *prhs[]) {
+	/* R = gmt ('record', data, text): simplifies creating one or more GMT records on the fly.
+	 * A row cell array of strings is stored as a column. */
+	mxArray *R = mxCreateStructMatrix (1, 1, N_MEX_FIELDNAMES_RECORD, GMTMEX_fieldname_record);
+	mxSetField (R, 0, "data", mxDuplicateArray (prhs[0]));
+	if (mxIsCell (prhs[1]) && mxGetM (prhs[1]) == 1) {	/* Transpose row cell array */
+		mwSize k, n = mxGetN (prhs[1]);
+		mxArray *text = mxCreateCellMatrix (n, 1);
+		for (k = 0; k < n; k++) {
+			mxArray *mx_ptr = mxGetCell (prhs[1], k);
+			if (mx_ptr) mxSetCell (text, k, mxDuplicateArray (mx_ptr));
+		}
+		mxSetField (R, 0, "text", text);
+	}
+	else
+		mxSetField (R, 0, "text", mxDuplicateArray (prhs[1]));
+	return (R);
+}
+
+static mxArray *gmtmex_vcat (const mxArray *A, bool drop_last, const mxArray *B) {
+	/* Return [A; B] for double matrices, optionally leaving out the last row of A */
+	uint64_t col, na = (A) ? mxGetM (A) : 0, nb = (B) ? mxGetM (B) : 0, n_columns, n_rows;
+	double *out = NULL;
+	mxArray *C = NULL;
+	if (drop_last && na) na--;
+	n_columns = (nb) ? mxGetN (B) : ((A) ? mxGetN (A) : 0);
+	if (na && nb && mxGetN (A) != n_columns)
+		mexErrMsgTxt ("catcpt: Dimensions of the two palettes are not consistent.\n");
+	if ((na && !mxIsDouble (A)) || (nb && !mxIsDouble (B)))
+		mexErrMsgTxt ("catcpt: Palette arrays must be double.\n");
+	n_rows = na + nb;
+	C = mxCreateDoubleMatrix ((mwSize)n_rows, (mwSize)n_columns, mxREAL);
+	out = mxGetPr (C);
+	for (col = 0; col < n_columns; col++) {
+		if (na) memcpy (&out[col*n_rows],    &mxGetPr (A)[col*mxGetM (A)], na * sizeof (double));
+		if (nb) memcpy (&out[col*n_rows+na], &mxGetPr (B)[col*nb],         nb * sizeof (double));
+	}
+	return (C);
+}
+
+mxArray *GMTMEX_catcpt (int nrhs, const mxArray *prhs[]) {
+	/* cpt = gmt ('catcpt', cpt1, cpt2): join two color palette structures.  The two palettes must be
+	 * continuous across their common border; this is not checked.  Only the colormap, alpha, range,
+	 * minmax, bfn and depth fields are set. */
+	bool continuous;
+	unsigned int k;
+	double minmax[2];
+	mxArray *cpt = NULL, *depth[2], *colormap1 = NULL, *range1 = NULL, *minmax1 = NULL, *minmax2 = NULL, *bfn = NULL;
+
+	for (k = 0; k < 2; k++) {
+		if (!mxIsStruct (prhs[k]) || (depth[k] = mxGetField (prhs[k], 0, "depth")) == NULL)
+			mexErrMsgTxt ("catcpt: Both arguments must be color palette structures.\n");
+	}
+	if (mxGetScalar (depth[0]) != mxGetScalar (depth[1]))
+		mexErrMsgTxt ("catcpt: Cannot join two palettes that have different bit depths.\n");
+	if ((colormap1 = mxGetField (prhs[0], 0, "colormap")) == NULL) gmtmex_quit_if_missing ("catcpt", "colormap");
+	if ((range1 = mxGetField (prhs[0], 0, "range")) == NULL) gmtmex_quit_if_missing ("catcpt", "range");
+	if ((minmax1 = mxGetField (prhs[0], 0, "minmax")) == NULL || mxGetNumberOfElements (minmax1) < 2) gmtmex_quit_if_missing ("catcpt", "minmax");
+	if ((minmax2 = mxGetField (prhs[1], 0, "minmax")) == NULL || mxGetNumberOfElements (minmax2) < 2) gmtmex_quit_if_missing ("catcpt", "minmax");
+	/* A continuous palette has one more color than slices, so the join would have one color in excess.
+	 * We could average the top cpt1 color and bottom cpt2 but that would blur the transition. */
+	continuous = (mxGetM (colormap1) != mxGetM (range1));
+	cpt = mxCreateStructMatrix (1, 1, N_MEX_FIELDNAMES_CATCPT, GMTMEX_fieldname_catcpt);
+	mxSetField (cpt, 0, "colormap", gmtmex_vcat (colormap1, continuous, mxGetField (prhs[1], 0, "colormap")));
+	mxSetField (cpt, 0, "alpha",    gmtmex_vcat (mxGetField (prhs[0], 0, "alpha"), continuous, mxGetField (prhs[1], 0, "alpha")));
+	mxSetField (cpt, 0, "range",    gmtmex_vcat (range1, false, mxGetField (prhs[1], 0, "range")));
+	minmax[0] = gmtmex_get_value (minmax1, 0);	minmax[1] = gmtmex_get_value (minmax2, 1);
+	mxSetField (cpt, 0, "minmax",   gmtmex_row_vector (minmax, 2));
+	if ((bfn = mxGetField (prhs[0], 0, "bfn")) != NULL)	/* Just keep the first one */
+		mxSetField (cpt, 0, "bfn", mxDuplicateArray (bfn));
+	mxSetField (cpt, 0, "depth",    mxDuplicateArray (depth[0]));
+	return (cpt);
+}
@@ -4,7 +4,7 @@ function  test_mex(opt)
 %
 
 all_tests = {'blockmean' 'filter1d' 'gmtinfo' 'gmtmath' 'gmtread' 'gmtsimplify' 'gmtwrite' 'mapproject' 'psbasemap' ...
-	'pscoast' 'pstext' 'psxy' 'grd2xyz' 'grdinfo' 'grdimage' 'grdsample' 'grdtrack' 'surface', 'coasts'}; 
+	'pscoast' 'pstext' 'psxy' 'grd2xyz' 'grdinfo' 'grdimage' 'grdsample' 'grdtrack' 'surface', 'coasts', 'async', 'colorize', 'columnar', 'vectors', 'register', 'memstats', 'unwind', 'stack', 'matrix', 'startup', 'helpers', 'nodata', 'layout', 'threads', 'log', 'shared', 'cache', 'map', 'segments', 'images', 'files', 'tiles', 'staging'}; 
 
 if (nargin == 0)
 	opt = all_tests;
@@ -34,6 +34,30 @@ try
 			case 'grdtrack',    grdtrack;
 			case 'surface',     surface;
 			case 'coasts',      coasts;
+			case 'async',       async;
+			case 'colorize',    colorize;
+			case 'columnar',    columnar;
+			case 'vectors',     vectors;
+			case 'register',    register;
+			case 'memstats',    memstats;
+			case 'unwind',      unwind;
+			case 'stack',       stack;
+			case 'matrix',      matrix;
+			case 'startup',     startup;
+			case 'helpers',     helpers;
+			case 'nodata',      nodata;
+			case 'layout',      layout;
+			case 'threads',     threads;
+			case 'log',         log_sink;
+			case 'shared',      shared;
+			case 'cache',       read_cache;
+			case 'map',         map;
+			case 'segments',    segments;
+			case 'images',      typed_images;
+			case 'files',       native_files;
+			case 'tiles',       tiles;
+			case 'staging',     staging;
+			case 'large',       large;		% Not in all_tests since it needs about 80 GB of memory
 		end
 	end
 catch
@@ -184,6 +208,463 @@ function coasts()
 	hold off
 	pause(2.0);		delete(h);
 
+function async()
+	disp ('Test async');
+	t = rand(100,3) * 100;
+	t(:,3) = (t(:,1)/150).^2 - (t(:,2)/100).^2 + 1.0;
+	f = gmt('async', 'surface -R0/150/0/100 -I1', t);
+	t = [];			% The job must hold on to its own copy of the input
+	[done, G] = gmt('ready', f);
+	if (~done)
+		G = gmt('wait', f);
+	end
+	if (~isequal(size(G.z), [101 151]))
+		disp('async surface returned a grid of the wrong size')
+	end
+
+function colorize()
+	disp ('Test colorize');
+	G = gmt('grdmath -R0/10/0/5 -I1 X Y MUL =');
+	G.z(3,3) = NaN;
+	C = gmt('makecpt -Cjet -T0/50/5');
+	I = gmt('colorize', G, C);
+	if (~isa(I.image, 'uint8') || ~isequal(size(I.image), [size(G.z) 3]))
+		disp('colorize returned an image of the wrong type or size')
+	end
+	nan_rgb = round(255 * C.bfn(3,:));
+	if (~isequal(double(squeeze(I.image(end-2,3,:)))', nan_rgb))	% Image rows are top-down
+		disp('colorize did not use the NaN color')
+	end
+	C.alpha = C.alpha(1:end-1);
+	try
+		gmt('colorize', G, C);
+		disp('colorize accepted a palette with too few alpha values')
+	catch
+	end
+
+function columnar()
+	disp ('Test columnar multi-segment input');
+	M = [0 0; 1 1; NaN NaN; 2 2; 3 3; 4 4];
+	D1 = gmt('gmtconvert', {M});
+	D2 = gmt('gmtconvert', {M([1 2 4 5 6],:), [1 1 2 2 2]});
+	D3 = gmt('gmtconvert', {M([1 2 4 5 6],:), [1 3]});
+	if (numel(D1) ~= 2 || ~isequal(D1(2).data, [2 2; 3 3; 4 4]))
+		disp('NaN-separated input did not give the expected segments')
+	end
+	if (~isequal(D1(2).data, D2(2).data) || ~isequal(D2(2).data, D3(2).data))
+		disp('segment ids and segment offsets do not agree')
+	end
+
+function vectors()
+	disp ('Test mixed-type column input');
+	S.t = (1:10)';
+	S.z = single(rand(10,1));
+	S.flag = int32(ones(10,1));
+	D = gmt('gmtconvert', S);
+	if (~isequal(size(D.data), [10 3]) || ~isequal(D.data(:,2), double(S.z)))
+		disp('structure of columns did not round-trip')
+	end
+
+function register()
+	disp ('Test resident objects');
+	G = gmt('grdmath -R0/10/0/10 -I1 X Y MUL =');
+	h = gmt('register', G);
+	t1 = gmt('grdtrack -G', [2.5 3.5], h);
+	t2 = gmt('grdtrack -G', [2.5 3.5], G);
+	if (~isequal(t1.data, t2.data))
+		disp('resident grid did not give the same result as the grid itself')
+	end
+	L = gmt('registered');
+	if (numel(L) ~= 1 || L(1).bytes == 0)
+		disp('resident grid was not listed')
+	end
+	H = gmt('grdmath ? 2 MUL =', h);	% grdmath computes on its stack, so it must get a copy
+	H = gmt('grdmath ? 2 MUL =', h);
+	t3 = gmt('grdtrack -G', [2.5 3.5], h);
+	if (~isequal(H.z, 2 * G.z) || ~isequal(t3.data, t2.data))
+		disp('a module changed a resident grid in place')
+	end
+	gmt('unregister', h);
+	if (~isempty(gmt('registered')))
+		disp('unregister did not release the grid')
+	end
+
+function memstats()
+	disp ('Test memory accounting');
+	G = gmt('grdmath -R0/10/0/10 -I1 X =');
+	gmt('gmtinfo', rand(100,2));
+	S = gmt('memstats');
+	k = find(strcmp({S.call.function}, 'gmtmex_dataset_init'));
+	if (S.call(k).aliased ~= 1600 || S.call(k).copied ~= 0)
+		disp('matrix input was not passed by reference')
+	end
+	gmt('grdinfo', G);
+	S = gmt('memstats');
+	k = find(strcmp({S.call.function}, 'gmtmex_grid_init'));
+	if (S.call(k).copied == 0 || S.total(end).calls < 2)
+		disp('grid input copy was not counted')
+	end
+
+function unwind()
+	disp ('Test recovery from failed calls');
+	G = gmt('grdmath -R0/10/0/10 -I1 X =');
+	h = gmt('register', G);
+	for (k = 1:20)		% Each of these ends in an error after the grid was converted
+		try,	gmt('grdsample -I0.5 -Rbad', G);	catch,	end
+		try,	gmt('grdsample -I0.5 -Rbad', h);	catch,	end
+		try,	gmt('map', 'gmtinfo', {rand(3,2), struct('bad', 1)});	catch,	end	% Fails after the workers were made
+	end
+	t = gmt('grdtrack -G', [2.5 3.5], h);
+	if (abs(t.data(3) - 2.5) > 1e-6)
+		disp('resident grid did not survive the failed calls')
+	end
+	gmt('unregister', h);
+
+function stack()
+	disp ('Test grid stacks');
+	G = gmt('grdmath -R0/10/0/10 -I1 X Y MUL =');
+	S = G;
+	S.z = cat(3, G.z, 2*G.z, 3*G.z);
+	S2 = gmt('stack', 'grdmath ? 2 MUL =', S);
+	if (~isequal(size(S2.z), [11 11 3]) || ~isequal(S2.z(:,:,3), 6*G.z))
+		disp('grdmath did not run on every layer')
+	end
+	S3 = gmt('stack', 'grdsample -I2', S);
+	G3 = gmt('grdsample -I2', G);
+	if (~isequal(S3.z(:,:,1), G3.z))
+		disp('grdsample on a stack does not agree with a single grid')
+	end
+	T = gmt('stack', 'grdtrack -G', [2.5 3.5], S);
+	if (numel(T) ~= 3 || abs(T{2}.data(3) - 2*T{1}.data(3)) > 1e-5)
+		disp('grdtrack on a stack did not give one table per layer')
+	end
+
+function matrix()
+	disp ('Test typed matrix output');
+	xy = [0 0; 1 1; 2 2];
+	D  = gmt('mapproject -R0/10/0/10 -JX10c -Fc', xy);
+	M  = gmt('matrix', 'single', 'mapproject -R0/10/0/10 -JX10c -Fc', xy);
+	if (~isa(M, 'single') || ~isequal(size(M), size(D.data)) || max(abs(double(M(:)) - D.data(:))) > 1e-5)
+		disp('single matrix output does not agree with the dataset output')
+	end
+	I = gmt('matrix', 'int32', 'gmtmath -T0/9/1 T =');
+	if (~isa(I, 'int32') || ~isequal(I(:,end), int32((0:9)')))
+		disp('int32 matrix output is wrong')
+	end
+	D = gmt('gmtmath -T0/9/1 T =');
+	if (~isstruct(D))
+		disp('matrix output type leaked into the next call')
+	end
+
+function startup()
+	disp ('Benchmark session startup');
+	n = 20;		x = rand(10,2);
+	clear gmtmex
+	tic;	gmt('gmtinfo', x);	t_cold = toc;	% Pays the full GMT startup
+	gmt('warm', 2);
+	tic;	for (k = 1:n),	gmt('gmtinfo', x);	end;	t_warm = toc / n;
+	fprintf('first call %.1f ms, later calls %.1f ms each\n', 1000 * t_cold, 1000 * t_warm);
+	gmt('gmtinfo -C', x);
+	t = gmt('gmtinfo -C', x);
+	if (~isequal(size(t.data), [1 4]))
+		disp('session was not reset between calls')
+	end
+
+function helpers()
+	disp ('Test the native helper functions');
+	D = gmt('wrapseg', {[1 2; 3 4], [5 6]}, {'> A', '> B'});
+	if (~isequal(size(D), [1 2]) || ~strcmp(D(2).header, '> B') || ~isequal(D(1).data, [1 2; 3 4]))
+		disp('wrapseg did not build the dataset')
+	end
+	D = gmt('wrapseg', {[1 2], [3 4]}, '> H', [], 'note');
+	if (~strcmp(D(2).header, '> H') || ~strcmp(D(1).comment, 'note') || ~isempty(D(2).comment))
+		disp('wrapseg did not spread a header string over the segments')
+	end
+	A = gmt('catseg', D);
+	if (~isequal(A, [1 2; 3 4; 5 6]))
+		disp('catseg did not merge the segments')
+	end
+	A = gmt('catseg', D, 1);
+	if (~isequal(size(A), [5 2]) || ~all(isnan(A([1 4],1))))
+		disp('catseg did not add NaN records')
+	end
+	R = gmt('record', [1 2; 3 4], {'a' 'b'});
+	if (~isequal(size(R.text), [2 1]))
+		disp('record did not store the text as a column')
+	end
+	Z = rand(3, 4);
+	G = gmt('wrapgrid', Z, [0 3 0 2 0 1 0 1 1]);
+	if (~isequal(G.z, Z) || ~isequal(G.x, linspace(0, 3, 4)) || ~isequal(G.y, linspace(0, 2, 3)))
+		disp('wrapgrid did not build the grid')
+	end
+	C = gmt('makecpt -Cjet -T0/10');
+	C2 = gmt('catcpt', C, C);
+	if (size(C2.range, 1) ~= 2 * size(C.range, 1))
+		disp('catcpt did not join the palettes')
+	end
+
+function nodata()
+	disp ('Test no-data sentinels and z range on input');
+	G = gmt('grdmath -R0/10/0/10 -I1 X =');
+	G.z(1:3,1) = -9999;
+	G.nodata = -9999;
+	G.range(5:6) = [100 200];		% Stale on purpose
+	G2 = gmt('grdmath ? 1 MUL =', G);
+	if (sum(isnan(G2.z(:))) ~= 3 || G2.range(5) ~= 0 || G2.range(6) ~= 10)
+		disp('sentinel was not turned into NaN or the z range was not recomputed')
+	end
+
+function layout()
+	disp ('Test row-major grid output');
+	G = gmt('grdmath -R0/10/0/5 -I1 X Y 100 MUL ADD =');
+	T = gmt('layout', 'TRF', 'grdmath -R0/10/0/5 -I1 X Y 100 MUL ADD =');
+	if (~strcmp(T.layout, 'TRF') || ~isequal(size(T.z), [11 6]) || ~isequal(T.z, flipud(G.z)') || T.y(1) ~= 5)
+		disp('TRF grid is not in GMT row order')
+	end
+	G2 = gmt('grdmath ? 2 MUL =', T);	% Accepted back without transposing
+	if (~isequal(G2.z, 2 * G.z))
+		disp('TRF grid input was not understood')
+	end
+
+function threads()
+	disp ('Test module calls from a thread-based pool');
+	if (~exist('backgroundPool', 'builtin') && ~exist('backgroundPool', 'file'))
+		disp('no thread-based pool in this MATLAB, skipped');	return
+	end
+	n = 8;		x = rand(1000,2);
+	for (k = 1:n),	f(k) = parfeval(backgroundPool, @gmt, 1, 'gmtinfo -C', x + k);	end
+	for (k = 1:n)
+		t = fetchOutputs(f(k));
+		if (abs(t.data(1) - min(x(:,1)) - k) > 1e-12)
+			fprintf('thread call %d returned the wrong result\n', k)
+		end
+	end
+	gmt('destroy');		API = gmt('create');	% So that we get a handle to our session
+	f = parfeval(backgroundPool, @gmt, 0, API, 'gmtinfo', x);	% Another thread may not use our session
+	wait(f);
+	if (isempty(f.Error))
+		disp('session was used by another thread')
+	end
+
+function log_sink()
+	disp ('Test the buffered log sink');
+	gmt('log', 'keep');
+	gmt('gmtinfo -Vd', rand(100,2));
+	L = gmt('log');
+	gmt('log', 'console');
+	if (isempty(L) || ~all(isfield(L, {'time' 'level' 'module' 'message'})))
+		disp('messages were not kept')
+	elseif (~any(strcmp({L.level}, 'DEBUG')) || ~any(strcmp({L.module}, 'gmtinfo')))
+		disp('level and module were not split off the messages')
+	end
+	if (~isempty(gmt('log')))
+		disp('the log was not emptied')
+	end
+
+function shared()
+	disp ('Test objects in shared memory');
+	G = gmt('grdmath -R0/10/0/5 -I1 X Y MUL =');
+	x = rand(100,2);
+	gmt('share', G, 'test_grid');	gmt('share', x, 'test_xy');
+	h = gmt('attach', 'test_grid');	hx = gmt('attach', 'test_xy');
+	G2 = gmt('grdmath ? 2 MUL =', h);
+	if (~isequal(G2.z, 2 * G.z))
+		disp('attached grid was not used in place of the original')
+	end
+	t = gmt('gmtinfo -C', hx);
+	if (~isequal(t.data([1 2]), [min(x(:,1)) max(x(:,1))]))
+		disp('attached matrix was not used in place of the original')
+	end
+	gmt('unshare', 'test_grid');	% Our mapping stays valid
+	G2 = gmt('grdmath ? 3 MUL =', h);
+	if (~isequal(G2.z, 3 * G.z))
+		disp('attached grid did not outlive its name')
+	end
+	gmt('unregister', h);	gmt('unregister', hx);	gmt('unshare', 'test_xy');
+	try
+		gmt('attach', 'test_grid');	disp('removed shared object could still be attached')
+	end
+
+function read_cache()
+	disp ('Test the gmtread cache');
+	gmt('write -Tg lixo_cache.nc', gmt('grdmath -R0/10/0/5 -I1 X Y MUL ='));
+	gmt('cache', 'flush');	S0 = gmt('cache', 1e6);
+	G1 = gmt('read -Tg lixo_cache.nc');
+	G2 = gmt('read -Tg lixo_cache.nc');
+	S = gmt('cache');
+	if (S.hits - S0.hits ~= 1 || S.entries ~= 1 || ~isequal(G1.z, G2.z))
+		disp('second read was not served from the cache')
+	end
+	pause(1.1);	gmt('write -Tg lixo_cache.nc', gmt('grdmath -R0/10/0/5 -I1 X Y ADD ='));
+	G3 = gmt('read -Tg lixo_cache.nc');
+	if (isequal(G3.z, G1.z))
+		disp('changed file was served from the cache')
+	end
+	S = gmt('cache', 0);
+	if (S.entries ~= 0)
+		disp('cache was not emptied when turned off')
+	end
+	delete('lixo_cache.nc')
+
+function map()
+	disp ('Test mapping one command over many inputs');
+	x = cell(200, 1);
+	for (k = 1:numel(x)),	x{k} = rand(500, 2) * 10;	end
+	cmd = 'mapproject -R0/10/0/10 -JM10c';
+	tic;	C = gmt('map', cmd, x);	t_map = toc;
+	tic;	L = cell(size(x));	for (k = 1:numel(x)),	L{k} = gmt(cmd, x{k});	end;	t_loop = toc;
+	if (~iscell(C) || ~isequal(size(C), size(x)) || max(abs(C{17}.data(:) - L{17}.data(:))) > 1e-10)
+		disp('map does not agree with a loop over the inputs')
+	end
+	C1 = gmt('map', 1, cmd, x);
+	if (~isequal(C1{end}.data, C{end}.data))
+		disp('map with a single worker gives a different result')
+	end
+	fprintf('%d inputs: MATLAB loop %.1f ms, map %.1f ms\n', numel(x), 1000 * t_loop, 1000 * t_map);
+	G = gmt('grdmath -R0/10/0/10 -I1 X Y MUL =');
+	H = gmt('map', 'grdmath ? 2 MUL =', {G; G});
+	if (~isequal(H{2}.z, 2*G.z))
+		disp('map did not return one grid per input')
+	end
+
+function segments()
+	disp ('Test typed dataset segments');
+	xy = [0 0; 1 1; 2 4; 3 9];
+	D  = gmt('wrapseg', {xy, 2*xy});
+	ref = gmt('gmtinfo -C', D);
+	D(1).data = single(D(1).data);	D(2).data = int32(D(2).data);
+	T = gmt('gmtinfo -C', D);
+	if (~isequal(T.data, ref.data))
+		disp('single and int32 segments were not read as their values')
+	end
+	S = gmt('segments', 'single', 'gmtconvert', D);
+	if (~isa(S(1).data, 'single') || ~isequal(double(S(2).data), 2*xy))
+		disp('segment data was not returned as single')
+	end
+	D(2).data = D(2).data(:,1);
+	try
+		gmt('gmtinfo', D);
+		disp('segments with different numbers of columns were accepted')
+	catch
+	end
+
+function typed_images()
+	disp ('Test uint16, int16 and single images');
+	G = gmt('grdmath -R0/10/0/10 -I1 X Y MUL =');
+	I = gmt('colorize', G, gmt('makecpt -Cgray -T0/100'));
+	for (c = {'uint16', 'int16', 'single'})
+		I2 = I;
+		I2.image = cast(I.image, c{1}) * 100;
+		J = gmt('grdsample -I2', I2);
+		if (~isa(J.image, c{1}) || ~strcmp(J.datatype, c{1}))
+			fprintf('%s image did not come back as %s\n', c{1}, c{1})
+		end
+	end
+
+function native_files()
+	disp ('Test native save and load');
+	file = [tempname '.gmx'];
+	G = gmt('grdmath -R0/10/0/10 -I1 X Y MUL =');
+	D = gmt('wrapseg', {[0 0; 1 1], [2 2; 3 3; 4 4]});
+	C = gmt('makecpt -Cjet -T0/100');
+	objs = {G, D, C, single(rand(1000, 3)), gmt('psbasemap -R0/1/0/1 -JX5c -Baf')};
+	for (k = 1:numel(objs))
+		gmt('save', objs{k}, file);
+		if (~isequaln(gmt('load', file), objs{k}))
+			fprintf('object %d did not round-trip through a native file\n', k)
+		end
+	end
+	xy = rand(1e6, 2) * 10;
+	gmt('save', xy, file);
+	tic;	h = gmt('load', file, 'resident');	t_load = toc;
+	if (~isequal(gmt('gmtinfo -C', h), gmt('gmtinfo -C', xy)))
+		disp('a resident matrix loaded from a native file gives a different result')
+	end
+	gmt('unregister', h);
+	mat = [tempname '.mat'];
+	tic;	save(mat, 'xy', '-v7.3');	S = load(mat);	t_mat = toc;
+	fprintf('1e6 x 2 table: save -v7.3 and load %.1f ms, resident native load %.1f ms\n', 1000 * t_mat, 1000 * t_load);
+	delete(file);	delete(mat);
+
+function tiles()
+	disp ('Test tiled grid modules against untiled runs');
+	G = gmt('grdmath -R0/20/0/40 -I0.05 X 3 DIV SIN Y 5 DIV COS MUL =');
+	cmds = {'grdfilter -Fg1 -D0', 'grdfilter -Fm0.6 -D0', 'grdgradient -A45', 'grdmath ? DDY ? 2 MUL ADD ='};
+	for (k = 1:numel(cmds))
+		tic;	T = gmt('tile', cmds{k}, G);	t_tile = toc;
+		tic;	U = gmt(cmds{k}, G);	t_one = toc;
+		d = abs(double(T.z(:)) - double(U.z(:)));
+		if (~isequal(size(T.z), size(U.z)) || ~isequal(isnan(T.z), isnan(U.z)) || max(d(~isnan(d))) > 1e-5)
+			fprintf('tiled %s does not agree with an untiled run\n', cmds{k})
+		end
+		fprintf('%s: untiled %.1f ms, tiled %.1f ms\n', cmds{k}, 1000 * t_one, 1000 * t_tile);
+	end
+	T = gmt('tile', 4, 'grdmath ? ABS =', G);
+	if (~isequal(T.z, abs(G.z)))
+		disp('tiled grdmath with a given halo does not agree')
+	end
+	bad = {'grdsample -I0.1', 'grdmath ? MEAN =', 'grdmath ? YMAX SUB =', 'grdgradient -A45 -Nt', 'grdgradient -A45 -Sslope.grd'};
+	for (k = 1:numel(bad))
+		try
+			gmt('tile', bad{k}, G);
+			fprintf('tiling %s was accepted\n', bad{k})
+		catch
+		end
+	end
+
+function staging()
+	disp ('Test huge-page staging buffers for input grids');
+	G = gmt('grdmath -R0/100/0/50 -I0.02 X Y MUL =');
+	n = 10;	mb = n * numel(G.z) * 4 / 2^20;
+	modes = {'off', 'on', 'prefault'};
+	for (k = 1:numel(modes))
+		gmt('staging', modes{k});
+		gmt('grdinfo -C', G);	% Makes the buffer, so the loop below measures reuse
+		S0 = gmt('staging');
+		tic;	for (j = 1:n),	I = gmt('grdinfo -C', G);	end;	t = toc;
+		S1 = gmt('staging');
+		if (k == 1),	ref = I;	elseif (~isequal(I, ref))
+			fprintf('grdinfo of a grid in a %s staging buffer gives a different result\n', modes{k})
+		end
+		fprintf('staging %-8s: %6.0f MB/s, %9d minor faults, %d maps, %d reuses\n', modes{k}, mb / t, ...
+			S1.minor_faults - S0.minor_faults, S1.maps - S0.maps, S1.reuses - S0.reuses);
+	end
+	if (S1.reuses - S0.reuses ~= n)
+		disp('staging buffers were not reused')
+	end
+	H = gmt('grdmath ? 2 MUL =', G);
+	if (~isequal(H.z, 2 * G.z))
+		disp('a module gave a different grid from a staged input')
+	end
+	gmt('staging', 'off');
+	S = gmt('staging');
+	if (S.buffers ~= 0)
+		disp('turning staging off did not release the buffers')
+	end
+
+function large()
+	disp ('Test objects with more than 2^31 elements');
+	n = 46342;		% n*n > 2^31
+	Z = zeros(n, n, 'single');
+	Z(end,end) = 1;		% Only the last node (the north-east corner) is non-zero
+	G = gmt('wrapgrid', Z, [1 n 1 n 0 1 0 1 1]);
+	clear Z
+	t = gmt('grdtrack -G', [n n], G);
+	if (t.data(3) ~= 1)
+		disp('grid node beyond 2^31 was not found')
+	end
+	G2 = gmt('grdmath ? 2 MUL =', G);
+	if (G2.z(end,end) ~= 2 || G2.range(6) ~= 2)
+		disp('grid with more than 2^31 nodes did not round-trip')
+	end
+	clear G G2
+	S.data = zeros(2^31 + 10, 1);
+	S.data(end) = 1;
+	D = gmt('gmtconvert', S);		% A dataset structure is copied record by record
+	if (D.data(end) ~= 1)
+		disp('record beyond 2^31 was lost')
+	end
+
 function grdcut()
 	G  = gmt('grdmath -R-10/10/-10/10 -I0.5 X =');
 	% Does not cut